@@ -505,16 +505,6 @@ XLowerWindow(display, w)
     panic("Not implemented: XLowerWindow");
 }
 
-void 
-XChangeGC(
-    Display*		display ,
-    GC			gc,
-    unsigned long	valuemask,
-    XGCValues*		values
-    ) 
-{
-    panic("Not implemented: XChangeGC");
-}
 
 extern Window XCreateWindow(
     Display*		display,
@@ -328,6 +328,24 @@ static Tk_ConfigSpec configSpecs[] = {
 static Tcl_HashTable imgPhotoHash;
 static int imgPhotoHashInitialized;	/* set when Tcl_InitHashTable done */
 
+/*
+ * Hex digits used for the pixel data of "put -binary" and "get -region",
+ * and their values (-1 for other characters), filled in on first use.
+ */
+
+static char hexDigits[] = "0123456789abcdef";
+static signed char hexValues[256];
+static int hexValuesInitialized;
+
+/*
+ * Largest number of pixel bytes, line padding included, that "put
+ * -binary" and "get -region" handle in one call.  This also bounds
+ * -width times -pixelsize and -stride, so none of the sizes computed
+ * from them can overflow.
+ */
+
+#define MAX_BINARY_BYTES 0x4000000
+
 /*
  * Hash table used to hash from (display, colormap, palette, gamma)
  * to ColorTable address.
@@ -343,6 +361,64 @@ static int imgPhotoColorHashInitialized;
 
 static Tk_PhotoImageFormat *formatList = NULL;
 
+/*
+ * Signatures of photo image formats, registered with
+ * Tk_CreatePhotoFormatSignature.  MatchFileFormat reads the start of a
+ * file once and looks it up in signatureIndex, by the byte found at
+ * each offset some signature is registered for, so it can try the
+ * right format first.  A format whose handler registered signatures
+ * itself is skipped for files that carry none of them.  The built-in
+ * signatures of the common formats below only decide which format is
+ * tried first, since the handlers of such a format may read variants
+ * of it that don't carry them.  Formats without signatures are still
+ * probed one by one.
+ */
+
+#define SIGNATURE_HEADER 32	/* Signatures must lie in the first
+				 * SIGNATURE_HEADER bytes of a file. */
+
+typedef struct FormatSignature {
+    char *name;			/* Name of the format. */
+    int offset;			/* Offset of the signature in a file. */
+    int length;			/* Number of bytes in the signature. */
+    unsigned char bytes[SIGNATURE_HEADER];
+				/* The signature. */
+    int builtin;		/* Non-zero for defaultSignatures, which
+				 * don't rule a format out. */
+    struct FormatSignature *nextPtr;
+				/* Next in signatureList. */
+    struct FormatSignature *bucketNextPtr;
+				/* Next with the same first byte. */
+} FormatSignature;
+
+static FormatSignature *signatureList = NULL;
+				/* All signatures. */
+static FormatSignature *signatureIndex[256];
+				/* Signatures by their first byte. */
+static int *signatureOffsets = NULL;
+				/* The different offsets signatures have. */
+static int numSignatureOffsets = 0;
+static int signaturesInitialized = 0;
+
+/*
+ * Magic numbers that the files of some common formats usually start
+ * with.
+ */
+
+static struct {
+    char *name;
+    int offset;
+    char *bytes;
+    int length;
+} defaultSignatures[] = {
+    {"GIF",	0,	"GIF87a",		6},
+    {"GIF",	0,	"GIF89a",		6},
+    {"PNG",	0,	"\211PNG\r\n\032\n",	8},
+    {"JPEG",	0,	"\377\330",		2},
+    {"BMP",	0,	"BM",			2},
+    {NULL,	0,	NULL,			0}
+};
+
 /*
  * Forward declarations
  */
@@ -386,6 +462,18 @@ static void		Dither _ANSI_ARGS_((PhotoMaster *masterPtr,
 			    int x, int y, int width, int height));
 static void		DitherInstance _ANSI_ARGS_((PhotoInstance *instancePtr,
 			    int x, int y, int width, int height));
+static int		PhotoGetRegion _ANSI_ARGS_((PhotoMaster *masterPtr,
+			    Tcl_Interp *interp, int argc, char **argv));
+static int		PhotoPutBinary _ANSI_ARGS_((PhotoMaster *masterPtr,
+			    Tcl_Interp *interp, int argc, char **argv));
+static int		AddSignature _ANSI_ARGS_((char *name, int offset,
+			    char *bytes, int length, int builtin));
+static int		CheckSignature _ANSI_ARGS_((
+			    Tk_PhotoImageFormat *formatPtr,
+			    unsigned char *header, int headerLength));
+static void		InitFormatSignatures _ANSI_ARGS_((void));
+static Tk_PhotoImageFormat *	LookupSignature _ANSI_ARGS_((
+			    unsigned char *header, int headerLength));
 
 #undef MIN
 #define MIN(a, b)	((a) < (b)? (a): (b))
@@ -429,6 +517,225 @@ Tk_CreatePhotoImageFormat(formatPtr)
     copyPtr->nextPtr = formatList;
     formatList = copyPtr;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Tk_CreatePhotoFormatSignature --
+ *
+ *	This procedure is invoked by an image file handler to register
+ *	bytes that every file of its format carries at a fixed offset,
+ *	such as "GIF8" at offset 0.  A format may have several
+ *	signatures; a file of the format must carry one of them.
+ *
+ * Results:
+ *	TCL_OK, or TCL_ERROR if the signature doesn't lie within the
+ *	first SIGNATURE_HEADER bytes of a file.
+ *
+ * Side effects:
+ *	MatchFileFormat tries the format first for files that carry the
+ *	signature, and doesn't try it at all for files that carry none
+ *	of the signatures registered for it this way.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Tk_CreatePhotoFormatSignature(name, offset, bytes, length)
+    char *name;			/* Name of the format, as given to
+				 * Tk_CreatePhotoImageFormat. */
+    int offset;			/* Offset of the signature in a file. */
+    char *bytes;		/* Bytes of the signature. */
+    int length;			/* Number of bytes. */
+{
+    return AddSignature(name, offset, bytes, length, 0);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddSignature --
+ *
+ *	Enter a signature in the signature list and index.
+ *
+ * Results:
+ *	TCL_OK, or TCL_ERROR if the signature doesn't lie within the
+ *	first SIGNATURE_HEADER bytes of a file.
+ *
+ * Side effects:
+ *	Allocates memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+AddSignature(name, offset, bytes, length, builtin)
+    char *name;			/* Name of the format. */
+    int offset;			/* Offset of the signature in a file. */
+    char *bytes;		/* Bytes of the signature. */
+    int length;			/* Number of bytes. */
+    int builtin;		/* Non-zero for defaultSignatures. */
+{
+    FormatSignature *sigPtr;
+    int i;
+
+    if ((offset < 0) || (length <= 0)
+	    || (offset + length > SIGNATURE_HEADER)) {
+	return TCL_ERROR;
+    }
+    sigPtr = (FormatSignature *) ckalloc(sizeof(FormatSignature));
+    sigPtr->name = (char *) ckalloc((unsigned) (strlen(name) + 1));
+    strcpy(sigPtr->name, name);
+    sigPtr->offset = offset;
+    sigPtr->length = length;
+    memcpy((VOID *) sigPtr->bytes, (VOID *) bytes, (size_t) length);
+    sigPtr->builtin = builtin;
+    sigPtr->nextPtr = signatureList;
+    signatureList = sigPtr;
+    sigPtr->bucketNextPtr = signatureIndex[sigPtr->bytes[0]];
+    signatureIndex[sigPtr->bytes[0]] = sigPtr;
+
+    for (i = 0; i < numSignatureOffsets; i++) {
+	if (signatureOffsets[i] == offset) {
+	    break;
+	}
+    }
+    if (i == numSignatureOffsets) {
+	signatureOffsets = (int *) ckrealloc((char *) signatureOffsets,
+		(unsigned) ((numSignatureOffsets + 1) * sizeof(int)));
+	signatureOffsets[numSignatureOffsets++] = offset;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InitFormatSignatures --
+ *
+ *	Register the signatures of the common formats whose files
+ *	usually start with a fixed magic number.  They only order the
+ *	formats MatchFileFormat tries.  Signatures of formats that
+ *	aren't registered are harmless.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Fills in the signature index.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+InitFormatSignatures()
+{
+    int i;
+
+    if (signaturesInitialized) {
+	return;
+    }
+    signaturesInitialized = 1;
+    for (i = 0; defaultSignatures[i].name != NULL; i++) {
+	AddSignature(defaultSignatures[i].name, defaultSignatures[i].offset,
+		defaultSignatures[i].bytes, defaultSignatures[i].length, 1);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CheckSignature --
+ *
+ *	Tell whether the start of a file carries a signature that the
+ *	handler of a format registered with
+ *	Tk_CreatePhotoFormatSignature.
+ *
+ * Results:
+ *	-1 if the handler registered no signatures for the format, 1
+ *	if the header carries one of them, 0 if it doesn't.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CheckSignature(formatPtr, header, headerLength)
+    Tk_PhotoImageFormat *formatPtr;
+    unsigned char *header;	/* First bytes of the file. */
+    int headerLength;		/* Number of bytes in header. */
+{
+    FormatSignature *sigPtr;
+    int result = -1;
+
+    for (sigPtr = signatureList; sigPtr != NULL; sigPtr = sigPtr->nextPtr) {
+	if (sigPtr->builtin
+		|| (strcasecmp(sigPtr->name, formatPtr->name) != 0)) {
+	    continue;
+	}
+	if ((sigPtr->offset + sigPtr->length <= headerLength)
+		&& (memcmp((VOID *) (header + sigPtr->offset),
+			(VOID *) sigPtr->bytes,
+			(size_t) sigPtr->length) == 0)) {
+	    return 1;
+	}
+	result = 0;
+    }
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LookupSignature --
+ *
+ *	Find the format whose signature the start of a file carries.
+ *
+ * Results:
+ *	The format record, or NULL if no registered format has a
+ *	signature that matches.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tk_PhotoImageFormat *
+LookupSignature(header, headerLength)
+    unsigned char *header;	/* First bytes of the file. */
+    int headerLength;		/* Number of bytes in header. */
+{
+    FormatSignature *sigPtr;
+    Tk_PhotoImageFormat *formatPtr;
+    int i, offset;
+
+    for (i = 0; i < numSignatureOffsets; i++) {
+	offset = signatureOffsets[i];
+	if (offset >= headerLength) {
+	    continue;
+	}
+	for (sigPtr = signatureIndex[header[offset]]; sigPtr != NULL;
+		sigPtr = sigPtr->bucketNextPtr) {
+	    if ((sigPtr->offset != offset)
+		    || (offset + sigPtr->length > headerLength)
+		    || (memcmp((VOID *) (header + offset),
+			    (VOID *) sigPtr->bytes,
+			    (size_t) sigPtr->length) != 0)) {
+		continue;
+	    }
+	    for (formatPtr = formatList; formatPtr != NULL;
+		    formatPtr = formatPtr->nextPtr) {
+		if (strcasecmp(sigPtr->name, formatPtr->name) == 0) {
+		    return formatPtr;
+		}
+	    }
+	}
+    }
+    return NULL;
+}
 
 /*
  *----------------------------------------------------------------------
@@ -699,6 +1006,9 @@ ImgPhotoCmd(clientData, interp, argc, argv)
 	 * photo get command - first parse and check parameters.
 	 */
 
+	if ((argc > 2) && (strcmp(argv[2], "-region") == 0)) {
+	    return PhotoGetRegion(masterPtr, interp, argc, argv);
+	}
 	if (argc != 4) {
 	    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
 		    " get x y\"", (char *) NULL);
@@ -728,6 +1038,9 @@ ImgPhotoCmd(clientData, interp, argc, argv)
 	 * photo put command - first parse the options and colors specified.
 	 */
 
+	if ((argc > 2) && (strcmp(argv[2], "-binary") == 0)) {
+	    return PhotoPutBinary(masterPtr, interp, argc, argv);
+	}
 	index = 2;
 	memset((VOID *) &options, 0, sizeof(options));
 	options.name = NULL;
@@ -1024,6 +1337,355 @@ ImgPhotoCmd(clientData, interp, argc, argv)
 
     return TCL_OK;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PhotoPutBinary --
+ *
+ *	This procedure is invoked to process the "put -binary" form of
+ *	the photo image widget command:
+ *
+ *	    imageName put -binary data -width w ?-height h?
+ *		    ?-pixelsize 3|4? ?-stride bytes? ?-to x1 y1 ?x2 y2??
+ *
+ *	The data are the bytes of the pixels, RGB or RGBA, two hex
+ *	digits per byte, with stride bytes from the start of one line
+ *	to the start of the next.  The alpha byte is ignored.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	The pixels are stored in the image with Tk_PhotoPutBlock.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+PhotoPutBinary(masterPtr, interp, argc, argv)
+    PhotoMaster *masterPtr;	/* Image to store the pixels in. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings; argv[2] is
+				 * "-binary". */
+{
+    Tk_PhotoImageBlock block;
+    unsigned char *bytePtr;
+    char *data, *option;
+    size_t length, numBytes, needed, i;
+    int width, height, pixelSize, stride, rowBytes;
+    int to[4], numTo, index, hi, lo;
+
+    if (argc < 4) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" put -binary data -width width ?-height height?",
+		" ?-pixelsize 3|4? ?-stride bytes? ?-to x1 y1 ?x2 y2??\"",
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+    data = argv[3];
+    width = height = stride = -1;
+    pixelSize = 3;
+    to[0] = to[1] = 0;
+    numTo = 2;
+
+    for (index = 4; index < argc; index++) {
+	option = argv[index];
+	length = strlen(option);
+	if (index + 1 >= argc) {
+	    Tcl_AppendResult(interp, "value for \"", option, "\" missing",
+		    (char *) NULL);
+	    return TCL_ERROR;
+	}
+	if ((length > 1) && (strncmp(option, "-to", length) == 0)) {
+	    for (numTo = 0; (numTo < 4) && (index + 1 < argc)
+		    && (isdigit(UCHAR(argv[index+1][0]))
+			|| ((argv[index+1][0] == '-')
+			    && isdigit(UCHAR(argv[index+1][1])))); numTo++) {
+		if (Tcl_GetInt(interp, argv[++index], &to[numTo]) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+	    }
+	    if ((numTo != 2) && (numTo != 4)) {
+		Tcl_AppendResult(interp, "the \"-to\" option ",
+			"requires two or four coordinate values",
+			(char *) NULL);
+		return TCL_ERROR;
+	    }
+	    if ((to[0] < 0) || (to[1] < 0) || ((numTo == 4)
+		    && ((to[2] <= to[0]) || (to[3] <= to[1])))) {
+		Tcl_AppendResult(interp, "value(s) for the -to option ",
+			"must be non-negative", (char *) NULL);
+		return TCL_ERROR;
+	    }
+	    continue;
+	}
+	if ((length > 1) && (strncmp(option, "-width", length) == 0)) {
+	    if (Tcl_GetInt(interp, argv[++index], &width) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	} else if ((length > 1) && (strncmp(option, "-height", length) == 0)) {
+	    if (Tcl_GetInt(interp, argv[++index], &height) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	} else if ((length > 1)
+		&& (strncmp(option, "-pixelsize", length) == 0)) {
+	    if (Tcl_GetInt(interp, argv[++index], &pixelSize) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	} else if ((length > 1) && (strncmp(option, "-stride", length) == 0)) {
+	    if (Tcl_GetInt(interp, argv[++index], &stride) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	} else {
+	    Tcl_AppendResult(interp, "unrecognized option \"", option,
+		    "\": must be -height, -pixelsize, -stride, -to, or -width",
+		    (char *) NULL);
+	    return TCL_ERROR;
+	}
+    }
+
+    if (width <= 0) {
+	Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		"a positive -width must be given", (char *) NULL);
+	return TCL_ERROR;
+    }
+    if ((pixelSize != 3) && (pixelSize != 4)) {
+	Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		"-pixelsize must be 3 or 4", (char *) NULL);
+	return TCL_ERROR;
+    }
+    if (width > MAX_BINARY_BYTES / pixelSize) {
+	Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		"-width is too large", (char *) NULL);
+	return TCL_ERROR;
+    }
+    rowBytes = width * pixelSize;
+    if (stride < 0) {
+	stride = rowBytes;
+    } else if (stride < rowBytes) {
+	Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		"-stride is less than -width times -pixelsize", (char *) NULL);
+	return TCL_ERROR;
+    } else if (stride > MAX_BINARY_BYTES) {
+	Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		"-stride is too large", (char *) NULL);
+	return TCL_ERROR;
+    }
+    length = strlen(data);
+    if (length & 1) {
+	Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		"odd number of hex digits", (char *) NULL);
+	return TCL_ERROR;
+    }
+    numBytes = length / 2;
+    if (height < 0) {
+	if (numBytes == 0) {
+	    height = 0;
+	} else if (numBytes <= (size_t) rowBytes) {
+	    height = 1;
+	} else {
+	    height = (numBytes - rowBytes) / stride + 1;
+	}
+    }
+    if (height == 0) {
+	return TCL_OK;
+    }
+    if ((size_t) (height - 1) > (size_t) (MAX_BINARY_BYTES - rowBytes)
+	    / stride) {
+	Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		"image is too large", (char *) NULL);
+	return TCL_ERROR;
+    }
+    needed = (size_t) (height - 1) * stride + rowBytes;
+    if (numBytes < needed) {
+	Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		"not enough data for the image size", (char *) NULL);
+	return TCL_ERROR;
+    }
+
+    /*
+     * Decode the bytes straight into the block; the line padding is
+     * decoded too and simply skipped by Tk_PhotoPutBlock.
+     */
+
+    if (!hexValuesInitialized) {
+	memset((VOID *) hexValues, -1, sizeof(hexValues));
+	for (i = 0; i < 16; i++) {
+	    hexValues[UCHAR(hexDigits[i])] = i;
+	    hexValues[toupper(UCHAR(hexDigits[i]))] = i;
+	}
+	hexValuesInitialized = 1;
+    }
+    bytePtr = (unsigned char *) ckalloc((unsigned) needed);
+    for (i = 0; i < needed; i++) {
+	hi = hexValues[UCHAR(data[2*i])];
+	lo = hexValues[UCHAR(data[2*i+1])];
+	if ((hi < 0) || (lo < 0)) {
+	    ckfree((char *) bytePtr);
+	    Tcl_AppendResult(interp, argv[0], " put -binary: ",
+		    "data contain a character that isn't a hex digit",
+		    (char *) NULL);
+	    return TCL_ERROR;
+	}
+	bytePtr[i] = (hi << 4) | lo;
+    }
+
+    if (numTo == 2) {
+	to[2] = to[0] + width;
+	to[3] = to[1] + height;
+    }
+    block.pixelPtr = bytePtr;
+    block.width = width;
+    block.height = height;
+    block.pitch = stride;
+    block.pixelSize = pixelSize;
+    block.offset[0] = 0;
+    block.offset[1] = 1;
+    block.offset[2] = 2;
+    Tk_PhotoPutBlock((Tk_PhotoHandle) masterPtr, &block, to[0], to[1],
+	    to[2] - to[0], to[3] - to[1]);
+    ckfree((char *) bytePtr);
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PhotoGetRegion --
+ *
+ *	This procedure is invoked to process the "get -region" form of
+ *	the photo image widget command:
+ *
+ *	    imageName get -region x1 y1 x2 y2 ?-pixelsize 3|4?
+ *		    ?-stride bytes?
+ *
+ *	It returns the pixels of the rectangle from (x1,y1) up to but
+ *	not including (x2,y2) in the format "put -binary" accepts.
+ *	Alpha bytes are 255, line padding is zero.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+PhotoGetRegion(masterPtr, interp, argc, argv)
+    PhotoMaster *masterPtr;	/* Image to read the pixels from. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings; argv[2] is
+				 * "-region". */
+{
+    Tk_PhotoImageBlock block;
+    unsigned char *srcPtr, *linePtr;
+    char *result, *dstPtr, *option;
+    size_t length, numBytes;
+    int region[4], pixelSize, stride, rowBytes, index, x, y, pad;
+
+    if (argc < 7) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" get -region x1 y1 x2 y2 ?-pixelsize 3|4? ?-stride bytes?\"",
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+    for (index = 0; index < 4; index++) {
+	if (Tcl_GetInt(interp, argv[index + 3], &region[index]) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+    }
+    if ((region[0] < 0) || (region[1] < 0) || (region[2] <= region[0])
+	    || (region[3] <= region[1]) || (region[2] > masterPtr->width)
+	    || (region[3] > masterPtr->height)) {
+	Tcl_AppendResult(interp, argv[0], " get: ",
+		"coordinates out of range", (char *) NULL);
+	return TCL_ERROR;
+    }
+    pixelSize = 3;
+    stride = -1;
+    for (index = 7; index < argc; index += 2) {
+	option = argv[index];
+	length = strlen(option);
+	if (index + 1 >= argc) {
+	    Tcl_AppendResult(interp, "value for \"", option, "\" missing",
+		    (char *) NULL);
+	    return TCL_ERROR;
+	}
+	if ((length > 1) && (strncmp(option, "-pixelsize", length) == 0)) {
+	    if (Tcl_GetInt(interp, argv[index + 1], &pixelSize) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	} else if ((length > 1) && (strncmp(option, "-stride", length) == 0)) {
+	    if (Tcl_GetInt(interp, argv[index + 1], &stride) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	} else {
+	    Tcl_AppendResult(interp, "unrecognized option \"", option,
+		    "\": must be -pixelsize or -stride", (char *) NULL);
+	    return TCL_ERROR;
+	}
+    }
+    if ((pixelSize != 3) && (pixelSize != 4)) {
+	Tcl_AppendResult(interp, argv[0], " get -region: ",
+		"-pixelsize must be 3 or 4", (char *) NULL);
+	return TCL_ERROR;
+    }
+    if (region[2] - region[0] > MAX_BINARY_BYTES / pixelSize) {
+	Tcl_AppendResult(interp, argv[0], " get -region: ",
+		"region is too large", (char *) NULL);
+	return TCL_ERROR;
+    }
+    rowBytes = (region[2] - region[0]) * pixelSize;
+    if (stride < 0) {
+	stride = rowBytes;
+    } else if (stride < rowBytes) {
+	Tcl_AppendResult(interp, argv[0], " get -region: ",
+		"-stride is less than the region width times -pixelsize",
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+    if ((stride > MAX_BINARY_BYTES) || ((size_t) (region[3] - region[1])
+	    > (size_t) MAX_BINARY_BYTES / stride)) {
+	Tcl_AppendResult(interp, argv[0], " get -region: ",
+		"region is too large", (char *) NULL);
+	return TCL_ERROR;
+    }
+    pad = stride - rowBytes;
+    numBytes = (size_t) (region[3] - region[1]) * stride;
+
+    Tk_PhotoGetImage((Tk_PhotoHandle) masterPtr, &block);
+    result = (char *) ckalloc((unsigned) (numBytes * 2 + 1));
+    dstPtr = result;
+    for (y = region[1]; y < region[3]; y++) {
+	linePtr = block.pixelPtr + y * block.pitch
+		+ region[0] * block.pixelSize;
+	for (x = region[0]; x < region[2]; x++) {
+	    for (index = 0; index < 3; index++) {
+		srcPtr = linePtr + block.offset[index];
+		*dstPtr++ = hexDigits[*srcPtr >> 4];
+		*dstPtr++ = hexDigits[*srcPtr & 0xf];
+	    }
+	    if (pixelSize == 4) {
+		*dstPtr++ = 'f';
+		*dstPtr++ = 'f';
+	    }
+	    linePtr += block.pixelSize;
+	}
+	for (index = 0; index < pad; index++) {
+	    *dstPtr++ = '0';
+	    *dstPtr++ = '0';
+	}
+    }
+    *dstPtr = '\0';
+    Tcl_AppendResult(interp, result, (char *) NULL);
+    ckfree(result);
+    return TCL_OK;
+}
 
 /*
  *----------------------------------------------------------------------
@@ -1503,6 +2165,9 @@ ImgPhotoConfigureInstance(instancePtr)
 	if ((instancePtr->imagePtr == NULL)
 		|| (instancePtr->imagePtr->bits_per_pixel != bitsPerPixel)) {
 	    if (instancePtr->imagePtr != NULL) {
+#if (defined(__OS2__) || defined(__EMX__))
+		TkOS2ShmDetach(instancePtr->imagePtr);
+#endif
 		XFree((char *) instancePtr->imagePtr);
 	    }
 	    imagePtr = XCreateImage(instancePtr->display,
@@ -2644,6 +3309,57 @@ AllocateColors(colorPtr)
 	 */
 
 	pixels = (unsigned long *) ckalloc(numColors * sizeof(unsigned long));
+#if (defined(__OS2__) || defined(__EMX__))
+	{
+	    /*
+	     * Allocate the whole cube in one palette transaction instead
+	     * of one XAllocColor (and palette update) per color.
+	     */
+
+	    int *status = (int *) ckalloc(2 * numColors * sizeof(int));
+	    int *retryStatus = status + numColors;
+	    int nAlloc, nFailed, j;
+	    XColor *retry;
+
+	    nAlloc = TkOS2AllocColors(colorPtr->id.display,
+		    colorPtr->id.colormap, colors, numColors, status);
+	    nFailed = numColors - nAlloc;
+	    if (nFailed > 0 && ReclaimColors(&colorPtr->id, nFailed)) {
+		/*
+		 * Freed colors from other unused color tables; try the
+		 * ones we couldn't get again, also in one go.
+		 */
+
+		retry = (XColor *) ckalloc(nFailed * sizeof(XColor));
+		for (i = j = 0; i < numColors; ++i) {
+		    if (!status[i]) {
+			retry[j++] = colors[i];
+		    }
+		}
+		nAlloc += TkOS2AllocColors(colorPtr->id.display,
+			colorPtr->id.colormap, retry, nFailed, retryStatus);
+		for (i = j = 0; i < numColors; ++i) {
+		    if (!status[i]) {
+			colors[i] = retry[j];
+			status[i] = retryStatus[j++];
+		    }
+		}
+		ckfree((char *) retry);
+	    }
+
+	    /*
+	     * Pass on the pixels we got; i ends up as the number of
+	     * colors allocated, as in the loop below.
+	     */
+
+	    for (i = j = 0; j < numColors; ++j) {
+		if (status[j]) {
+		    pixels[i++] = colors[j].pixel;
+		}
+	    }
+	    ckfree((char *) status);
+	}
+#else
 	for (i = 0; i < numColors; ++i) {
 	    if (!XAllocColor(colorPtr->id.display, colorPtr->id.colormap,
 		    &colors[i])) {
@@ -2664,6 +3380,7 @@ AllocateColors(colorPtr)
 	    }
 	    pixels[i] = colors[i].pixel;
 	}
+#endif
 
 	/*
 	 * If we didn't get all of the colors, reduce the
@@ -2955,6 +3672,9 @@ DisposeInstance(clientData)
 	Tk_FreeGC(instancePtr->display, instancePtr->gc);
     }
     if (instancePtr->imagePtr != NULL) {
+#if (defined(__OS2__) || defined(__EMX__))
+	TkOS2ShmDetach(instancePtr->imagePtr);
+#endif
 	XFree((char *) instancePtr->imagePtr);
     }
     if (instancePtr->error != NULL) {
@@ -2986,6 +3706,8 @@ DisposeInstance(clientData)
  *	handler which can parse the image data in the given file.
  *	If a user-specified format string is provided, only handlers
  *	whose names match a prefix of the format string are tried.
+ *	The format whose signature the file carries, if any, is tried
+ *	first, and formats with other signatures are skipped.
  *
  * Results:
  *	A standard TCL return value.  If the return value is TCL_OK, a
@@ -3012,8 +3734,37 @@ MatchFileFormat(interp, f, fileName, formatString, imageFormatPtr,
     int *widthPtr, *heightPtr;	/* The dimensions of the image are
 				 * returned here. */
 {
-    int matched;
-    Tk_PhotoImageFormat *formatPtr;
+    int matched, headerLength;
+    unsigned char header[SIGNATURE_HEADER];
+    Tk_PhotoImageFormat *formatPtr, *sigFormatPtr;
+
+    /*
+     * Read the start of the file once and try the format whose
+     * signature it carries first.
+     */
+
+    InitFormatSignatures();
+    fseek(f, 0L, SEEK_SET);
+    headerLength = fread((VOID *) header, 1, SIGNATURE_HEADER, f);
+    sigFormatPtr = LookupSignature(header, headerLength);
+    if ((sigFormatPtr != NULL) && (sigFormatPtr->fileMatchProc != NULL)
+	    && ((formatString == NULL)
+		|| (strncasecmp(formatString, sigFormatPtr->name,
+			strlen(sigFormatPtr->name)) == 0))) {
+	fseek(f, 0L, SEEK_SET);
+	if ((*sigFormatPtr->fileMatchProc)(f, fileName, formatString,
+		widthPtr, heightPtr)) {
+	    if (*widthPtr < 1) {
+		*widthPtr = 1;
+	    }
+	    if (*heightPtr < 1) {
+		*heightPtr = 1;
+	    }
+	    *imageFormatPtr = sigFormatPtr;
+	    fseek(f, 0L, SEEK_SET);
+	    return TCL_OK;
+	}
+    }
 
     /*
      * Scan through the table of file format handlers to find
@@ -3035,6 +3786,10 @@ MatchFileFormat(interp, f, fileName, formatString, imageFormatPtr,
 		return TCL_ERROR;
 	    }
 	}
+	if ((formatPtr == sigFormatPtr)
+		|| (CheckSignature(formatPtr, header, headerLength) == 0)) {
+	    continue;		/* Already tried, or can't match. */
+	}
 	if (formatPtr->fileMatchProc != NULL) {
 	    fseek(f, 0L, SEEK_SET);
 	    if ((*formatPtr->fileMatchProc)(f, fileName, formatString,
@@ -3615,7 +4370,7 @@ DitherInstance(instancePtr, xStart, yStart, width, height)
     int nLines, bigEndian;
     int i, c, x, y;
     int xEnd, yEnd;
-    int bitsPerPixel, bytesPerLine, lineLength;
+    int bitsPerPixel, bytesPerLine, lineLength, lineStep;
     unsigned char *srcLinePtr, *srcPtr;
     schar *errLinePtr, *errPtr;
     unsigned char *destBytePtr, *dstLinePtr;
@@ -3667,6 +4422,19 @@ DitherInstance(instancePtr, xStart, yStart, width, height)
     imagePtr->width = width;
     imagePtr->height = nLines;
     imagePtr->bytes_per_line = bytesPerLine;
+    lineStep = bytesPerLine;
+#if (defined(__OS2__) || defined(__EMX__))
+    /*
+     * Dither straight into a buffer that stays with the image and is
+     * kept bottom line first, so TkPutImage doesn't have to reverse
+     * (and copy) every block.  Bitmaps still go through the normal
+     * path, which aligns and reverses them anyway.
+     */
+
+    if ((bitsPerPixel > 1) && TkOS2ShmAttach(imagePtr, bytesPerLine, nLines)) {
+	lineStep = -bytesPerLine;
+    } else
+#endif
     imagePtr->data = (char *) ckalloc((unsigned) (imagePtr->bytes_per_line * nLines));
     bigEndian = imagePtr->bitmap_bit_order == MSBFirst;
     firstBit = bigEndian? (1 << (imagePtr->bitmap_unit - 1)): 1;
@@ -3686,6 +4454,9 @@ DitherInstance(instancePtr, xStart, yStart, width, height)
 	    nLines = height;
 	}
 	dstLinePtr = (unsigned char *) imagePtr->data;
+	if (lineStep < 0) {
+	    dstLinePtr += (imagePtr->height - 1) * bytesPerLine;
+	}
 	yEnd = yStart + nLines;
 	for (y = yStart; y < yEnd; ++y) {
 	    srcPtr = srcLinePtr;
@@ -3887,7 +4658,7 @@ DitherInstance(instancePtr, xStart, yStart, width, height)
 	    }
 	    srcLinePtr += lineLength;
 	    errLinePtr += lineLength;
-	    dstLinePtr += bytesPerLine;
+	    dstLinePtr += lineStep;
 	}
 
 	/*
@@ -3903,7 +4674,9 @@ DitherInstance(instancePtr, xStart, yStart, width, height)
 	
     }
 
-    ckfree(imagePtr->data);
+    if (lineStep > 0) {
+	ckfree(imagePtr->data);
+    }
     imagePtr->data = NULL;
 }
 
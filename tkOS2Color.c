@@ -20,6 +20,13 @@
 
 static int initialized = 0;
 
+/*
+ * Maximum number of color specifications remembered per colormap by
+ * XParseColor.  When the cache fills up it is simply flushed.
+ */
+
+#define MAX_SPEC_CACHE	256
+
 /*
  * colorTable is a hash table used to look up X colors by name.
  */
@@ -97,6 +104,63 @@ static int GetColorByName _ANSI_ARGS_((char *name, XColor *color));
 static int GetColorByValue _ANSI_ARGS_((char *value, XColor *color));
 static void InitColorTable _ANSI_ARGS_((void));
 static void SetSystemColors _ANSI_ARGS_((void));
+static int ParseHex _ANSI_ARGS_((char *string, int length, int *valuePtr));
+static void FlushSpecCache _ANSI_ARGS_((TkOS2Colormap *cmap));
+static int GrowShadow _ANSI_ARGS_((TkOS2Colormap *cmap, ULONG count));
+static int SetShadowEntry _ANSI_ARGS_((TkOS2Colormap *cmap, ULONG index,
+	ULONG rgb));
+static void MarkStale _ANSI_ARGS_((TkOS2Colormap *cmap));
+static void RealizeStaleColormap _ANSI_ARGS_((ClientData clientData));
+static int InitNearestColors _ANSI_ARGS_((void));
+static LONG NearestColor _ANSI_ARGS_((LONG rgb, LONG *indexPtr));
+static void LogColorTableChanged _ANSI_ARGS_((LONG index, LONG rgb));
+
+/*
+ * On devices without a palette manager every color request and every
+ * pixel converted for an image used to go through GpiQueryNearestColor,
+ * GpiQueryColorIndex and GpiQueryLogColorTable.  The nearest color
+ * table caches these answers for the global log color table:
+ *
+ * The slots are grouped in sets of NEAREST_WAYS, chosen by the 15 bit
+ * RGB value (5 bits per channel) with its low bits cleared.  A set holds
+ * the most recently used colors first; a color that isn't in its set
+ * replaces the least recently used one.
+ *
+ *	request[]	Slot -> the full RGB value whose answer the slot
+ *			holds.  Every color gets the device's answer for
+ *			itself, so devices that resolve colors exactly
+ *			stay exact.
+ *	nearest[]	Slot -> nearest device RGB for request[], or 0 if
+ *			not yet known.  Only depends on the device, so it
+ *			is never invalidated.
+ *	index[]		Slot -> (generation << 16) | (color index + 1).
+ *			Entries with another generation are stale; bumping
+ *			the generation invalidates the whole table at once
+ *			when the log color table changes.
+ *	rgb[]		Color index -> RGB, the reverse table.  Kept up to
+ *			date as entries are added to the log color table.
+ */
+
+#define NEAREST_SIZE	32768
+#define NEAREST_WAYS	2
+#define NEAREST_VALID	0x01000000
+#define NEAREST_KEY(rgb) ((((rgb) >> 9) & 0x7c00) | (((rgb) >> 6) & 0x03e0) \
+	| (((rgb) >> 3) & 0x001f))
+#define NEAREST_SET(rgb) (NEAREST_KEY(rgb) & ~(NEAREST_WAYS - 1))
+
+typedef struct NearestColorTable {
+    int initialized;
+    int rgbMode;		/* Log color table is in RGB mode, pixels
+				 * are RGB values themselves. */
+    ULONG generation;
+    LONG *request;
+    LONG *nearest;
+    ULONG *index;
+    LONG *rgb;
+    LONG numRgb;		/* Size of rgb array. */
+} NearestColorTable;
+
+static NearestColorTable nearestColors;
 
 
 
@@ -225,6 +289,7 @@ GetColorByName(name, color)
     Tcl_HashEntry *hPtr;
     XColorEntry *colorPtr;
     char localname[32];
+    char *p, *q;
 
 #ifdef DEBUG
     printf("GetColorByName %s\n", name);
@@ -234,9 +299,29 @@ GetColorByName(name, color)
 	InitColorTable();
     }
 
-    /* We need a *modifiable* copy of the string name! */
-    strncpy(localname, name, 32);
-    hPtr = Tcl_FindHashEntry(&colorTable, (char *) strlwr(localname));
+    /*
+     * The table is keyed by lower case names.  Most names are given in
+     * lower case already and can be looked up as they are; otherwise
+     * fold them into a local buffer.
+     */
+
+    for (p = name; *p != '\0'; p++) {
+	if (*p >= 'A' && *p <= 'Z') {
+	    break;
+	}
+    }
+    if (*p == '\0') {
+	hPtr = Tcl_FindHashEntry(&colorTable, name);
+    } else {
+	for (p = name, q = localname; *p != '\0'; p++, q++) {
+	    if (q == localname + sizeof(localname) - 1) {
+		return 0;
+	    }
+	    *q = (*p >= 'A' && *p <= 'Z') ? (*p - 'A' + 'a') : *p;
+	}
+	*q = '\0';
+	hPtr = Tcl_FindHashEntry(&colorTable, localname);
+    }
 
     if (hPtr == NULL) {
 	return 0;
@@ -256,6 +341,48 @@ GetColorByName(name, color)
     return 1;
 }      
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ParseHex --
+ *
+ *	Convert a fixed number of hexadecimal digits to an integer.
+ *
+ * Results:
+ *	Returns 1 and stores the value in valuePtr if all length
+ *	characters are hex digits, otherwise returns 0.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ParseHex(string, length, valuePtr)
+    char *string;		/* First digit. */
+    int length;			/* Number of digits, at most 4. */
+    int *valuePtr;		/* Where to store the value. */
+{
+    int value = 0;
+    char c;
+
+    for (; length > 0; length--, string++) {
+	c = *string;
+	if (c >= '0' && c <= '9') {
+	    value = (value << 4) | (c - '0');
+	} else if (c >= 'a' && c <= 'f') {
+	    value = (value << 4) | (c - 'a' + 10);
+	} else if (c >= 'A' && c <= 'F') {
+	    value = (value << 4) | (c - 'A' + 10);
+	} else {
+	    return 0;
+	}
+    }
+    *valuePtr = value;
+    return 1;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -282,19 +409,23 @@ GetColorByValue(value, color)
 				/* "#RRRGGGBBB", or "#RRRRGGGGBBBB" */
     XColor *color;		/* The closest available color. */
 {
-    char fmt[16];
-    int i;
+    int i, red, green, blue;
 
     i = strlen(value+1);
     if (i % 3) {
 	return 0;
     }
     i /= 3;
-    if (i == 0) {
+    if (i == 0 || i > 4) {
 	return 0;
     }
-    sprintf(fmt, "%%%dx%%%dx%%%dx", i, i, i);
-    sscanf(value+1, fmt, &color->red, &color->green, &color->blue);
+    if (!ParseHex(value+1, i, &red) || !ParseHex(value+1+i, i, &green)
+	    || !ParseHex(value+1+2*i, i, &blue)) {
+	return 0;
+    }
+    color->red = red;
+    color->green = green;
+    color->blue = blue;
     /*
      * Scale the parse values into 8 bits.
      */
@@ -334,7 +465,9 @@ GetColorByValue(value, color)
  *	Sets exact_def_return to the parsed color.
  *
  * Side effects:
- *	None.
+ *	Remembers the parsed color in the specification cache of the
+ *	colormap, so the next request for the same string is a single
+ *	hash lookup.
  *
  *----------------------------------------------------------------------
  */
@@ -346,6 +479,11 @@ XParseColor(display, colormap, spec, exact_def_return)
     _Xconst char* spec;
     XColor* exact_def_return;
 {
+    TkOS2Colormap *cmap = (TkOS2Colormap *) colormap;
+    Tcl_HashEntry *entryPtr;
+    XColor *colorPtr;
+    int result, new;
+
     /*
      * Note that we are violating the const-ness of spec.  This is
      * probably OK in most cases.  But this is a bug in general.
@@ -355,13 +493,462 @@ XParseColor(display, colormap, spec, exact_def_return)
     printf("XParseColor %s\n", spec);
 #endif
 
+    if (cmap != NULL) {
+	entryPtr = Tcl_FindHashEntry(&cmap->specCache, (char *) spec);
+	if (entryPtr != NULL) {
+	    *exact_def_return = *((XColor *) Tcl_GetHashValue(entryPtr));
+	    return 1;
+	}
+    }
+
     if (spec[0] == '#') {
-	return GetColorByValue((char *)spec, exact_def_return);
+	result = GetColorByValue((char *)spec, exact_def_return);
     } else {
-	return GetColorByName((char *)spec, exact_def_return);
+	result = GetColorByName((char *)spec, exact_def_return);
+    }
+
+    if (result && cmap != NULL) {
+	if (cmap->numSpecs >= MAX_SPEC_CACHE) {
+	    FlushSpecCache(cmap);
+	}
+	colorPtr = (XColor *) ckalloc(sizeof(XColor));
+	*colorPtr = *exact_def_return;
+	entryPtr = Tcl_CreateHashEntry(&cmap->specCache, (char *) spec, &new);
+	Tcl_SetHashValue(entryPtr, (ClientData) colorPtr);
+	cmap->numSpecs++;
+    }
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FlushSpecCache --
+ *
+ *	Forget all color specifications remembered by XParseColor for
+ *	a colormap.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees the cached colors.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FlushSpecCache(cmap)
+    TkOS2Colormap *cmap;
+{
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+
+    for (entryPtr = Tcl_FirstHashEntry(&cmap->specCache, &search);
+	    entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+	ckfree((char *) Tcl_GetHashValue(entryPtr));
     }
+    Tcl_DeleteHashTable(&cmap->specCache);
+    Tcl_InitHashTable(&cmap->specCache, TCL_STRING_KEYS);
+    cmap->numSpecs = 0;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * GrowShadow --
+ *
+ *	Make sure the shadow copy of a palette has room for at least
+ *	the given number of entries.
+ *
+ * Results:
+ *	Returns 1 on success, 0 if memory ran out.
+ *
+ * Side effects:
+ *	May reallocate the entries and freeSlots arrays of the colormap.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GrowShadow(cmap, count)
+    TkOS2Colormap *cmap;
+    ULONG count;
+{
+    ULONG numEntries;
+    ULONG *entries, *freeSlots;
+
+    if (count <= cmap->numEntries) {
+	return 1;
+    }
+    numEntries = (cmap->numEntries == 0) ? 16 : cmap->numEntries * 2;
+    while (numEntries < count) {
+	numEntries *= 2;
+    }
+    entries = (ULONG *) ckalloc(sizeof(ULONG) * numEntries);
+    if (entries == NULL) {
+	return 0;
+    }
+    freeSlots = (ULONG *) ckalloc(sizeof(ULONG) * numEntries);
+    if (freeSlots == NULL) {
+	ckfree((char *) entries);
+	return 0;
+    }
+    if (cmap->entries != NULL) {
+	memcpy((void *) entries, (void *) cmap->entries,
+		sizeof(ULONG) * cmap->numEntries);
+	memcpy((void *) freeSlots, (void *) cmap->freeSlots,
+		sizeof(ULONG) * cmap->numFree);
+	ckfree((char *) cmap->entries);
+	ckfree((char *) cmap->freeSlots);
+    }
+    cmap->entries = entries;
+    cmap->freeSlots = freeSlots;
+    cmap->numEntries = numEntries;
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetShadowEntry --
+ *
+ *	Store an RGB value in the shadow copy of a palette, growing the
+ *	shadow if necessary.  The palette itself is only written by
+ *	TkOS2SyncPalette, when it is next selected to be realized.
+ *
+ * Results:
+ *	Returns 1 on success, 0 if memory ran out.
+ *
+ * Side effects:
+ *	Updates the RGB index and the range of changed entries.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SetShadowEntry(cmap, index, rgb)
+    TkOS2Colormap *cmap;
+    ULONG index;
+    ULONG rgb;
+{
+    Tcl_HashEntry *entryPtr;
+    int new;
+
+    if (!GrowShadow(cmap, index + 1)) {
+	return 0;
+    }
+    cmap->entries[index] = rgb;
+    entryPtr = Tcl_CreateHashEntry(&cmap->rgbIndex, (char *) rgb, &new);
+    Tcl_SetHashValue(entryPtr, (ClientData) index);
+
+    if (cmap->dirtyFirst > cmap->dirtyLast) {
+	cmap->dirtyFirst = cmap->dirtyLast = index;
+    } else if (index < cmap->dirtyFirst) {
+	cmap->dirtyFirst = index;
+    } else if (index > cmap->dirtyLast) {
+	cmap->dirtyLast = index;
+    }
+    MarkStale(cmap);
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MarkStale --
+ *
+ *	Note that the entries of a colormap changed, and arrange for the
+ *	palette to be realized when Tk becomes idle.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Schedules RealizeStaleColormap if it isn't scheduled yet.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+MarkStale(cmap)
+    TkOS2Colormap *cmap;
+{
+    if (!cmap->stale) {
+	cmap->stale = 1;
+	Tcl_DoWhenIdle(RealizeStaleColormap, (ClientData) cmap);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RealizeStaleColormap --
+ *
+ *	Writes the changed entries of a stale colormap to its palette
+ *	and realizes it once in every toplevel that uses it.  Invoked
+ *	as a when-idle handler, so any number of allocations in one
+ *	event cycle cost a single realization.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May change the system palette and generate damage.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RealizeStaleColormap(clientData)
+    ClientData clientData;
+{
+    TkOS2Colormap *cmap = (TkOS2Colormap *) clientData;
+
+    cmap->stale = 0;
+    TkOS2SyncPalette((Colormap) cmap);
+    TkOS2WmRealizeColormap((Colormap) cmap);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2SyncPalette --
+ *
+ *	Write the entries of a colormap that changed since the last call
+ *	to its PM palette, in one GpiSetPaletteEntries call.  Must be
+ *	called before the palette is selected for realization.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Changes the PM palette.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2SyncPalette(colormap)
+    Colormap colormap;
+{
+    TkOS2Colormap *cmap = (TkOS2Colormap *) colormap;
+
+    if (cmap == NULL || cmap->dirtyFirst > cmap->dirtyLast) {
+	return;
+    }
+#ifdef DEBUG
+    printf("TkOS2SyncPalette %x: entries %d-%d\n", cmap->palette,
+           cmap->dirtyFirst, cmap->dirtyLast);
+#endif
+    GpiSetPaletteEntries(cmap->palette, LCOLF_CONSECRGB, cmap->dirtyFirst,
+	    cmap->dirtyLast - cmap->dirtyFirst + 1,
+	    cmap->entries + cmap->dirtyFirst);
+    cmap->dirtyFirst = 1;
+    cmap->dirtyLast = 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InitNearestColors --
+ *
+ *	Set up the nearest color table and read the reverse table from
+ *	the global log color table, the first time it is needed.
+ *
+ * Results:
+ *	1 if the table can be used, 0 otherwise.
+ *
+ * Side effects:
+ *	Allocates memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+InitNearestColors()
+{
+    LONG count;
+
+    if (nearestColors.initialized) {
+	return (nearestColors.rgb != NULL);
+    }
+    nearestColors.initialized = 1;
+    nearestColors.generation = 1;
+    nearestColors.request = (LONG *) ckalloc(NEAREST_SIZE * sizeof(LONG));
+    memset((char *) nearestColors.request, 0, NEAREST_SIZE * sizeof(LONG));
+    nearestColors.nearest = (LONG *) ckalloc(NEAREST_SIZE * sizeof(LONG));
+    memset((char *) nearestColors.nearest, 0, NEAREST_SIZE * sizeof(LONG));
+    nearestColors.index = (ULONG *) ckalloc(NEAREST_SIZE * sizeof(ULONG));
+    memset((char *) nearestColors.index, 0, NEAREST_SIZE * sizeof(ULONG));
+
+    count = aDevCaps[CAPS_COLOR_INDEX] + 1;
+    if (count < nextColor) {
+	count = nextColor;
+    }
+    nearestColors.numRgb = count;
+    nearestColors.rgb = (LONG *) ckalloc((unsigned) (count * sizeof(LONG)));
+    memset((char *) nearestColors.rgb, 0, count * sizeof(LONG));
+    rc = GpiQueryLogColorTable(globalPS, 0L, 0L, nextColor,
+	    nearestColors.rgb);
+    if (rc == QLCT_RGB) {
+	nearestColors.rgbMode = 1;
+    } else if (rc == QLCT_ERROR) {
+#ifdef DEBUG
+        printf("InitNearestColors: GpiQueryLogColorTable ERROR %x\n",
+               WinGetLastError(hab));
+#endif
+	ckfree((char *) nearestColors.rgb);
+	nearestColors.rgb = NULL;
+	return 0;
+    }
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NearestColor --
+ *
+ *	Find the device color nearest to an RGB value, and the index of
+ *	that color in the global log color table.
+ *
+ * Results:
+ *	Returns the nearest device RGB value and stores its color index
+ *	in indexPtr.
+ *
+ * Side effects:
+ *	Moves the color to the front of its set, filling it in on a
+ *	miss in place of the least recently used color of the set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static LONG
+NearestColor(rgb, indexPtr)
+    LONG rgb;
+    LONG *indexPtr;
+{
+    int set = NEAREST_SET(rgb);
+    int way;
+    LONG nearest;
+    ULONG entry;
+
+    if (!InitNearestColors()) {
+	nearest = GpiQueryNearestColor(globalPS, 0L, rgb);
+	*indexPtr = GpiQueryColorIndex(globalPS, 0L, nearest);
+	return nearest;
+    }
+    rgb &= 0xffffff;
+    for (way = 0; way < NEAREST_WAYS; way++) {
+	if ((nearestColors.nearest[set + way] & NEAREST_VALID)
+		&& (nearestColors.request[set + way] == rgb)) {
+	    break;
+	}
+    }
+    if (way < NEAREST_WAYS) {
+	nearest = nearestColors.nearest[set + way];
+	entry = nearestColors.index[set + way];
+    } else {
+	way = NEAREST_WAYS - 1;
+	nearest = (GpiQueryNearestColor(globalPS, 0L, rgb) & 0xffffff)
+		| NEAREST_VALID;
+	entry = 0;
+    }
+    for (; way > 0; way--) {
+	nearestColors.request[set + way] = nearestColors.request[set + way - 1];
+	nearestColors.nearest[set + way] = nearestColors.nearest[set + way - 1];
+	nearestColors.index[set + way] = nearestColors.index[set + way - 1];
+    }
+    nearestColors.request[set] = rgb;
+    nearestColors.nearest[set] = nearest;
+    nearest &= 0xffffff;
+
+    if ((entry >> 16) != nearestColors.generation) {
+	LONG index = GpiQueryColorIndex(globalPS, 0L, nearest);
+	entry = (nearestColors.generation << 16) | ((index + 1) & 0xffff);
+    }
+    nearestColors.index[set] = entry;
+    *indexPtr = (LONG) (entry & 0xffff) - 1;
+    return nearest;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LogColorTableChanged --
+ *
+ *	Record that an entry was loaded into the global log color table.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Updates the reverse table and invalidates the cached color
+ *	indices.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+LogColorTableChanged(index, rgb)
+    LONG index;
+    LONG rgb;
+{
+    if (nearestColors.rgb == NULL) {
+	return;
+    }
+    if (index >= nearestColors.numRgb) {
+	LONG count = index + 1;
+	nearestColors.rgb = (LONG *) ckrealloc((char *) nearestColors.rgb,
+		(unsigned) (count * sizeof(LONG)));
+	memset((char *) (nearestColors.rgb + nearestColors.numRgb), 0,
+		(count - nearestColors.numRgb) * sizeof(LONG));
+	nearestColors.numRgb = count;
+    }
+    nearestColors.rgb[index] = rgb;
+    nearestColors.generation = (nearestColors.generation + 1) & 0xffff;
+    if (nearestColors.generation == 0) {
+	memset((char *) nearestColors.index, 0, NEAREST_SIZE * sizeof(ULONG));
+	nearestColors.generation = 1;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2IndexToRGB --
+ *
+ *	Convert a color index of the global log color table (a pixel
+ *	value on devices without a palette manager) to its RGB value.
+ *
+ * Results:
+ *	The RGB value.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+LONG
+TkOS2IndexToRGB(index)
+    LONG index;
+{
+    LONG rgb;
+
+    if (InitNearestColors()) {
+	if (nearestColors.rgbMode) {
+	    return index;
+	}
+	if (index >= 0 && index < nextColor) {
+	    return nearestColors.rgb[index];
+	}
+    }
+    rc = GpiQueryLogColorTable(globalPS, 0L, index, 1L, &rgb);
+    return (rc == QLCT_RGB) ? index : rgb;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -387,9 +974,7 @@ XAllocColor(display, colormap, color)
 {
     TkOS2Colormap *cmap = (TkOS2Colormap *) colormap;
     RGB entry;
-    HPAL oldPal;
-    ULONG *palInfo;
-    LONG i, found = -1;
+    LONG found = -1;
 
     /* We lose significance when converting to PM, 256 values per color */
     entry.bRed = (color->red) / 256;
@@ -407,94 +992,67 @@ XAllocColor(display, colormap, color)
 	 * Palette support
 	 */
 	ULONG newPixel;
-        HPS hps;
 	int new, refCount;
 	Tcl_HashEntry *entryPtr;
 
-        hps = WinGetScreenPS(HWND_DESKTOP);
-
 #ifdef DEBUG
         printf("    Palette Manager\n");
 #endif
 
 	/*
-	 * Find the nearest existing palette entry.
+	 * Look the color up in the shadow of the palette.
 	 */
 	
 	newPixel = RGB(entry.bRed, entry.bGreen, entry.bBlue);
-	oldPal= GpiSelectPalette(hps, cmap->palette);
-	if (oldPal == PAL_ERROR) {
-#ifdef DEBUG
-        printf("GpiSelectPalette PAL_ERROR: %x\n", WinGetLastError(hab));
-#endif
-            WinReleasePS(hps);
-            return 0;
+	entryPtr = Tcl_FindHashEntry(&cmap->rgbIndex, (char *) newPixel);
+	if (entryPtr != NULL) {
+	    found = (LONG) Tcl_GetHashValue(entryPtr);
 	}
-	palInfo= (ULONG *) ckalloc(sizeof(ULONG) * (cmap->size+1));
-
-	if (GpiQueryPaletteInfo(cmap->palette, hps, 0L, 0L, cmap->size,
-	                        palInfo) == PAL_ERROR) {
 #ifdef DEBUG
-        printf("GpiQueryPaletteInfo PAL_ERROR: %x\n", WinGetLastError(hab));
+        printf("rgbIndex found %d\n", found);
 #endif
-	    GpiSelectPalette(hps, oldPal);
-            WinReleasePS(hps);
-	    ckfree((char *) palInfo);
-            return 0;
-	}
 
 	/*
 	 * If this is not a duplicate, allocate a new entry.
 	 */
 	
-        for (i=0; i<cmap->size; i++) {
-            if (palInfo[i] == newPixel) {
-                found = i;
-            }
-        }
-#ifdef DEBUG
-        printf("GpiQueryPaletteInfo found %d\n", found);
-#endif
-/*
-*/
 	if (found == -1) {
 
 	    /*
-	     * Fails if the palette is full.
+	     * Reuse an entry freed by XFreeColors if there is one, so the
+	     * palette doesn't grow.  Otherwise append a new entry; this
+	     * fails if the palette is full.
 	     */
-	    if (cmap->size == aDevCaps[CAPS_COLOR_INDEX]) {
+	    if (cmap->numFree > 0) {
+		found = cmap->freeSlots[cmap->numFree - 1];
+		if (!SetShadowEntry(cmap, found, newPixel)) {
+		    return 0;
+		}
+		cmap->numFree--;
+	    } else {
+		if (cmap->size == aDevCaps[CAPS_COLOR_INDEX]) {
 #ifdef DEBUG
             printf("palette is full\n");
 #endif
-	        GpiSelectPalette(hps, oldPal);
-                WinReleasePS(hps);
-	        ckfree((char *) palInfo);
-		return 0;
+		    return 0;
+		}
+		if (!SetShadowEntry(cmap, cmap->size, newPixel)) {
+		    return 0;
+		}
+		found = cmap->size;
+		cmap->size++;
 	    }
-	
-	    cmap->size++;
 #ifdef DEBUG
-            printf("adding palInfo[%d]: %d (%d, %d, %d)\n", cmap->size-1,
-                   RGB(entry.bRed, entry.bGreen, entry.bBlue),
+            printf("adding entries[%d]: %d (%d, %d, %d)\n", found, newPixel,
                    entry.bRed, entry.bGreen, entry.bBlue);
 #endif
-/*
-	    palInfo[cmap->size-1]= RGB(entry.bRed, entry.bGreen, entry.bBlue);
-*/
-	    palInfo[cmap->size-1]= newPixel;
-	    GpiSetPaletteEntries(cmap->palette, LCOLF_CONSECRGB, 0L, cmap->size,
-	                         palInfo);
 	}
 
-	ckfree((char *) palInfo);
-/*
-	color->pixel = RGB(entry.bRed, entry.bGreen, entry.bBlue);
-*/
         /*
          * Assign the _index_ in the palette as the pixel, for later use in
          * GpiSetColor et al. ()
          */
-        color->pixel = cmap->size-1;
+        color->pixel = found;
 	entryPtr = Tcl_CreateHashEntry(&cmap->refCounts,
 		(char *)color->pixel, &new);
 	if (new) {
@@ -510,8 +1068,6 @@ XAllocColor(display, colormap, color)
 	}
 	Tcl_SetHashValue(entryPtr, (ClientData)refCount);
 
-	WinReleasePS(hps);
-
     } else {
        LONG index, iColor;
 
@@ -526,40 +1082,17 @@ XAllocColor(display, colormap, color)
 	 * Determine what color will actually be used on non-colormap systems.
 	 */
 
-	color->pixel = GpiQueryNearestColor(globalPS, 0L,
-		RGB(entry.bRed, entry.bGreen, entry.bBlue));
+	color->pixel = NearestColor(RGB(entry.bRed, entry.bGreen, entry.bBlue),
+		&index);
 	color->red = (GetRValue(color->pixel) << 8);
 	color->green = (GetGValue(color->pixel) << 8);
 	color->blue = (GetBValue(color->pixel) << 8);
-#ifdef DEBUG
-        if (color->pixel==GPI_ALTERROR) {
-            printf("GpiQueryNearestColor ERROR %x\n", WinGetLastError(hab));
-        } else {
-            printf("            Using nearest color %d for %d (%d,%d,%d)\n",
-                   color->pixel, RGB(entry.bRed, entry.bGreen, entry.bBlue),
-                   color->red, color->green, color->blue);
-        }
-#endif
 	/* See if this color is already in the color table */
-        index = GpiQueryColorIndex(globalPS, 0L, color->pixel);
+	iColor = TkOS2IndexToRGB(index);
 #ifdef DEBUG
-        if (index==GPI_ALTERROR) {
-            printf("GpiQueryColorIndex ERROR %x\n", WinGetLastError(hab));
-        } else {
-            printf("            Colorindex %d for %d\n", index, color->pixel);
-        }
-#endif
-	rc = GpiQueryLogColorTable(globalPS, 0L, index, 1, &iColor);
-#ifdef DEBUG
-        if (iColor==QLCT_ERROR) {
-            printf("GpiQueryLogColorTable ERROR %x\n", WinGetLastError(hab));
-        } else {
-            if (iColor==QLCT_RGB) {
-                printf("GpiQueryLogColorTable in RGB mode\n");
-            } else {
-                printf("GpiQueryLogColorTable %d: %d \n", index, iColor);
-            }
-        }
+        printf("            Using nearest color %d for %d (%d,%d,%d), index %d: %d\n",
+               color->pixel, RGB(entry.bRed, entry.bGreen, entry.bBlue),
+               color->red, color->green, color->blue, index, iColor);
 #endif
 	/*
 	 * If the color isn't in the table yet and loadable color table support,
@@ -574,6 +1107,7 @@ XAllocColor(display, colormap, color)
                 printf("    GpiCreateLogColorTable %d at %d OK\n", color->pixel,
                        nextColor);
 #endif
+                LogColorTableChanged(nextColor, color->pixel);
                 color->pixel = nextColor;
                 nextColor++;
             } else {
@@ -594,6 +1128,68 @@ XAllocColor(display, colormap, color)
     return 1;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2AllocColors --
+ *
+ *	Allocate a whole set of colors in one palette transaction, for
+ *	callers like the photo image color table that need many colors
+ *	at once.
+ *
+ * Results:
+ *	Each color is updated as XAllocColor would do, and status[i] is
+ *	set to 1 if colors[i] was allocated, 0 otherwise.  Returns the
+ *	number of colors allocated.
+ *
+ * Side effects:
+ *	Allocates new colors in the palette.  On palette devices the new
+ *	entries are written to the palette with one GpiSetPaletteEntries.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2AllocColors(display, colormap, colors, ncolors, status)
+    Display* display;
+    Colormap colormap;
+    XColor* colors;
+    int ncolors;
+    int* status;
+{
+    TkOS2Colormap *cmap = (TkOS2Colormap *) colormap;
+    int i, nAlloc = 0;
+
+#ifdef DEBUG
+    printf("TkOS2AllocColors %d colors, cmap %x\n", ncolors, cmap);
+#endif
+
+    if (aDevCaps[CAPS_ADDITIONAL_GRAPHICS] & CAPS_PALETTE_MANAGER) {
+	/*
+	 * Reserve room for the whole set in the shadow palette up front,
+	 * so it isn't regrown while the colors are added.
+	 */
+	ULONG want = cmap->size + ncolors;
+
+	if (want > (ULONG) aDevCaps[CAPS_COLOR_INDEX]) {
+	    want = aDevCaps[CAPS_COLOR_INDEX];
+	}
+	GrowShadow(cmap, want);
+    }
+
+    for (i = 0; i < ncolors; i++) {
+	status[i] = XAllocColor(display, colormap, &colors[i]);
+	if (status[i]) {
+	    nAlloc++;
+	}
+    }
+
+    if (aDevCaps[CAPS_ADDITIONAL_GRAPHICS] & CAPS_PALETTE_MANAGER) {
+	TkOS2SyncPalette(colormap);
+    }
+    return nAlloc;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -643,8 +1239,11 @@ XAllocNamedColor(display, colormap, color_name, screen_def_return,
  *	None.
  *
  * Side effects:
- *	Removes entries for the current palette and compacts the
- *	remaining set.
+ *	Decrements the reference counts of the pixels.  A pixel that is
+ *	no longer referenced stays in the palette, so the other pixel
+ *	values remain valid, but it is removed from the color index and
+ *	put on the free list of the colormap, to be reused by the next
+ *	color allocated.  Nothing is compacted or rewritten.
  *
  *----------------------------------------------------------------------
  */
@@ -658,11 +1257,9 @@ XFreeColors(display, colormap, pixels, npixels, planes)
     unsigned long planes;
 {
     TkOS2Colormap *cmap = (TkOS2Colormap *) colormap;
-    ULONG cref;
     ULONG refCount;
-    int i, old, new;
-    ULONG *entries;
-    Tcl_HashEntry *entryPtr;
+    int i;
+    Tcl_HashEntry *entryPtr, *indexPtr;
 
 #ifdef DEBUG
     printf("XFreeColors\n");
@@ -674,9 +1271,6 @@ XFreeColors(display, colormap, pixels, npixels, planes)
     
     if (aDevCaps[CAPS_ADDITIONAL_GRAPHICS] & CAPS_PALETTE_MANAGER) {
 
-	/*
-	 * This is really slow for large values of npixels.
-	 */
 	for (i = 0; i < npixels; i++) {
 	    entryPtr = Tcl_FindHashEntry(&cmap->refCounts,
 		    (char *) pixels[i]);
@@ -685,31 +1279,26 @@ XFreeColors(display, colormap, pixels, npixels, planes)
 	    }
 	    refCount = (int) Tcl_GetHashValue(entryPtr) - 1;
 	    if (refCount == 0) {
-		cref = pixels[i] & 0x00ffffff;
-                entries = (ULONG *) ckalloc(sizeof(ULONG) * cmap->size);
-                /* hps value ignored for specific values of palette */
-                if (GpiQueryPaletteInfo(cmap->palette, NULLHANDLE, 0L, 0L,
-                                        cmap->size, entries) == PAL_ERROR) {
-                   ckfree((char *)entries);
-                   return;
-	        }
-		/* Copy all entries except the one to delete */
-		for (old= new= 0; old<cmap->size; old++) {
-		    if (entries[old] != cref) {
-		        entries[new] = entries[old];
-		        new++;
-		    }
+		/*
+		 * Leave the entry in the palette, so other pixel values
+		 * stay valid and nothing has to be rewritten, but make it
+		 * unreachable by color and put it on the free list.
+		 */
+		indexPtr = Tcl_FindHashEntry(&cmap->rgbIndex,
+			(char *) cmap->entries[pixels[i]]);
+		if (indexPtr != NULL
+			&& (ULONG) Tcl_GetHashValue(indexPtr) == pixels[i]) {
+		    Tcl_DeleteHashEntry(indexPtr);
 		}
-		cmap->size--;
-	        GpiSetPaletteEntries(cmap->palette, LCOLF_CONSECRGB, 0,
-	                             cmap->size, entries);
-		ckfree((char *) entries);
+		cmap->freeSlots[cmap->numFree++] = pixels[i];
 		Tcl_DeleteHashEntry(entryPtr);
+	    } else {
+		Tcl_SetHashValue(entryPtr, (ClientData) refCount);
 	    }
 	}
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -764,6 +1353,15 @@ XCreateColormap(display, w, visual, alloc)
     cmap->size = 0;
     cmap->stale = 0;
     Tcl_InitHashTable(&cmap->refCounts, TCL_ONE_WORD_KEYS);
+    cmap->entries = NULL;
+    cmap->numEntries = 0;
+    cmap->freeSlots = NULL;
+    cmap->numFree = 0;
+    Tcl_InitHashTable(&cmap->rgbIndex, TCL_ONE_WORD_KEYS);
+    cmap->dirtyFirst = 1;
+    cmap->dirtyLast = 0;
+    Tcl_InitHashTable(&cmap->specCache, TCL_STRING_KEYS);
+    cmap->numSpecs = 0;
     return (Colormap)cmap;
 }
 
@@ -804,7 +1402,17 @@ XFreeColormap(display, colormap)
 	    panic("Unable to free colormap, palette is still selected.");
         }
     }
+    if (cmap->stale) {
+        Tcl_CancelIdleCall(RealizeStaleColormap, (ClientData) cmap);
+    }
     Tcl_DeleteHashTable(&cmap->refCounts);
+    Tcl_DeleteHashTable(&cmap->rgbIndex);
+    FlushSpecCache(cmap);
+    Tcl_DeleteHashTable(&cmap->specCache);
+    if (cmap->entries != NULL) {
+        ckfree((char *) cmap->entries);
+        ckfree((char *) cmap->freeSlots);
+    }
     ckfree((char *) cmap);
 }
 
@@ -814,9 +1422,10 @@ XFreeColormap(display, colormap)
  * TkOS2SelectPalette --
  *
  *	This function sets up the specified device context with a
- *	given palette.  If the palette is stale, it realizes it in
- *	the background unless the palette is the current global
- *	palette.
+ *	given palette.  The palette is only realized if it is stale,
+ *	i.e. it changed and the idle handler scheduled by MarkStale
+ *	hasn't run yet; otherwise it was realized already and drawing
+ *	can use it as it is.
  *
  * Results:
  *	Returns the previous palette selected into the device context.
@@ -842,43 +1451,30 @@ TkOS2SelectPalette(hps, hwnd, colormap)
 #endif
 
     if (aDevCaps[CAPS_ADDITIONAL_GRAPHICS] & CAPS_PALETTE_MANAGER) {
+        TkOS2SyncPalette(colormap);
         oldPalette = GpiSelectPalette(hps, cmap->palette);
 #ifdef DEBUG
 if (oldPalette == PAL_ERROR) printf("GpiSelectPalette PAL_ERROR: %x\n",
 WinGetLastError(hab));
 else printf("GpiSelectPalette: %x\n", oldPalette);
 #endif
-        mapped = WinRealizePalette(hwnd, hps, &changed);
+        if (cmap->stale) {
+            mapped = WinRealizePalette(hwnd, hps, &changed);
 #ifdef DEBUG
 if (mapped == PAL_ERROR) printf("WinRealizePalette PAL_ERROR: %x\n",
 WinGetLastError(hab));
 else printf("WinRealizePalette: %x\n", mapped);
 #endif
+        }
 return oldPalette;
     } else {
-        PULONG alArray;
-        /* Retrieve the "global" color table and create it in this PS */
-#ifdef DEBUG
-        printf("    ckalloc\'ing %d (%dx%d)\n",
-               (unsigned)(sizeof(LONG) * (nextColor)), sizeof(LONG), nextColor);
-#endif
-        alArray = (PLONG) ckalloc ((unsigned)(sizeof(LONG) * (nextColor)));
-        rc = GpiQueryLogColorTable(globalPS, 0L, 0L, nextColor, alArray);
-#ifdef DEBUG
-        if (rc==QLCT_ERROR) {
-            printf("    GpiQueryLogColorTable (0-%d) ERROR %x\n", nextColor-1,
-                   WinGetLastError(hab));
-        } else {
-            if (rc==QLCT_RGB) {
-                printf("    GpiQueryLogColorTable in RGB mode\n");
-            } else {
-                printf("    GpiQueryLogColorTable (0-%d) OK\n", nextColor-1);
-            }
-        }
-#endif
-        if (rc > 0) {
+        /*
+         * Load the "global" color table into this PS, straight from the
+         * reverse table of the nearest color cache.
+         */
+        if (InitNearestColors() && !nearestColors.rgbMode) {
             rc = GpiCreateLogColorTable(hps, 0L, LCOLF_CONSECRGB, 0,
-                                        nextColor, alArray);
+                                        nextColor, nearestColors.rgb);
 #ifdef DEBUG
             if (rc!=TRUE) {
                 printf("    GpiCreateLogColorTable ERROR %x\n",
@@ -888,7 +1484,6 @@ return oldPalette;
             }
 #endif
         }
-        ckfree((char *)alArray);
         return (HPAL)0;
     }
 }
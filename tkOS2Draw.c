@@ -168,8 +168,20 @@ TkOS2GetDrawablePS(display, d, state)
 
     if (todPtr->type != TOD_BITMAP) {
         TkWindow *winPtr = todPtr->window.winPtr;
+	HWND hwnd;
 
-	hps = WinGetPS(todPtr->window.handle);
+	/*
+	 * Don't draw at the old size or position of a window.
+	 */
+
+	TkOS2FlushGeometry();
+	if ((todPtr->window.flags & TOD_LIGHTWEIGHT) && (winPtr != NULL)) {
+	    hps = TkOS2GetLightweightPS(winPtr, &hwnd);
+	} else {
+	    hwnd = todPtr->window.handle;
+	    hps = WinGetPS(hwnd);
+	    TkOS2ExcludeLightweight(hps, winPtr);
+	}
 /*
 #ifdef DEBUG
 printf("TkOS2GetDrawablePS window %x (handle %x, hps %x)\n", d,
@@ -181,7 +193,7 @@ todPtr->window.handle, hps);
         } else {
 	    cmap = winPtr->atts.colormap;
         }
-        state->palette = TkOS2SelectPalette(hps, todPtr->window.handle, cmap);
+        state->palette = TkOS2SelectPalette(hps, hwnd, cmap);
     } else {
 
         hps = todPtr->bitmap.hps;
@@ -208,7 +220,11 @@ todPtr->bitmap.handle, hps);
  *	None.
  *
  * Side effects:
- *	Restores the old bitmap handle to the memory DC for pixmaps.
+ *	Restores the old palette, and releases the PS for windows.  For
+ *	pixmaps, forgets which GC the PS attributes were set up for
+ *	unless the drawing call kept them (see RenderObject).  The
+ *	palette is not realized again here: changed colormaps are
+ *	realized once per idle cycle (see MarkStale in tkOS2Color.c).
  *
  *----------------------------------------------------------------------
  */
@@ -219,7 +235,6 @@ TkOS2ReleaseDrawablePS(d, hps, state)
     HPS hps;
     TkOS2PSState *state;
 {
-    ULONG changed;
     HPAL oldPal;
     TkOS2Drawable *todPtr = (TkOS2Drawable *)d;
 
@@ -236,7 +251,6 @@ else printf("GpiSelectPalette TkOS2ReleaseDrawablePS: %x\n", oldPal);
 printf("TkOS2ReleaseDrawablePS window %x\n", d);
 #endif
 */
-        WinRealizePalette(TkOS2GetHWND(d), hps, &changed);
         WinReleasePS(hps);
     } else {
 /*
@@ -244,7 +258,10 @@ printf("TkOS2ReleaseDrawablePS window %x\n", d);
 printf("TkOS2ReleaseDrawablePS bitmap %x released %x\n", d, state->bitmap);
 #endif
 */
-        WinRealizePalette(todPtr->bitmap.parent, hps, &changed);
+        if (!todPtr->bitmap.keepAttrs) {
+            todPtr->bitmap.gcGeneration = 0;
+        }
+        todPtr->bitmap.keepAttrs = 0;
     }
 }
 
@@ -404,6 +421,18 @@ XCopyArea(display, src, dest, gc, src_x, src_y, width, height, dest_x, dest_y)
         windowHeight = TkOS2WindowHeight((TkOS2Drawable *)src);
     }
     aPoints[2].y = windowHeight - src_y - height;
+    if (TkOS2IsLightweight(src)) {
+	POINTL origin;
+
+	/*
+	 * The source points of GpiBitBlt are in device coordinates, which
+	 * the translation of a lightweight window's PS doesn't apply to.
+	 */
+
+	TkOS2GetHeavyweight(TkOS2GetWinPtr(src), &origin);
+	aPoints[2].x += origin.x;
+	aPoints[2].y += origin.y;
+    }
     srcPS = TkOS2GetDrawablePS(display, src, &srcState);
 #ifdef DEBUG
     printf("    PM: (%d,%d)-(%d,%d) <- (%d,%d)\n", aPoints[0].x, aPoints[0].y,
@@ -910,6 +939,7 @@ else printf("Internal GpiBitBlt %x ERROR, error %x\n", hps, WinGetLastError(hab)
     } else {
 	int i, usePalette;
 	LONG defBitmapFormat[2];
+	TkOS2ShmInfo *shmPtr = TkOS2ShmImageInfo(image);
 
 #ifdef DEBUG
 printf("image->bits_per_pixel %d\n", image->bits_per_pixel);
@@ -921,7 +951,23 @@ printf("image->bits_per_pixel %d\n", image->bits_per_pixel);
 	
 	usePalette = (image->bits_per_pixel < 24);
 
-	if (usePalette) {
+	if (shmPtr != NULL) {
+	    /*
+	     * Shared image: the header stays with the image and only has
+	     * to grow when the color table does.
+	     */
+
+	    i = usePalette ? ncolors : 0;
+	    if (shmPtr->infoPtr == NULL || shmPtr->numColors < i) {
+		if (shmPtr->infoPtr != NULL) {
+		    ckfree((char *) shmPtr->infoPtr);
+		}
+		shmPtr->infoPtr = (BITMAPINFO2*) ckalloc(sizeof(BITMAPINFO2)
+			+ sizeof(RGB2)*i);
+		shmPtr->numColors = (shmPtr->infoPtr == NULL) ? 0 : i;
+	    }
+	    infoPtr = shmPtr->infoPtr;
+	} else if (usePalette) {
 #ifdef DEBUG
 printf("using palette (not TrueColor)\n");
 #endif
@@ -933,10 +979,23 @@ printf("not using palette (TrueColor)\n");
 #endif
 	    infoPtr = (BITMAPINFO2*) ckalloc(sizeof(BITMAPINFO2));
 	}
-	if (infoPtr == NULL) return;
+	if (infoPtr == NULL) {
+	    TkOS2ReleaseDrawablePS(d, hps, &state);
+	    return;
+	}
 
-        /* Bitmap must be reversed in OS/2 wrt. the Y direction */
-	data = TkOS2ReverseImageLines(image);
+	if (shmPtr != NULL) {
+	    /*
+	     * The lines are already bottom-up: start at the lowest line
+	     * of the subimage and let PM read straight from the buffer.
+	     */
+
+	    data = image->data + (image->height - src_y - height)
+		    * image->bytes_per_line;
+	} else {
+            /* Bitmap must be reversed in OS/2 wrt. the Y direction */
+	    data = TkOS2ReverseImageLines(image);
+	}
 	
 /*
 	infoPtr = (BITMAPINFO2*) ckalloc(sizeof(BITMAPINFO2));
@@ -1036,17 +1095,8 @@ if (rc!=TRUE) {
                     }
 #endif
                 } else {
-                    rc = GpiQueryLogColorTable(hps, 0, colors[i], 1L, &rgb);
-#ifdef DEBUG
-                    if (rc == QLCT_ERROR) {
-                        printf("    GpiQueryLogColorTable ERROR %x\n",
-                               WinGetLastError(hab));
-                    } else if (rc == QLCT_RGB) {
-                        printf("    table in RGB mode, no element returned");
-                    } else {
-                        printf("    color %d\n", rgb);
-                    }
-#endif
+                    /* The PS holds a copy of the global color table */
+                    rgb = TkOS2IndexToRGB(colors[i]);
                 }
 		infoPtr->argbColor[i].bRed = GetRValue(rgb);
 		infoPtr->argbColor[i].bGreen = GetGValue(rgb);
@@ -1072,8 +1122,10 @@ printf("GpiSetBitmapBits set %d scanlines\n", rc);
 }
 #endif
 
-	ckfree((char *)infoPtr);
-	ckfree(data);
+	if (shmPtr == NULL) {
+	    ckfree((char *)infoPtr);
+	    ckfree(data);
+	}
     }
     TkOS2ReleaseDrawablePS(d, hps, &state);
 }
@@ -1476,34 +1528,7 @@ TkOS2UnsetStipple(todPtr->bitmap.hps, todPtr->bitmap.hps, todPtr->bitmap.handle,
         ULONG changed;
 	RECTL allRect;
 
-	/* Select appropriate palette into hps */
-/*
-        if (todPtr->type != TOD_BITMAP) {
-            if (todPtr->window.winPtr == NULL) {
-#ifdef DEBUG
-printf("XDrawString at %d,%d; cmap DEF fg %d, bg %d; window %x\n",
-x, y, gc->foreground, gc->background, todPtr->window.handle);
-#endif
-                oldPalette = TkOS2SelectPalette(hps, todPtr->window.handle,
-                              DefaultColormap(display, DefaultScreen(display)));
-            } else {
-                oldPalette = TkOS2SelectPalette(hps, todPtr->window.handle,
-                                          todPtr->window.winPtr->atts.colormap);
-#ifdef DEBUG
-printf("XDrawString at %d,%d; cmap %x fg %d, bg %d; window %x\n",
-x, y, todPtr->window.winPtr->atts.colormap, gc->foreground,
-gc->background, todPtr->window.handle);
-#endif
-            }
-        } else {
-            oldPalette = TkOS2SelectPalette(hps, todPtr->bitmap.parent,
-                                            todPtr->bitmap.colormap);
-        }
-#ifdef DEBUG
-printf("          oldPalette %x (now %x), changed %d\n", oldPalette,
-GpiQueryPalette(hps), changed);
-#endif
-*/
+	/* The palette was selected into hps by TkOS2GetDrawablePS */
 
 	GpiQueryTextAlignment(hps, &oldHorAlign, &oldVerAlign);
 	GpiSetTextAlignment(hps, TA_LEFT, TA_BASE);
@@ -1621,11 +1646,6 @@ gc->font, WinGetLastError(hab));
 #endif
 
 
-        /* restore appopriate palette into hps */
-/*
-        GpiSelectPalette(hps, oldPalette);
-*/
-
 	if (gc->font != None) {
 	    /* Set slant if necessary */
 	    if (logfonts[(LONG)gc->font].setShear) {
@@ -1846,18 +1866,10 @@ printf("WinFillRect4\n");
 	/* end of using 254 */
     } else {
 
-        if (todPtr->type == TOD_BITMAP) {
-            oldPalette = TkOS2SelectPalette(hps, HWND_DESKTOP,
-                                            todPtr->bitmap.colormap);
-        } else {
-            if (todPtr->window.winPtr == NULL) {
-                oldPalette = TkOS2SelectPalette(hps, todPtr->window.handle,
-                             DefaultColormap(display, DefaultScreen(display)));
-            } else {
-                oldPalette = TkOS2SelectPalette(hps, todPtr->window.handle,
-                                         todPtr->window.winPtr->atts.colormap);
-            }
-        }
+        /*
+         * The palette was selected into hps by TkOS2GetDrawablePS, for
+         * the PM window that lightweight windows draw into.
+         */
 
         for (i = 0; i < nrectangles; i++) {
             rect.xLeft = rectangles[i].x;
@@ -2149,16 +2161,37 @@ TkOS2UnsetStipple(hps, todPtr->bitmap.hps, todPtr->bitmap.handle, oldPattern,
 &oldRefPoint);
 	WinReleasePS(psMem);
     } else {
+	TkOS2Drawable *destPtr = (TkOS2Drawable *)d;
 
-	GpiQueryAttrs(hps, PRIM_LINE, LBB_COLOR | LBB_WIDTH | LBB_TYPE,
-	              &oldLineBundle);
-	GpiSetAttrs(hps, PRIM_LINE, LBB_COLOR | LBB_WIDTH | LBB_TYPE, 0L,
-	            &lineBundle);
-        oldPattern = GpiQueryPattern(hps);
-        oldColor = GpiQueryColor(hps);
-	GpiSetColor(hps, gc->foreground);
-	GpiSetPattern(hps, PATSYM_SOLID);
-	GpiSetMix(hps, mixModes[gc->function]);
+	/*
+	 * A pixmap PS keeps its attributes between drawing calls, so if
+	 * the previous call set them up for the same generation of this
+	 * GC they are still right.  Window PS's are reset by WinGetPS.
+	 */
+
+	if (destPtr->type == TOD_BITMAP) {
+	    if (destPtr->bitmap.gcGeneration != TkOS2GCGeneration(gc)
+		    || destPtr->bitmap.lineType != lineBundle->usType) {
+		GpiSetAttrs(hps, PRIM_LINE, LBB_COLOR | LBB_WIDTH | LBB_TYPE,
+			0L, lineBundle);
+		GpiSetColor(hps, gc->foreground);
+		GpiSetPattern(hps, PATSYM_SOLID);
+		GpiSetMix(hps, mixModes[gc->function]);
+		destPtr->bitmap.gcGeneration = TkOS2GCGeneration(gc);
+		destPtr->bitmap.lineType = lineBundle->usType;
+	    }
+	    destPtr->bitmap.keepAttrs = 1;
+	} else {
+	    GpiQueryAttrs(hps, PRIM_LINE, LBB_COLOR | LBB_WIDTH | LBB_TYPE,
+	                  &oldLineBundle);
+	    GpiSetAttrs(hps, PRIM_LINE, LBB_COLOR | LBB_WIDTH | LBB_TYPE, 0L,
+	                lineBundle);
+            oldPattern = GpiQueryPattern(hps);
+            oldColor = GpiQueryColor(hps);
+	    GpiSetColor(hps, gc->foreground);
+	    GpiSetPattern(hps, PATSYM_SOLID);
+	    GpiSetMix(hps, mixModes[gc->function]);
+	}
 
         if (func == TOP_POLYGONS) {
 int i;
@@ -2189,10 +2222,12 @@ printf("returns %d\n", rc);
 #endif
         }
 
-	GpiSetColor(hps, oldColor);
-	GpiSetPattern(hps, oldPattern);
-	GpiSetAttrs(hps, PRIM_LINE, LBB_COLOR | LBB_WIDTH | LBB_TYPE, 0L,
-	            &oldLineBundle);
+	if (destPtr->type != TOD_BITMAP) {
+	    GpiSetColor(hps, oldColor);
+	    GpiSetPattern(hps, oldPattern);
+	    GpiSetAttrs(hps, PRIM_LINE, LBB_COLOR | LBB_WIDTH | LBB_TYPE, 0L,
+	                &oldLineBundle);
+	}
     }
 }
 
@@ -2624,6 +2659,16 @@ TkScrollWindow(tkwin, gc, x, y, width, height, dx, dy, damageRgn)
 printf("TkScrollWindow\n");
 #endif
 
+    if (TkOS2IsLightweight(Tk_WindowId(tkwin))) {
+	/*
+	 * The damage region would be in coordinates of the heavyweight,
+	 * so have the whole window redrawn instead of scrolling bits.
+	 */
+
+	TkOS2InvalidateWindow((TkWindow *) tkwin);
+	return 0;
+    }
+
     windowHeight = TkOS2WindowHeight((TkOS2Drawable *)Tk_WindowId(tkwin));
 
     /* Translate the Y coordinates to PM coordinates */
@@ -22,6 +22,91 @@ static int		NameToFont (_Xconst char *name, TkOS2Font *logfont);
 static int		XNameToFont (_Xconst char *name, TkOS2Font *logfont);
 static char *lastname;
 
+/*
+ * Cache of font specifications already resolved by XLoadFont, keyed by
+ * the name given.  The values are TkOS2Font templates holding everything
+ * GpiCreateLogFont and the outline/shear handling need, so that repeated
+ * requests for the same name skip NameToFont/XNameToFont and the font
+ * matching.  The fm field of the templates isn't used.
+ * The cache holds at most FONTSPEC_CACHE_SIZE names; when it is full,
+ * the slot to reuse is chosen with the clock algorithm, a name that was
+ * looked up since the hand last passed it getting a second chance.
+ */
+
+#define FONTSPEC_CACHE_SIZE	64
+
+typedef struct {
+    TkOS2Font font;		/* Template for the logical font */
+    Tcl_HashEntry *hPtr;	/* Entry in fontSpecCache, NULL if free */
+    int referenced;		/* Looked up since the hand last passed */
+} FontSpec;
+
+static Tcl_HashTable fontSpecCache;
+static int fontSpecCacheInitialized = 0;
+static FontSpec fontSpecs[FONTSPEC_CACHE_SIZE];
+static int fontSpecHand = 0;
+
+/*
+ * Optional persistent font catalog.  If the environment variable
+ * TK_FONTCACHE names a file, the GpiQueryFonts results per face name and
+ * the metrics computed by XQueryFont for each logical font are read from
+ * that file at startup (TkPlatformInit) and written back at exit, so that
+ * a warm start doesn't have to enumerate fonts or query metrics from PM.
+ * The file is discarded if it was written for a different set of public
+ * fonts, as told by FontCatalogKey, or a different font resolution.
+ */
+
+#define FONTCACHE_MAGIC		"TkOS2FC"
+#define FONTCACHE_VERSION	4
+#define FONTCACHE_KEYLEN	160	/* FontCacheKey writes at most 131 */
+
+typedef struct {
+    char magic[8];		/* FONTCACHE_MAGIC */
+    ULONG version;		/* FONTCACHE_VERSION */
+    LONG numFonts;		/* Number of public fonts when written */
+    ULONG dirTime;		/* Write time of the font directory */
+    ULONG listSize;		/* Size of the PM_Fonts key list */
+    LONG xRes, yRes;		/* Horizontal and vertical font resolution */
+    ULONG numFaces;		/* Number of FontCacheFace records */
+    ULONG numMetrics;		/* Number of FontCacheMetrics records */
+} FontCacheHeader;
+
+typedef struct {
+    char facename[FACESIZE];	/* Face name given to GpiQueryFonts */
+    LONG count;			/* Number of FONTMETRICS that follow */
+} FontCacheFace;
+
+typedef struct {
+    char key[FONTCACHE_KEYLEN];	/* See FontCacheKey */
+    FONTMETRICS fm;		/* Metrics as remembered in logfonts */
+    int direction;
+    int ascent, descent;
+    unsigned min_char, max_char, default_char;
+    XCharStruct min_bounds, max_bounds;
+    LONG nwidths;		/* Number of per-char widths that follow,
+				 * 0 for fixed pitch fonts */
+} FontCacheMetrics;
+
+static char *fontCacheName = NULL;	/* NULL means cache disabled */
+static char *fontCacheImage = NULL;	/* Contents of the cache file */
+static ULONG fontCacheSize = 0;		/* Size of fontCacheImage */
+static int fontCacheDirty = 0;		/* Needs to be written at exit */
+static LONG catalogFonts = 0;		/* FontCatalogKey at startup */
+static ULONG catalogDirTime = 0;
+static ULONG catalogListSize = 0;
+static Tcl_HashTable faceCache;		/* FontCacheFace by face name */
+static Tcl_HashTable metricsCache;	/* FontCacheMetrics by key */
+
+static void		FontCacheKey _ANSI_ARGS_((TkOS2Font *logfont,
+			    char *key));
+static PFONTMETRICS	QueryFaceFonts _ANSI_ARGS_((PSZ facename,
+			    LONG *countPtr));
+static void		CacheFontMetrics _ANSI_ARGS_((XFontStruct *fontPtr));
+static XFontStruct *	CachedFontMetrics _ANSI_ARGS_((XID font_ID));
+static void		FontCatalogKey _ANSI_ARGS_((LONG *numFontsPtr,
+			    ULONG *dirTimePtr, ULONG *listSizePtr));
+static void		DiscardFontCache _ANSI_ARGS_((void));
+
 /*
  * Code pages used in this file, 1004 is Windows compatible, 65400 must be
  * used if the font contains special glyphs, ie. Symbol.
@@ -558,6 +643,11 @@ XLoadFont(display, name)
     SIZEF charBox;
     int i, error = 30000, best = -1;
     TkOS2Font *logfont = logfonts + lFontID;	/* For debugging. */
+    _Xconst char *specName = name;	/* name gets advanced while parsing */
+    Tcl_HashEntry *specPtr;
+    FontSpec *fontSpecPtr;
+    TkOS2Font *specFontPtr = NULL;
+    int new;
 
 #ifdef DEBUG
     printf("XLoadFont %s\n", name);
@@ -567,6 +657,29 @@ XLoadFont(display, name)
         return (Font) 0;
     }
 
+    /* A name we have resolved before needs no parsing and matching */
+    if (!fontSpecCacheInitialized) {
+        Tcl_InitHashTable(&fontSpecCache, TCL_STRING_KEYS);
+        fontSpecCacheInitialized = 1;
+    }
+    specPtr = Tcl_FindHashEntry(&fontSpecCache, (char *) name);
+    if (specPtr != NULL) {
+        fontSpecPtr = (FontSpec *) Tcl_GetHashValue(specPtr);
+        fontSpecPtr->referenced = 1;
+        specFontPtr = &fontSpecPtr->font;
+        logfonts[lFontID].fattrs = specFontPtr->fattrs;
+        logfonts[lFontID].shear = specFontPtr->shear;
+        logfonts[lFontID].setShear = specFontPtr->setShear;
+        logfonts[lFontID].outline = specFontPtr->outline;
+        logfonts[lFontID].pixelSize = specFontPtr->pixelSize;
+        os2fonts = NULL;
+#ifdef DEBUG
+        printf("    resolved from spec cache [%s]\n",
+               logfonts[lFontID].fattrs.szFacename);
+#endif
+        goto got_it;
+    }
+
 #ifdef DEBUG
     /* Determine total number of fonts */
     reqFonts = 0L;
@@ -746,29 +859,12 @@ XLoadFont(display, name)
         }
     }
     /* Name has now been filled in with a correct or sane value */
-    /* Determine number of fonts */
-    reqFonts = 0L;
-    remFonts = GpiQueryFonts(globalPS, QF_PUBLIC,
-                             logfonts[lFontID].fattrs.szFacename, &reqFonts,
-                             (LONG) sizeof(FONTMETRICS), NULL);
-#ifdef DEBUG
-    printf("    nr.of fonts: %d\n", remFonts);
-#endif
-    reqFonts = remFonts;
-    /* Allocate space for the fonts */
-    if (reqFonts) {
-    os2fonts = (PFONTMETRICS) ckalloc(remFonts * sizeof(FONTMETRICS));
-    if (os2fonts == NULL) {
+    /* Get the fonts that apply, from the font cache if possible */
+    os2fonts = QueryFaceFonts(logfonts[lFontID].fattrs.szFacename, &reqFonts);
+    if (os2fonts == NULL && reqFonts > 0) {
         return (Font) 0;
     }
-    /* Retrieve the fonts */
-    /* Get the fonts that apply */
-    remFonts = GpiQueryFonts(globalPS, QF_PUBLIC,
-                             logfonts[lFontID].fattrs.szFacename, &reqFonts,
-                             (LONG) sizeof(FONTMETRICS), os2fonts);
-    } else {
-	os2fonts = NULL;
-    }
+    remFonts = 0;
 
 #ifdef DEBUG
     if (remFonts == GPI_ALTERROR)
@@ -1020,6 +1116,30 @@ else printf("TkOS2ScaleFont %d OK\n", logfonts[lFontID].pixelSize);
 #endif
 	if (os2fonts)
 	    ckfree((char *)os2fonts);
+        if (specFontPtr == NULL) {
+            /* Find a free slot, or evict the first unreferenced name */
+            for (;;) {
+                fontSpecPtr = &fontSpecs[fontSpecHand];
+                fontSpecHand = (fontSpecHand + 1) % FONTSPEC_CACHE_SIZE;
+                if (fontSpecPtr->hPtr == NULL) {
+                    break;
+                }
+                if (!fontSpecPtr->referenced) {
+#ifdef DEBUG
+                    printf("    evicting [%s] from spec cache\n",
+                           Tcl_GetHashKey(&fontSpecCache, fontSpecPtr->hPtr));
+#endif
+                    Tcl_DeleteHashEntry(fontSpecPtr->hPtr);
+                    break;
+                }
+                fontSpecPtr->referenced = 0;
+            }
+            fontSpecPtr->font = logfonts[lFontID];
+            fontSpecPtr->referenced = 0;
+            fontSpecPtr->hPtr = Tcl_CreateHashEntry(&fontSpecCache,
+                                                    (char *) specName, &new);
+            Tcl_SetHashValue(fontSpecPtr->hPtr, (ClientData) fontSpecPtr);
+        }
         nextLogicalFont++;
         return (Font) lFontID;
     }
@@ -1046,7 +1166,7 @@ XQueryFont(display, font_ID)
     Display* display;
     XID font_ID;
 {
-    XFontStruct *fontPtr = (XFontStruct *) ckalloc(sizeof(XFontStruct));
+    XFontStruct *fontPtr;
     LONG oldFont;
     FONTMETRICS fm;
     XCharStruct bounds;
@@ -1057,6 +1177,13 @@ XQueryFont(display, font_ID)
 printf("XQueryFont FID %d\n", font_ID);
 #endif
 
+    /* A font used in an earlier run may be in the font cache */
+    fontPtr = CachedFontMetrics(font_ID);
+    if (fontPtr != NULL) {
+	return fontPtr;
+    }
+
+    fontPtr = (XFontStruct *) ckalloc(sizeof(XFontStruct));
     if (!fontPtr) {
 	return NULL;
     }
@@ -1241,9 +1368,13 @@ fm.lMaxCharInc, fm.lMaxAscender, fm.lMaxDescender, fm.lMaxBaselineExt, bounds);
 	fontPtr = NULL;
     }    
 
+    if (fontPtr != NULL) {
+	CacheFontMetrics(fontPtr);
+    }
+
   restore:
     /* Restore font */
-    if (logfonts[(LONG)fontPtr->fid].setShear) {
+    if (logfonts[(LONG)font_ID].setShear) {
         GpiSetCharShear(globalPS, &noShear);
     }
     GpiSetCharSet(globalPS, oldFont);
@@ -1344,60 +1475,29 @@ XTextWidth(font_struct, string, count)
     _Xconst char* string;
     int count;
 {
-    /*
-    FONTMETRICS fm;
-    */
-    LONG oldFont;
-    POINTL aSize[TXTBOX_COUNT];
-    POINTL noShear= {0, 1};
+    int width;
 
 #ifdef DEBUG
     printf("XTextWidth [%s]\n", string);
 #endif
-    oldFont = GpiQueryCharSet(globalPS);
-    GpiSetCharSet(globalPS, (LONG) font_struct->fid);
-    /* Set slant if necessary */
-    if (logfonts[(LONG)font_struct->fid].setShear) {
-        GpiSetCharShear(globalPS, &(logfonts[(LONG)font_struct->fid].shear));
-    }
-    /* If this is an outline font, set the char box */
-    if (logfonts[(LONG)font_struct->fid].outline) {
-        SIZEF charBox;
-        rc = TkOS2ScaleFont(globalPS,
-                            logfonts[(LONG)font_struct->fid].pixelSize, 0);
-#ifdef DEBUG
-if (rc!=TRUE) printf("TkOS2ScaleFont %d ERROR %x\n",
-                     logfonts[(LONG)font_struct->fid].pixelSize,
-                     WinGetLastError(hab));
-else printf("TkOS2ScaleFont %d OK\n", logfonts[(LONG)font_struct->fid].pixelSize);
-        rc = GpiQueryCharBox(globalPS, &charBox);
-if (rc!=TRUE) printf("GpiQueryCharBox ERROR %x\n");
-else printf("GpiQueryCharBox OK: now cx %d (%d,%d), cy %d (%d,%d)\n", charBox.cx,
-            FIXEDINT(charBox.cx), FIXEDFRAC(charBox.cx), charBox.cy,
-            FIXEDINT(charBox.cy), FIXEDFRAC(charBox.cy));
-#endif
-    }
 
-    GpiQueryTextBox(globalPS, count, (PCH)string, TXTBOX_COUNT, aSize);
-    /* OS/2 PM does not have ths overhang
-     * GpiQueryFontMetrics(globalPS, sizeof(FONTMETRICS), &fm);
-     * size.cx -= fm.fmOverhang;
+    /*
+     * A single run is measured like any other: TkOS2TextWidths takes
+     * the width from the advance table of a bitmap font and only
+     * selects the font into the global PS when PM has to be asked.
      */
 
-    /* Restore font */
-    if (logfonts[(LONG)font_struct->fid].setShear) {
-        GpiSetCharShear(globalPS, &noShear);
-    }
-    GpiSetCharSet(globalPS, oldFont);
+    TkOS2TextWidths(font_struct, 1, &string, &count, &width,
+                    (XCharStruct *) NULL);
 
 #ifdef DEBUG
 printf("XTextWidth %s (font %d) returning %d\n", string, font_struct->fid,
-       aSize[TXTBOX_CONCAT].x - aSize[TXTBOX_BOTTOMLEFT].x);
+       width);
 #endif
 
-    return aSize[TXTBOX_CONCAT].x - aSize[TXTBOX_BOTTOMLEFT].x;
+    return width;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1426,10 +1526,7 @@ XTextExtents(font_struct, string, nchars, direction_return,
     int* font_descent_return;
     XCharStruct* overall_return;
 {
-    LONG oldFont;
-    FONTMETRICS fm;
-    POINTL aSize[TXTBOX_COUNT];
-    POINTL noShear= {0, 1};
+    int width;
 
 #ifdef DEBUG
 printf("XTextExtents\n");
@@ -1439,50 +1536,140 @@ printf("XTextExtents\n");
     *font_ascent_return = font_struct->ascent;
     *font_descent_return = font_struct->descent;
 
-    oldFont = GpiQueryCharSet(globalPS);
-    GpiSetCharSet(globalPS, (LONG) font_struct->fid);
-    /* Set slant if necessary */
-    if (logfonts[(LONG)font_struct->fid].setShear) {
-        GpiSetCharShear(globalPS, &(logfonts[(LONG)font_struct->fid].shear));
-    }
-    /* If this is an outline font, set the char box */
+    TkOS2TextWidths(font_struct, 1, &string, &nchars, &width,
+                    overall_return);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AdvanceWidth --
+ *
+ *	Compute the width of an 8-bit character string from the advance
+ *	table of a bitmap font, without asking PM.
+ *
+ * Results:
+ *	Returns TRUE and stores the width in *widthPtr if every character
+ *	was found in the table, FALSE if PM has to be asked.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static BOOL
+AdvanceWidth(font_struct, string, count, widthPtr)
+    XFontStruct* font_struct;
+    _Xconst char* string;
+    int count;
+    int* widthPtr;
+{
+    int i, index, nchars, width = 0;
+
+    /* Outline font widths depend on the char box, don't trust the table */
     if (logfonts[(LONG)font_struct->fid].outline) {
-        SIZEF charBox;
-        rc = TkOS2ScaleFont(globalPS,
-                            logfonts[(LONG)font_struct->fid].pixelSize, 0);
-#ifdef DEBUG
-if (rc!=TRUE) printf("TkOS2ScaleFont %d ERROR %x\n",
-                     logfonts[(LONG)font_struct->fid].pixelSize,
-                     WinGetLastError(hab));
-else printf("TkOS2ScaleFont %d OK\n", logfonts[(LONG)font_struct->fid].pixelSize);
-        rc = GpiQueryCharBox(globalPS, &charBox);
-if (rc!=TRUE) printf("GpiQueryCharBox ERROR %x\n", WinGetLastError(hab));
-else printf("GpiQueryCharBox OK: now cx %d (%d,%d), cy %d (%d,%d)\n", charBox.cx,
-            FIXEDINT(charBox.cx), FIXEDFRAC(charBox.cx), charBox.cy,
-            FIXEDINT(charBox.cy), FIXEDFRAC(charBox.cy));
-#endif
+        return FALSE;
+    }
+    if (font_struct->per_char == NULL) {
+        *widthPtr = count * font_struct->max_bounds.width;
+        return TRUE;
+    }
+    /* XQueryFont only builds the table for the first 255 code points */
+    nchars = MIN((int)(font_struct->max_char_or_byte2
+                       - font_struct->min_char_or_byte2 + 1), 255);
+    for (i = 0; i < count; i++) {
+        index = (int)(unsigned char)string[i]
+                - (int)font_struct->min_char_or_byte2;
+        if (index < 0 || index >= nchars) {
+            return FALSE;
+        }
+        width += font_struct->per_char[index].width;
     }
+    *widthPtr = width;
+    return TRUE;
+}
 
 /*
-    GpiQueryFontMetrics(globalPS, sizeof(FONTMETRICS), &fm);
-    overall_return->ascent = fm.lMaxAscender;
-    overall_return->descent = fm.lMaxDescender;
-*/
-    overall_return->ascent = logfonts[(LONG)font_struct->fid].fm.lMaxAscender;
-    overall_return->descent = logfonts[(LONG)font_struct->fid].fm.lMaxDescender;
-    GpiQueryTextBox(globalPS, nchars, (char *)string, TXTBOX_COUNT, aSize);
-    overall_return->width = aSize[TXTBOX_CONCAT].x - aSize[TXTBOX_BOTTOMLEFT].x;
-    overall_return->lbearing = 0;
-    /* OS/2 PM doesn't have this overhang
-     * overall_return->rbearing = overall_return->width - fm.fmOverhang;
-     */
-    overall_return->rbearing = overall_return->width;
+ *----------------------------------------------------------------------
+ *
+ * TkOS2TextWidths --
+ *
+ *	Compute the widths, and optionally the extents, of a number of
+ *	8-bit character strings in the same font.  Layout code that
+ *	measures many runs (listbox items, menu entries, text lines)
+ *	should use this instead of calling XTextWidth per run: the font
+ *	is selected into the global PS at most once, and not at all if
+ *	the advance table of the font covers every run.  XTextWidth and
+ *	XTextExtents are implemented as single-run calls of it.
+ *
+ * Results:
+ *	Fills widths[0..nruns-1] and, if extents is not NULL,
+ *	extents[0..nruns-1] with the values XTextWidth and XTextExtents
+ *	would return.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    /* Restore font */
-    if (logfonts[(LONG)font_struct->fid].setShear) {
-        GpiSetCharShear(globalPS, &noShear);
+void
+TkOS2TextWidths(font_struct, nruns, strings, counts, widths, extents)
+    XFontStruct* font_struct;
+    int nruns;
+    _Xconst char** strings;
+    int* counts;
+    int* widths;
+    XCharStruct* extents;
+{
+    LONG fid = (LONG) font_struct->fid;
+    LONG oldFont = 0;
+    BOOL selected = FALSE;
+    POINTL aSize[TXTBOX_COUNT];
+    POINTL noShear= {0, 1};
+    int i;
+
+#ifdef DEBUG
+    printf("TkOS2TextWidths %d runs (font %d)\n", nruns, fid);
+#endif
+
+    for (i = 0; i < nruns; i++) {
+        if (!AdvanceWidth(font_struct, strings[i], counts[i], &widths[i])) {
+            if (!selected) {
+                oldFont = GpiQueryCharSet(globalPS);
+                GpiSetCharSet(globalPS, fid);
+                /* Set slant if necessary */
+                if (logfonts[fid].setShear) {
+                    GpiSetCharShear(globalPS, &(logfonts[fid].shear));
+                }
+                /* If this is an outline font, set the char box */
+                if (logfonts[fid].outline) {
+                    rc = TkOS2ScaleFont(globalPS, logfonts[fid].pixelSize, 0);
+                }
+                selected = TRUE;
+            }
+            GpiQueryTextBox(globalPS, counts[i], (PCH)strings[i],
+                            TXTBOX_COUNT, aSize);
+            widths[i] = aSize[TXTBOX_CONCAT].x - aSize[TXTBOX_BOTTOMLEFT].x;
+        }
+        if (extents != NULL) {
+            extents[i].ascent = logfonts[fid].fm.lMaxAscender;
+            extents[i].descent = logfonts[fid].fm.lMaxDescender;
+            extents[i].width = widths[i];
+            extents[i].lbearing = 0;
+            extents[i].rbearing = widths[i];
+            extents[i].attributes = 0;
+        }
+    }
+
+    if (selected) {
+        /* Restore font */
+        if (logfonts[fid].setShear) {
+            GpiSetCharShear(globalPS, &noShear);
+        }
+        GpiSetCharSet(globalPS, oldFont);
     }
-    GpiSetCharSet(globalPS, oldFont);
 }
 
 /*
@@ -1720,3 +1907,569 @@ TkOS2ScaleFont(hps, pixelSize, pixelWidth)
 
     return GpiSetCharBox(hps, &sizef);
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FontCacheKey --
+ *
+ *	Construct the key under which the metrics of a logical font are
+ *	remembered in the font cache.
+ *
+ * Results:
+ *	Fills key, which must have room for FONTCACHE_KEYLEN chars.
+ *	The fields are at most 31 chars for the face name, 4 hex digits
+ *	for each USHORT, 5 digits for the code page, 10 for the pixel
+ *	size and 11 for each signed 32 bit value, 131 chars with the
+ *	separators and the terminating null.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FontCacheKey(logfont, key)
+    TkOS2Font *logfont;
+    char *key;
+{
+    sprintf(key, "%.31s|%x|%ld|%ld|%ld|%u|%x|%lu|%d|%ld,%ld",
+            logfont->fattrs.szFacename,
+            (unsigned) (logfont->fattrs.fsSelection & 0xffff),
+            (long) logfont->fattrs.lMatch,
+            (long) logfont->fattrs.lMaxBaselineExt,
+            (long) logfont->fattrs.lAveCharWidth,
+            (unsigned) (logfont->fattrs.usCodePage & 0xffff),
+            (unsigned) (logfont->fattrs.fsFontUse & 0xffff),
+            (unsigned long) logfont->pixelSize,
+            (int) logfont->outline,
+            (long) logfont->shear.x, (long) logfont->shear.y);
+    key[FONTCACHE_KEYLEN - 1] = '\0';
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FontCatalogKey --
+ *
+ *	Compute what the font cache file is checked against: the number
+ *	of public fonts, the time the PSFONTS directory of the boot drive
+ *	was last written and the size of the list of fonts registered in
+ *	the PM_Fonts application of the user profile.  Installing or
+ *	removing a font changes at least one of them.  None of them
+ *	needs the fonts to be enumerated, so this is cheap enough to do
+ *	at every startup.
+ *
+ * Results:
+ *	Fills in *numFontsPtr, *dirTimePtr and *listSizePtr, with 0 for
+ *	what can't be determined.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FontCatalogKey(numFontsPtr, dirTimePtr, listSizePtr)
+    LONG *numFontsPtr;
+    ULONG *dirTimePtr;
+    ULONG *listSizePtr;
+{
+    LONG reqFonts = 0L;
+    ULONG bootDrive;
+    FILESTATUS3 status;
+    char fontDir[16];
+
+    fontDir[0] = '\0';
+    *numFontsPtr = GpiQueryFonts(globalPS, QF_PUBLIC, NULL, &reqFonts,
+                                 (LONG) sizeof(FONTMETRICS), NULL);
+    if (*numFontsPtr == GPI_ALTERROR) {
+        *numFontsPtr = 0;
+    }
+
+    *dirTimePtr = 0;
+    if (DosQuerySysInfo(QSV_BOOT_DRIVE, QSV_BOOT_DRIVE, (PVOID) &bootDrive,
+                        sizeof(ULONG)) == NO_ERROR) {
+        sprintf(fontDir, "%c:\\PSFONTS", (char) ('A' + bootDrive - 1));
+        if (DosQueryPathInfo(fontDir, FIL_STANDARD, (PVOID) &status,
+                             sizeof(FILESTATUS3)) == NO_ERROR) {
+            *dirTimePtr = ((ULONG) *(USHORT *) &status.fdateLastWrite << 16)
+                          | *(USHORT *) &status.ftimeLastWrite;
+        }
+    }
+
+    if (!PrfQueryProfileSize(HINI_USERPROFILE, "PM_Fonts", NULL,
+                             listSizePtr)) {
+        *listSizePtr = 0;
+    }
+#ifdef DEBUG
+    printf("FontCatalogKey: %d fonts, %s %x, PM_Fonts %d\n", *numFontsPtr,
+           fontDir, *dirTimePtr, *listSizePtr);
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * QueryFaceFonts --
+ *
+ *	Get the metrics of all public fonts with the given face name,
+ *	from the font cache if it has them, otherwise from PM.
+ *
+ * Results:
+ *	Returns a ckalloc'ed array of FONTMETRICS (NULL if there are none
+ *	or memory is exhausted) and stores the number of fonts in
+ *	*countPtr.
+ *
+ * Side effects:
+ *	The result of the PM query is added to the font cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static PFONTMETRICS
+QueryFaceFonts(facename, countPtr)
+    PSZ facename;
+    LONG *countPtr;
+{
+    Tcl_HashEntry *entryPtr;
+    FontCacheFace *facePtr;
+    PFONTMETRICS os2fonts;
+    LONG reqFonts, remFonts;
+    int new;
+
+    if (fontCacheName != NULL) {
+        entryPtr = Tcl_FindHashEntry(&faceCache, (char *) facename);
+        if (entryPtr != NULL) {
+            facePtr = (FontCacheFace *) Tcl_GetHashValue(entryPtr);
+            *countPtr = facePtr->count;
+            if (facePtr->count == 0) {
+                return NULL;
+            }
+            os2fonts = (PFONTMETRICS)
+                       ckalloc(facePtr->count * sizeof(FONTMETRICS));
+            if (os2fonts != NULL) {
+                memcpy((void *)os2fonts, (void *)(facePtr + 1),
+                       facePtr->count * sizeof(FONTMETRICS));
+            }
+            return os2fonts;
+        }
+    }
+
+    /* Determine number of fonts */
+    reqFonts = 0L;
+    remFonts = GpiQueryFonts(globalPS, QF_PUBLIC, facename, &reqFonts,
+                             (LONG) sizeof(FONTMETRICS), NULL);
+#ifdef DEBUG
+    printf("    nr.of fonts: %d\n", remFonts);
+#endif
+    reqFonts = (remFonts == GPI_ALTERROR) ? 0 : remFonts;
+    os2fonts = NULL;
+    if (reqFonts) {
+        os2fonts = (PFONTMETRICS) ckalloc(reqFonts * sizeof(FONTMETRICS));
+        if (os2fonts == NULL) {
+            *countPtr = reqFonts;
+            return NULL;
+        }
+        remFonts = GpiQueryFonts(globalPS, QF_PUBLIC, facename, &reqFonts,
+                                 (LONG) sizeof(FONTMETRICS), os2fonts);
+    }
+    *countPtr = reqFonts;
+
+    if (fontCacheName != NULL) {
+        facePtr = (FontCacheFace *) ckalloc(sizeof(FontCacheFace)
+                                            + reqFonts * sizeof(FONTMETRICS));
+        if (facePtr != NULL) {
+            memset(facePtr->facename, '\0', FACESIZE);
+            strncpy(facePtr->facename, facename, FACESIZE - 1);
+            facePtr->count = reqFonts;
+            if (reqFonts) {
+                memcpy((void *)(facePtr + 1), (void *)os2fonts,
+                       reqFonts * sizeof(FONTMETRICS));
+            }
+            entryPtr = Tcl_CreateHashEntry(&faceCache, facePtr->facename,
+                                           &new);
+            Tcl_SetHashValue(entryPtr, (ClientData) facePtr);
+            fontCacheDirty = 1;
+        }
+    }
+    return os2fonts;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CachedFontMetrics --
+ *
+ *	Construct the XFontStruct for a logical font from the font cache,
+ *	as XQueryFont would.
+ *
+ * Results:
+ *	Returns a newly allocated XFontStruct, or NULL if the font isn't
+ *	in the cache.
+ *
+ * Side effects:
+ *	The font metrics of the logical font are filled in.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static XFontStruct *
+CachedFontMetrics(font_ID)
+    XID font_ID;
+{
+    char key[FONTCACHE_KEYLEN];
+    Tcl_HashEntry *entryPtr;
+    FontCacheMetrics *metricsPtr;
+    XFontStruct *fontPtr;
+    LONG *widths;
+    int i;
+
+    if (fontCacheName == NULL) {
+        return NULL;
+    }
+    FontCacheKey(&logfonts[font_ID], key);
+    entryPtr = Tcl_FindHashEntry(&metricsCache, key);
+    if (entryPtr == NULL) {
+        return NULL;
+    }
+    metricsPtr = (FontCacheMetrics *) Tcl_GetHashValue(entryPtr);
+
+    fontPtr = (XFontStruct *) ckalloc(sizeof(XFontStruct));
+    if (fontPtr == NULL) {
+        return NULL;
+    }
+    fontPtr->per_char = NULL;
+    if (metricsPtr->nwidths > 0) {
+        fontPtr->per_char = (XCharStruct *)
+                            ckalloc(sizeof(XCharStruct) * metricsPtr->nwidths);
+        if (fontPtr->per_char == NULL) {
+            ckfree((char *)fontPtr);
+            return NULL;
+        }
+        widths = (LONG *)(metricsPtr + 1);
+        for (i = 0; i < metricsPtr->nwidths; i++) {
+            fontPtr->per_char[i] = metricsPtr->max_bounds;
+            fontPtr->per_char[i].width = widths[i];
+        }
+    }
+#ifdef DEBUG
+    printf("    font %d metrics from font cache [%s]\n", font_ID, key);
+#endif
+
+    memcpy((void *)&logfonts[font_ID].fm, (void *)&metricsPtr->fm,
+           sizeof(FONTMETRICS));
+    fontPtr->fid = font_ID;
+    fontPtr->direction = metricsPtr->direction;
+    fontPtr->min_byte1 = 0;
+    fontPtr->max_byte1 = 0;
+    fontPtr->min_char_or_byte2 = metricsPtr->min_char;
+    fontPtr->max_char_or_byte2 = metricsPtr->max_char;
+    fontPtr->all_chars_exist = True;
+    fontPtr->default_char = metricsPtr->default_char;
+    fontPtr->n_properties = 0;
+    fontPtr->properties = NULL;
+    fontPtr->ascent = metricsPtr->ascent;
+    fontPtr->descent = metricsPtr->descent;
+    fontPtr->min_bounds = metricsPtr->min_bounds;
+    fontPtr->max_bounds = metricsPtr->max_bounds;
+    return fontPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheFontMetrics --
+ *
+ *	Remember the metrics XQueryFont computed for a logical font in
+ *	the font cache.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Adds an entry to the font cache, if it is enabled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheFontMetrics(fontPtr)
+    XFontStruct *fontPtr;
+{
+    char key[FONTCACHE_KEYLEN];
+    Tcl_HashEntry *entryPtr;
+    FontCacheMetrics *metricsPtr;
+    TkOS2Font *logfont = &logfonts[(LONG)fontPtr->fid];
+    LONG *widths;
+    int i, new, nwidths = 0;
+
+    if (fontCacheName == NULL) {
+        return;
+    }
+    FontCacheKey(logfont, key);
+    if (Tcl_FindHashEntry(&metricsCache, key) != NULL) {
+        return;
+    }
+    if (fontPtr->per_char != NULL) {
+        /* Same count as XQueryFont uses */
+        nwidths = MIN(((int)logfont->fm.sLastChar + 1), 255);
+    }
+    metricsPtr = (FontCacheMetrics *) ckalloc(sizeof(FontCacheMetrics)
+                                              + nwidths * sizeof(LONG));
+    if (metricsPtr == NULL) {
+        return;
+    }
+    memset(metricsPtr->key, '\0', FONTCACHE_KEYLEN);
+    strcpy(metricsPtr->key, key);
+    memcpy((void *)&metricsPtr->fm, (void *)&logfont->fm, sizeof(FONTMETRICS));
+    metricsPtr->direction = fontPtr->direction;
+    metricsPtr->ascent = fontPtr->ascent;
+    metricsPtr->descent = fontPtr->descent;
+    metricsPtr->min_char = fontPtr->min_char_or_byte2;
+    metricsPtr->max_char = fontPtr->max_char_or_byte2;
+    metricsPtr->default_char = fontPtr->default_char;
+    metricsPtr->min_bounds = fontPtr->min_bounds;
+    metricsPtr->max_bounds = fontPtr->max_bounds;
+    metricsPtr->nwidths = nwidths;
+    widths = (LONG *)(metricsPtr + 1);
+    for (i = 0; i < nwidths; i++) {
+        widths[i] = fontPtr->per_char[i].width;
+    }
+    entryPtr = Tcl_CreateHashEntry(&metricsCache, metricsPtr->key, &new);
+    Tcl_SetHashValue(entryPtr, (ClientData) metricsPtr);
+    fontCacheDirty = 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DiscardFontCache --
+ *
+ *	Forget everything in the font cache.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees all entries and the contents of the cache file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DiscardFontCache()
+{
+    Tcl_HashTable *tablePtr[2];
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+    char *valuePtr;
+    int i;
+
+    tablePtr[0] = &faceCache;
+    tablePtr[1] = &metricsCache;
+    for (i = 0; i < 2; i++) {
+        for (entryPtr = Tcl_FirstHashEntry(tablePtr[i], &search);
+             entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+            valuePtr = (char *) Tcl_GetHashValue(entryPtr);
+            /* Entries read from the file point into the file contents */
+            if (valuePtr < fontCacheImage
+                || valuePtr >= fontCacheImage + fontCacheSize) {
+                ckfree(valuePtr);
+            }
+        }
+        Tcl_DeleteHashTable(tablePtr[i]);
+    }
+    Tcl_InitHashTable(&faceCache, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&metricsCache, TCL_STRING_KEYS);
+    TkOS2FreeMem(fontCacheImage);
+    fontCacheImage = NULL;
+    fontCacheSize = 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2InitFontCache --
+ *
+ *	Read the font cache file named by TK_FONTCACHE, if any, and check
+ *	that it was written for the present set of fonts.  The file is read
+ *	into one block and the cache entries point straight into it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Enables the font cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2InitFontCache()
+{
+    char *name, *p, *end;
+    FILE *f;
+    long size;
+    FontCacheHeader *headerPtr;
+    FontCacheFace *facePtr;
+    FontCacheMetrics *metricsPtr;
+    Tcl_HashEntry *entryPtr;
+    ULONG i;
+    int new;
+
+    if (fontCacheName != NULL) {
+        /* Already done for an earlier interpreter */
+        return;
+    }
+    name = getenv("TK_FONTCACHE");
+    if (name == NULL || *name == '\0') {
+        return;
+    }
+    fontCacheName = ckalloc(strlen(name) + 1);
+    strcpy(fontCacheName, name);
+    FontCatalogKey(&catalogFonts, &catalogDirTime, &catalogListSize);
+    Tcl_InitHashTable(&faceCache, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&metricsCache, TCL_STRING_KEYS);
+
+    f = fopen(fontCacheName, "rb");
+    if (f == NULL) {
+        return;
+    }
+    fseek(f, 0L, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0L, SEEK_SET);
+    if (size < (long) sizeof(FontCacheHeader)) {
+        fclose(f);
+        fontCacheDirty = 1;
+        return;
+    }
+    fontCacheImage = (char *) TkOS2AllocMem((size_t) size);
+    if (fontCacheImage == NULL) {
+        fclose(f);
+        return;
+    }
+    fontCacheSize = (ULONG) size;
+    if (fread(fontCacheImage, 1, (size_t) size, f) != (size_t) size) {
+        fclose(f);
+        goto invalid;
+    }
+    fclose(f);
+
+    headerPtr = (FontCacheHeader *) fontCacheImage;
+    if (strncmp(headerPtr->magic, FONTCACHE_MAGIC, 8) != 0
+        || headerPtr->version != FONTCACHE_VERSION
+        || headerPtr->numFonts != catalogFonts
+        || headerPtr->dirTime != catalogDirTime
+        || headerPtr->listSize != catalogListSize
+        || headerPtr->xRes != aDevCaps[CAPS_HORIZONTAL_FONT_RES]
+        || headerPtr->yRes != aDevCaps[CAPS_VERTICAL_FONT_RES]) {
+#ifdef DEBUG
+        printf("TkOS2InitFontCache: %s out of date\n", fontCacheName);
+#endif
+        goto invalid;
+    }
+
+    p = fontCacheImage + sizeof(FontCacheHeader);
+    end = fontCacheImage + fontCacheSize;
+    for (i = 0; i < headerPtr->numFaces; i++) {
+        facePtr = (FontCacheFace *) p;
+        if (p + sizeof(FontCacheFace) > end || facePtr->count < 0
+            || p + sizeof(FontCacheFace) + facePtr->count * sizeof(FONTMETRICS)
+               > end) {
+            goto invalid;
+        }
+        facePtr->facename[FACESIZE - 1] = '\0';
+        entryPtr = Tcl_CreateHashEntry(&faceCache, facePtr->facename, &new);
+        Tcl_SetHashValue(entryPtr, (ClientData) facePtr);
+        p += sizeof(FontCacheFace) + facePtr->count * sizeof(FONTMETRICS);
+    }
+    for (i = 0; i < headerPtr->numMetrics; i++) {
+        metricsPtr = (FontCacheMetrics *) p;
+        if (p + sizeof(FontCacheMetrics) > end || metricsPtr->nwidths < 0
+            || metricsPtr->nwidths > 255
+            || p + sizeof(FontCacheMetrics) + metricsPtr->nwidths * sizeof(LONG)
+               > end) {
+            goto invalid;
+        }
+        metricsPtr->key[FONTCACHE_KEYLEN - 1] = '\0';
+        entryPtr = Tcl_CreateHashEntry(&metricsCache, metricsPtr->key, &new);
+        Tcl_SetHashValue(entryPtr, (ClientData) metricsPtr);
+        p += sizeof(FontCacheMetrics) + metricsPtr->nwidths * sizeof(LONG);
+    }
+#ifdef DEBUG
+    printf("TkOS2InitFontCache: %d faces, %d fonts from %s\n",
+           headerPtr->numFaces, headerPtr->numMetrics, fontCacheName);
+#endif
+    return;
+
+  invalid:
+    DiscardFontCache();
+    fontCacheDirty = 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2SaveFontCache --
+ *
+ *	Write the font cache back to its file if anything was added to it,
+ *	and release it.  Must be called while globalPS still exists.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Rewrites the file named by TK_FONTCACHE.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2SaveFontCache()
+{
+    FontCacheHeader header;
+    FontCacheFace *facePtr;
+    FontCacheMetrics *metricsPtr;
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+    FILE *f;
+
+    if (fontCacheName == NULL) {
+        return;
+    }
+    if (fontCacheDirty && (f = fopen(fontCacheName, "wb")) != NULL) {
+        memset((void *)&header, '\0', sizeof(FontCacheHeader));
+        strncpy(header.magic, FONTCACHE_MAGIC, 8);
+        header.version = FONTCACHE_VERSION;
+        header.numFonts = catalogFonts;
+        header.dirTime = catalogDirTime;
+        header.listSize = catalogListSize;
+        header.xRes = aDevCaps[CAPS_HORIZONTAL_FONT_RES];
+        header.yRes = aDevCaps[CAPS_VERTICAL_FONT_RES];
+        header.numFaces = faceCache.numEntries;
+        header.numMetrics = metricsCache.numEntries;
+        fwrite(&header, sizeof(FontCacheHeader), 1, f);
+        for (entryPtr = Tcl_FirstHashEntry(&faceCache, &search);
+             entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+            facePtr = (FontCacheFace *) Tcl_GetHashValue(entryPtr);
+            fwrite(facePtr, sizeof(FontCacheFace)
+                   + facePtr->count * sizeof(FONTMETRICS), 1, f);
+        }
+        for (entryPtr = Tcl_FirstHashEntry(&metricsCache, &search);
+             entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+            metricsPtr = (FontCacheMetrics *) Tcl_GetHashValue(entryPtr);
+            fwrite(metricsPtr, sizeof(FontCacheMetrics)
+                   + metricsPtr->nwidths * sizeof(LONG), 1, f);
+        }
+        fclose(f);
+    }
+    DiscardFontCache();
+    Tcl_DeleteHashTable(&faceCache);
+    Tcl_DeleteHashTable(&metricsCache);
+    ckfree(fontCacheName);
+    fontCacheName = NULL;
+    fontCacheDirty = 0;
+}
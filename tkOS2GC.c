@@ -12,46 +12,68 @@
  * SCCS: @(#) xgc.c 1.5 96/03/08 11:47:03
  */
 
-#include <stdlib.h>
-#include <tk.h>
+#include "tkOS2Int.h"
 
-#ifdef MAC_TCL
-#	include <Xlib.h>
-#else
-#	include <X11/Xlib.h>
-#endif
+/*
+ * Every change to a GC gives it a new generation number from this
+ * counter, so drawing code can tell whether a GC is still the same as
+ * when it last set up a PS for it.
+ */
+
+static unsigned long gcGeneration = 0;
+
+static void		ChangedGC _ANSI_ARGS_((GC gc));
+static void		FillGCValues _ANSI_ARGS_((XGCValues *gp,
+			    unsigned long mask, XGCValues *values));
 
-
 /*
  *----------------------------------------------------------------------
  *
- * XCreateGC --
+ * ChangedGC --
  *
- *	Allocate a new GC, and initialize the specified fields.
+ *	Record that a slot of the GC was changed.
  *
  * Results:
- *	Returns a newly allocated GC. 
+ *	None.
  *
  * Side effects:
- *	None.
+ *	Gives the GC a new generation number.
  *
  *----------------------------------------------------------------------
  */
 
-GC
-XCreateGC(display, d, mask, values)
-    Display* display;
-    Drawable d;
-    unsigned long mask;
-    XGCValues* values;
+static void
+ChangedGC(gc)
+    GC gc;
 {
-    GC gp;
+    TkOS2GC *gcPtr = (TkOS2GC *) gc;
 
-    gp = (XGCValues *)ckalloc(sizeof(XGCValues));
-    if (!gp) {
-	return None;
-    }
+    gcPtr->generation = ++gcGeneration;
+}
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * FillGCValues --
+ *
+ *	Initialize all fields of a GC, from values where the mask says
+ *	so and to the X defaults otherwise.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FillGCValues(gp, mask, values)
+    XGCValues *gp;
+    unsigned long mask;
+    XGCValues *values;
+{
     gp->function =       (mask & GCFunction)        ?values->function     :GXcopy;
     gp->plane_mask =     (mask & GCPlaneMask)       ?values->plane_mask   :~0;
     gp->foreground =     (mask & GCForeground)      ?values->foreground   :0;
@@ -75,8 +97,93 @@ XCreateGC(display, d, mask, values)
     gp->clip_mask =      (mask & GCClipMask)        ?values->clip_mask     :None;
     gp->dash_offset =    (mask & GCDashOffset)      ?values->dash_offset   :0;
     gp->dashes =         (mask & GCDashList)        ?values->dashes        :4;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * XCreateGC --
+ *
+ *	Allocate a new GC, and initialize the specified fields.
+ *
+ * Results:
+ *	Returns a newly allocated GC. 
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+GC
+XCreateGC(display, d, mask, values)
+    Display* display;
+    Drawable d;
+    unsigned long mask;
+    XGCValues* values;
+{
+    TkOS2GC *gcPtr;
+
+    gcPtr = (TkOS2GC *)ckalloc(sizeof(TkOS2GC));
+    if (!gcPtr) {
+	return None;
+    }
+    memset((VOID *) gcPtr, 0, sizeof(TkOS2GC));
+    FillGCValues(&gcPtr->values, mask, values);
+    gcPtr->generation = ++gcGeneration;
 
-    return gp;
+    return (GC) gcPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * XChangeGC --
+ *
+ *	Changes the slots of a GC selected by the mask.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Gives the GC a new generation number.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+XChangeGC(display, gc, mask, values)
+    Display* display;
+    GC gc;
+    unsigned long mask;
+    XGCValues* values;
+{
+    if (mask & GCFunction)		gc->function = values->function;
+    if (mask & GCPlaneMask)		gc->plane_mask = values->plane_mask;
+    if (mask & GCForeground)		gc->foreground = values->foreground;
+    if (mask & GCBackground)		gc->background = values->background;
+    if (mask & GCLineWidth)		gc->line_width = values->line_width;
+    if (mask & GCLineStyle)		gc->line_style = values->line_style;
+    if (mask & GCCapStyle)		gc->cap_style = values->cap_style;
+    if (mask & GCJoinStyle)		gc->join_style = values->join_style;
+    if (mask & GCFillStyle)		gc->fill_style = values->fill_style;
+    if (mask & GCFillRule)		gc->fill_rule = values->fill_rule;
+    if (mask & GCArcMode)		gc->arc_mode = values->arc_mode;
+    if (mask & GCTile)			gc->tile = values->tile;
+    if (mask & GCStipple)		gc->stipple = values->stipple;
+    if (mask & GCTileStipXOrigin)	gc->ts_x_origin = values->ts_x_origin;
+    if (mask & GCTileStipYOrigin)	gc->ts_y_origin = values->ts_y_origin;
+    if (mask & GCFont)			gc->font = values->font;
+    if (mask & GCSubwindowMode)	gc->subwindow_mode = values->subwindow_mode;
+    if (mask & GCGraphicsExposures)
+	gc->graphics_exposures = values->graphics_exposures;
+    if (mask & GCClipXOrigin)		gc->clip_x_origin = values->clip_x_origin;
+    if (mask & GCClipYOrigin)		gc->clip_y_origin = values->clip_y_origin;
+    if (mask & GCClipMask)		gc->clip_mask = values->clip_mask;
+    if (mask & GCDashOffset)		gc->dash_offset = values->dash_offset;
+    if (mask & GCDashList)		gc->dashes = values->dashes;
+    ChangedGC(gc);
 }
 
 /*
@@ -117,7 +224,8 @@ XFreeGC(d, gc)
  *	None.
  *
  * Side effects:
- *	Each function sets some slot in the GC.
+ *	Each function sets some slot in the GC and gives it a new
+ *	generation number.
  *
  *----------------------------------------------------------------------
  */
@@ -129,6 +237,7 @@ XSetForeground(display, gc, foreground)
     unsigned long foreground;
 {
     gc->foreground = foreground;
+    ChangedGC(gc);
 }
 
 void 
@@ -138,6 +247,7 @@ XSetBackground(display, gc, background)
     unsigned long background;
 {
     gc->background = background;
+    ChangedGC(gc);
 }
 
 void
@@ -147,6 +257,7 @@ XSetFunction(display, gc, function)
     int function;
 {
     gc->function = function;
+    ChangedGC(gc);
 }
 
 void
@@ -156,6 +267,7 @@ XSetFillRule(display, gc, fill_rule)
     int fill_rule;
 {
     gc->fill_rule = fill_rule;
+    ChangedGC(gc);
 }
 
 void
@@ -165,6 +277,7 @@ XSetFillStyle(display, gc, fill_style)
     int fill_style;
 {
     gc->fill_style = fill_style;
+    ChangedGC(gc);
 }
 
 void
@@ -175,6 +288,7 @@ XSetTSOrigin(display, gc, x, y)
 {
     gc->ts_x_origin = x;
     gc->ts_y_origin = y;
+    ChangedGC(gc);
 }
 
 void
@@ -184,6 +298,7 @@ XSetArcMode(display, gc, arc_mode)
     int arc_mode;
 {
     gc->arc_mode = arc_mode;
+    ChangedGC(gc);
 }
 
 void
@@ -193,6 +308,7 @@ XSetStipple(display, gc, stipple)
     Pixmap stipple;
 {
     gc->stipple = stipple;
+    ChangedGC(gc);
 }
 
 void
@@ -205,9 +321,11 @@ XSetLineAttributes(display, gc, line_width, line_style, cap_style,
     int cap_style;
     int join_style;
 {
+    gc->line_width = line_width;
     gc->line_style = line_style;
     gc->cap_style = cap_style;
     gc->join_style = join_style;
+    ChangedGC(gc);
 }
 
 void
@@ -217,6 +335,7 @@ XSetClipMask(display, gc, pixmap)
     Pixmap pixmap;
 {
     gc->clip_mask = pixmap;
+    ChangedGC(gc);
 }
 
 void
@@ -228,4 +347,5 @@ XSetClipOrigin(display, gc, clip_x_origin, clip_y_origin)
 {
     gc->clip_x_origin = clip_x_origin;
     gc->clip_y_origin = clip_y_origin;
+    ChangedGC(gc);
 }
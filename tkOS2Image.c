@@ -44,6 +44,10 @@ PutPixel(image, x, y, pixel)
 /*
     y = image->height - y;
 */
+    if (image->obdata != NULL) {
+	/* Shared images are stored bottom line first */
+	y = image->height - 1 - y;
+    }
 
     destPtr = &(image->data[(y * image->bytes_per_line)
     	+ (x * (image->bits_per_pixel >> 3))]);
@@ -51,17 +55,10 @@ PutPixel(image, x, y, pixel)
 #ifdef DEBUG
     printf("PutPixel %x", pixel);
 #endif
-rc = GpiQueryLogColorTable(globalPS, 0, pixel, 1L, &rgb);
-pixel = rgb;
+    rgb = TkOS2IndexToRGB((LONG) pixel);
+    pixel = rgb;
 #ifdef DEBUG
-                if (rc == QLCT_ERROR) {
-                    printf("    GpiQueryLogColorTable ERROR %x\n",
-                           WinGetLastError(hab));
-                } else if (rc == QLCT_RGB) {
-                    printf("    table in RGB mode, no element returned");
-                } else {
-                    printf("    color %x", rgb);
-                }
+    printf("    color %x", rgb);
 #endif
 /*
     destPtr[0] = GetBValue(pixel);
@@ -85,9 +82,119 @@ pixel = rgb;
 static void
 imfree(XImage *ximage)
 {
-    if (ximage->data) ckfree(ximage->data);
+    if (ximage->obdata != NULL) {
+	TkOS2ShmDetach(ximage);
+    } else if (ximage->data) {
+	ckfree(ximage->data);
+    }
     ckfree(ximage);
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2ShmAttach --
+ *
+ *	Give an image a pixel buffer that lives as long as the image
+ *	itself, instead of one that is allocated and thrown away for
+ *	every block that is put.  The lines in the buffer are stored
+ *	bottom line first, the order GpiSetBitmapBits expects, so that
+ *	TkPutImage can hand (part of) it to PM directly instead of
+ *	reversing the lines into a copy first.  The caller is expected
+ *	to fill the lines from the end of the buffer backwards; XPutPixel
+ *	takes care of this itself.
+ *
+ * Results:
+ *	Returns 1 if the image now has a shared buffer of at least
+ *	bytesPerLine * height bytes in image->data, 0 if memory ran
+ *	out, in which case the image is left alone.
+ *
+ * Side effects:
+ *	Sets the data, bytes_per_line and height of the image.  The
+ *	buffer is only reallocated when it needs to grow.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2ShmAttach(image, bytesPerLine, height)
+    XImage *image;
+    int bytesPerLine;
+    int height;
+{
+    TkOS2ShmInfo *shmPtr = TkOS2ShmImageInfo(image);
+    size_t size = (size_t) bytesPerLine * height;
+
+    if (shmPtr == NULL) {
+	shmPtr = (TkOS2ShmInfo *) ckalloc(sizeof(TkOS2ShmInfo));
+	if (shmPtr == NULL) {
+	    return 0;
+	}
+	shmPtr->buffer = NULL;
+	shmPtr->size = 0;
+	shmPtr->infoPtr = NULL;
+	shmPtr->numColors = 0;
+	image->obdata = (XPointer) shmPtr;
+    }
+    if (shmPtr->size < size) {
+	char *buffer = (char *) TkOS2AllocMem(size);
+
+	if (buffer == NULL) {
+	    return 0;
+	}
+	if (shmPtr->buffer != NULL) {
+	    TkOS2FreeMem(shmPtr->buffer);
+	}
+	shmPtr->buffer = buffer;
+	shmPtr->size = size;
+#ifdef DEBUG
+	printf("TkOS2ShmAttach %x: %d bytes\n", image, size);
+#endif
+    }
+    image->data = shmPtr->buffer;
+    image->bytes_per_line = bytesPerLine;
+    image->height = height;
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2ShmDetach --
+ *
+ *	Release the shared buffer of an image, if it has one.  Must be
+ *	called before an image that went through TkOS2ShmAttach is freed
+ *	with XFree.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees the buffer and the cached bitmap header; image->data is
+ *	set to NULL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2ShmDetach(image)
+    XImage *image;
+{
+    TkOS2ShmInfo *shmPtr = TkOS2ShmImageInfo(image);
+
+    if (shmPtr == NULL) {
+	return;
+    }
+    if (shmPtr->buffer != NULL) {
+	TkOS2FreeMem(shmPtr->buffer);
+    }
+    if (shmPtr->infoPtr != NULL) {
+	ckfree((char *) shmPtr->infoPtr);
+    }
+    ckfree((char *) shmPtr);
+    image->obdata = NULL;
+    image->data = NULL;
+}
 
 /*
  *----------------------------------------------------------------------
@@ -130,6 +237,7 @@ printf("XCreateImage\n");
         imagePtr->xoffset = offset;
         imagePtr->format = format;
         imagePtr->data = data;
+        imagePtr->obdata = NULL;
         imagePtr->byte_order = MSBFirst;
         imagePtr->bitmap_unit = 32;
         imagePtr->bitmap_bit_order = MSBFirst;
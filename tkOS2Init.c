@@ -101,6 +101,9 @@ TkPlatformInit(interp)
     Tcl_Interp *interp;
 {
     char *libDir;
+#ifdef _LANG				/* Perl */
+    Var variable;
+#endif
 
 /* User profile (OS2.INI) support removed since beta */
 /*    Tcl_DStringInit(&ds);
@@ -139,14 +142,39 @@ TkPlatformInit(interp)
 /*    Tcl_DStringFree(&ds);
 */
 
+    /*
+     * Read the persistent font catalog, if one was asked for, before the
+     * default widget fonts get loaded.
+     */
+
+    TkOS2InitFontCache();
+
+    /*
+     * Commands to tune and watch the pacing of redraws and the latency
+     * of event handling, to control motion compression and the batching
+     * of child geometry changes, to choose lightweight child windows,
+     * and to watch the reuse of pixmap resources.
+     */
+
+    Tcl_CreateCommand(interp, "os2redraw", TkOS2RedrawCmd,
+	    (ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
+    Tcl_CreateCommand(interp, "os2latency", TkOS2LatencyCmd,
+	    (ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
+    Tcl_CreateCommand(interp, "os2motion", TkOS2MotionCmd,
+	    (ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
+    Tcl_CreateCommand(interp, "os2geometry", TkOS2GeometryCmd,
+	    (ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
+    Tcl_CreateCommand(interp, "os2lightweight", TkOS2LightweightCmd,
+	    (ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
+    Tcl_CreateCommand(interp, "os2pixmap", TkOS2PixmapCmd,
+	    (ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
+
     /*
      * If the path doesn't exist, look for the library relative to the
      * tk.dll library.
      */
 
 #ifdef _LANG				/* Perl */
-    Var variable;
-
     variable = LangFindVar( interp, NULL,  "tk_library");
     libDir = LangString(Tcl_GetVar(interp, variable, TCL_GLOBAL_ONLY));
     if (libDir == NULL || *libDir == '\0') {
@@ -305,6 +333,8 @@ WinGetLastError(hab));
 void
 TkOS2ExitPM (void)
 {
+    TkOS2SaveFontCache();
+    TkOS2FreePixmapPools();
     GpiSetBitmap(globalPS, NULLHANDLE);
     GpiDestroyPS(globalPS);
     DevCloseDC(hScreenDC);
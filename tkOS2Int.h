@@ -179,6 +179,14 @@ typedef struct TkWmInfo {
     TkWindow **cmapList;	/* Array of window with private colormaps. */
     int cmapCount;		/* Number of windows in array. */
 
+    /*
+     * Spatial index of the mapped windows in the toplevel, for finding
+     * the window at a point without asking PM (see tkOS2Wm.c).
+     */
+
+    struct TkOS2WindowIndex *indexPtr;
+				/* NULL until the first query. */
+
     /*
      * Miscellaneous information.
      */
@@ -225,6 +233,8 @@ typedef struct TkWmInfo {
  *				was called the top-level itself wasn't
  *				specified, so we added it implicitly at
  *				the end of the list.
+ * WM_COLORMAPS_PENDING -	non-zero means a call to InstallColormapsIdle
+ *				has already been scheduled for this window.
  */
 
 #define WM_NEVER_MAPPED			(1<<0)
@@ -239,6 +249,7 @@ typedef struct TkWmInfo {
 #define WM_ADDED_TOPLEVEL_COLORMAP	(1<<9)
 #define WM_WIDTH_NOT_RESIZABLE		(1<<10)
 #define WM_HEIGHT_NOT_RESIZABLE		(1<<11)
+#define WM_COLORMAPS_PENDING		(1<<12)
 
 /*
  * Window styles for various types of toplevel windows.
@@ -296,8 +307,30 @@ typedef struct {
     int type;
     HWND handle;
     TkWindow *winPtr;
+    int flags;			/* TOD_* flags defined below. */
+    int rootX, rootY;		/* Root coordinates of the window's origin,
+				 * cached by Tk_GetRootCoords. */
+    unsigned long rootGeneration;
+				/* Generation the cached coordinates belong
+				 * to; 0 means none are cached. */
+    int lightChildren;		/* Number of lightweight children, so
+				 * drawing needn't look for them if 0. */
 } TkOS2Window;
 
+/*
+ * Flag bits in TkOS2Window.flags:
+ *
+ * TOD_ALL_MOTION -		Report every motion event for this window,
+ *				don't collapse them; see
+ *				TkOS2SetMotionCompression.
+ * TOD_LIGHTWEIGHT -		The window has no PM window of its own but
+ *				is drawn into its nearest ancestor that has
+ *				one; see TkOS2SetLightweight.
+ */
+
+#define TOD_ALL_MOTION	0x1
+#define TOD_LIGHTWEIGHT	0x2
+
 typedef struct {
     int type;
     HBITMAP handle;
@@ -306,6 +339,13 @@ typedef struct {
     HWND parent;
     HDC dc;
     HPS hps;
+    unsigned long gcGeneration;	/* Generation of the GC whose line
+				 * attributes are set up in hps, 0 if
+				 * none.  See RenderObject. */
+    USHORT lineType;		/* Line type set up along with them. */
+    int keepAttrs;		/* Set by RenderObject to tell
+				 * TkOS2ReleaseDrawablePS the attributes
+				 * in hps are still those of the GC. */
 } TkOS2Bitmap;
     
 typedef union {
@@ -314,10 +354,40 @@ typedef union {
     TkOS2Bitmap bitmap;
 } TkOS2Drawable;
 
+/*
+ * A GC is a pointer to the XGCValues at the start of a TkOS2GC, which
+ * adds the information tkOS2GC.c keeps about it.
+ */
+
+typedef struct {
+    XGCValues values;		/* Must be first. */
+    unsigned long generation;	/* Changes whenever the GC changes; unique
+				 * over all GCs. */
+} TkOS2GC;
+
+#define TkOS2GCGeneration(gc) (((TkOS2GC *) (gc))->generation)
+
+/*
+ * A shared image keeps its pixel buffer, in the bottom-up line order PM
+ * wants, and the BITMAPINFO2 used to hand it to GpiSetBitmapBits alive
+ * between calls to TkPutImage.  See TkOS2ShmAttach in tkOS2Image.c.
+ */
+
+typedef struct {
+    char *buffer;		/* Pixel lines, bottom line first. */
+    size_t size;		/* Number of bytes in buffer. */
+    BITMAPINFO2 *infoPtr;	/* Header plus color table, or NULL. */
+    int numColors;		/* Room in the color table of infoPtr. */
+} TkOS2ShmInfo;
+
+#define TkOS2ShmImageInfo(image) ((TkOS2ShmInfo *) (image)->obdata)
+
 /*
  * The following macros are used to retrieve internal values from a Drawable.
  */
 #define TkOS2GetHWND(w) (((TkOS2Drawable *) w)->window.handle)
+#define TkOS2IsLightweight(w) ((((TkOS2Drawable *) (w))->type != TOD_BITMAP) \
+	&& (((TkOS2Drawable *) (w))->window.flags & TOD_LIGHTWEIGHT))
 #define TkOS2GetWinPtr(w) (((TkOS2Drawable*)w)->window.winPtr)
 #define TkOS2GetHBITMAP(w) (((TkOS2Drawable*)w)->bitmap.handle)
 #define TkOS2GetColormap(w) (((TkOS2Drawable*)w)->bitmap.colormap)
@@ -338,13 +408,35 @@ typedef union {
 
 typedef struct {
     HPAL palette;		/* Palette handle used when drawing. */
-    ULONG size;			/* Number of entries in the palette. */
+    ULONG size;			/* Number of entries in the palette, including
+				 * freed entries waiting to be reused. */
     int stale;			/* 1 if palette needs to be realized,
 				 * otherwise 0.  If the palette is stale,
 				 * then an idle handler is scheduled to
 				 * realize the palette. */
     Tcl_HashTable refCounts;	/* Hash table of palette entry reference counts
 				 * indexed by pixel value. */
+    ULONG *entries;		/* Shadow copy of the palette entries, indexed
+				 * by pixel value, so allocation doesn't have
+				 * to read the palette back from PM. */
+    ULONG numEntries;		/* Number of slots allocated in entries. */
+    ULONG *freeSlots;		/* Stack of palette indices below size that
+				 * were freed by XFreeColors and can be
+				 * reused; room for numEntries indices.  A
+				 * freed entry keeps its old color in the
+				 * palette but is no longer in rgbIndex. */
+    ULONG numFree;		/* Number of indices on freeSlots. */
+    Tcl_HashTable rgbIndex;	/* Hash table of palette indices indexed by
+				 * RGB value of the entry. */
+    ULONG dirtyFirst, dirtyLast;
+				/* Range of entries changed since the palette
+				 * was last written by TkOS2SyncPalette.  No
+				 * entries changed if dirtyFirst > dirtyLast. */
+    Tcl_HashTable specCache;	/* Parsed XColor for color specifications
+				 * given to XParseColor, indexed by the
+				 * specification string. */
+    int numSpecs;		/* Number of entries in specCache, flushed
+				 * when it reaches MAX_SPEC_CACHE. */
 } TkOS2Colormap;
 
 /*
@@ -376,6 +468,69 @@ typedef struct {
     SWP swp;
 } TkOS2WINDOWPOS;
 
+/*
+ * Counters kept by Tk_GetPixmap and Tk_FreePixmap about the reuse of
+ * pooled memory PS's and cached bitmaps, see TkOS2GetPixmapStats.
+ */
+
+typedef struct {
+    unsigned long psCreated;	/* DC/PS pairs created. */
+    unsigned long psReused;	/* DC/PS pairs taken from the pool. */
+    unsigned long psDestroyed;	/* DC/PS pairs destroyed, pool full. */
+    unsigned long bitmapsCreated;
+    unsigned long bitmapsReused;
+    unsigned long bitmapsDeleted;
+    int psPooled;		/* DC/PS pairs in the pool now. */
+    int bitmapsCached;		/* Bitmaps in the cache now. */
+} TkOS2PixmapStats;
+
+/*
+ * Counters kept by TranslateEvent about motion compression, see
+ * TkOS2GetMotionStats.
+ */
+
+typedef struct {
+    unsigned long motionEvents;	/* WM_MOUSEMOVEs translated. */
+    unsigned long collapsed;	/* Replaced by a later one before they
+				 * were queued. */
+    unsigned long delivered;	/* Passed on to TkOS2PointerEvent. */
+} TkOS2MotionStats;
+
+/*
+ * Counters kept about batched child geometry changes, see
+ * TkOS2GetGeometryStats.
+ */
+
+typedef struct {
+    unsigned long requests;	/* Moves and resizes asked for. */
+    unsigned long pmCalls;	/* WinSetWindowPos and WinSetMultWindowPos
+				 * calls made for them. */
+    unsigned long callsSaved;	/* Difference of the two. */
+} TkOS2GeometryStats;
+
+/*
+ * Timing of the frames of redrawing presented by the event layer, see
+ * TkOS2GetRedrawStats.  Times are in milliseconds.
+ */
+
+typedef struct {
+    int interval;		/* Least time between frames. */
+    unsigned long paints;	/* WM_PAINTs translated. */
+    unsigned long exposes;	/* Expose events queued for them. */
+    unsigned long frames;	/* Frames presented. */
+    unsigned long framesDrawn;	/* Frames whose redrawing is done. */
+    unsigned long inputDeferred;
+				/* Frames put off for waiting input. */
+    int lastToplevels;		/* Toplevels in the last frame. */
+    int lastWindows;		/* Windows in the last frame. */
+    unsigned long lastInterval;	/* Time between the last two frames. */
+    unsigned long maxInterval;	/* Longest time between two frames. */
+    unsigned long lastDraw;	/* Time from presenting the last frame
+				 * until its redrawing was done. */
+    unsigned long maxDraw;	/* Longest such time. */
+    unsigned long totalDraw;	/* Sum of those times. */
+} TkOS2RedrawStats;
+
 /*
  * The following macro retrieves the PM palette from a colormap.
  */
@@ -386,35 +541,89 @@ typedef struct {
  * Internal procedures used by more than one source file.
  */
 
+extern void		TkOS2CancelGeometry _ANSI_ARGS_((HWND hwnd));
 extern MRESULT EXPENTRY TkOS2ChildProc _ANSI_ARGS_((HWND hwnd, ULONG message,
                             MPARAM param1, MPARAM param2));
 extern void		TkOS2ClipboardRender _ANSI_ARGS_((TkWindow *winPtr,
                             ULONG format));
+extern void		TkOS2FreePixmapPools _ANSI_ARGS_((void));
 extern HAB	 	TkOS2GetAppInstance _ANSI_ARGS_((void));
 extern HPS		TkOS2GetDrawablePS _ANSI_ARGS_((Display *display,
 			    Drawable d, TkOS2PSState* state));
+extern void		TkOS2ExcludeLightweight _ANSI_ARGS_((HPS hps,
+			    TkWindow *winPtr));
+extern void		TkOS2ExposeLightweight _ANSI_ARGS_((TkWindow *winPtr,
+			    XEvent *eventPtr));
+extern void		TkOS2FlushGeometry _ANSI_ARGS_((void));
 extern TkOS2Drawable *	TkOS2GetDrawableFromHandle _ANSI_ARGS_((HWND hwnd));
+extern int		TkOS2GeometryCmd _ANSI_ARGS_((ClientData clientData,
+			    Tcl_Interp *interp, int argc, char **argv));
+extern void		TkOS2GetGeometryStats _ANSI_ARGS_((
+			    TkOS2GeometryStats *statsPtr));
+extern HWND		TkOS2GetHeavyweight _ANSI_ARGS_((TkWindow *winPtr,
+			    POINTL *originPtr));
+extern HPS		TkOS2GetLightweightPS _ANSI_ARGS_((TkWindow *winPtr,
+			    HWND *hwndPtr));
 extern unsigned int	TkOS2GetModifierState _ANSI_ARGS_((ULONG message,
 			    MPARAM param1, MPARAM param2));
+extern void		TkOS2GetMotionStats _ANSI_ARGS_((
+			    TkOS2MotionStats *statsPtr));
+extern void		TkOS2GetPixmapStats _ANSI_ARGS_((
+			    TkOS2PixmapStats *statsPtr));
+extern void		TkOS2GetRedrawStats _ANSI_ARGS_((
+			    TkOS2RedrawStats *statsPtr));
 extern HPAL		TkOS2GetSystemPalette _ANSI_ARGS_((void));
 extern HMODULE		TkOS2GetTkModule _ANSI_ARGS_((void));
+extern void		TkOS2InvalidateWindow _ANSI_ARGS_((TkWindow *winPtr));
+extern int		TkOS2LatencyCmd _ANSI_ARGS_((ClientData clientData,
+			    Tcl_Interp *interp, int argc, char **argv));
+extern TkWindow *	TkOS2LightweightAt _ANSI_ARGS_((TkWindow *winPtr,
+			    int *xPtr, int *yPtr));
+extern int		TkOS2LightweightCmd _ANSI_ARGS_((ClientData clientData,
+			    Tcl_Interp *interp, int argc, char **argv));
+extern void		TkOS2RootCoordsChanged _ANSI_ARGS_((void));
+extern TkWindow *	TkOS2RootCoordsToWindow _ANSI_ARGS_((int rootX,
+			    int rootY, HWND *hwndPtr));
 extern void		TkOS2PointerDeadWindow _ANSI_ARGS_((TkWindow *winPtr));
 extern void		TkOS2PointerEvent _ANSI_ARGS_((XEvent *event,
                             TkWindow *winPtr));
 extern void		TkOS2PointerInit _ANSI_ARGS_((void));
+extern void		TkOS2PointerLeft _ANSI_ARGS_((HWND hwnd));
+extern int		TkOS2MotionCmd _ANSI_ARGS_((ClientData clientData,
+			    Tcl_Interp *interp, int argc, char **argv));
+extern int		TkOS2PixmapCmd _ANSI_ARGS_((ClientData clientData,
+			    Tcl_Interp *interp, int argc, char **argv));
+extern int		TkOS2RedrawCmd _ANSI_ARGS_((ClientData clientData,
+			    Tcl_Interp *interp, int argc, char **argv));
 extern void		TkOS2ReleaseDrawablePS _ANSI_ARGS_((Drawable d,
 			    HPS hps, TkOS2PSState* state));
+extern void		TkOS2SaveFontCache _ANSI_ARGS_((void));
+extern int		TkOS2SetFrameInterval _ANSI_ARGS_((int interval));
+extern int		TkOS2SetGeometryBatching _ANSI_ARGS_((int batch));
+extern int		TkOS2SetLatencyTracking _ANSI_ARGS_((int track));
+extern int		TkOS2SetLightweight _ANSI_ARGS_((Tk_Window tkwin,
+			    int lightweight));
+extern void		TkOS2SetLightweightClass _ANSI_ARGS_((
+			    char *className, int lightweight));
+extern int		TkOS2SetMotionCompression _ANSI_ARGS_((
+			    Tk_Window tkwin, int compress));
+extern void		TkOS2SyncPalette _ANSI_ARGS_((Colormap colormap));
+extern LONG		TkOS2IndexToRGB _ANSI_ARGS_((LONG index));
 extern HPAL		TkOS2SelectPalette _ANSI_ARGS_((HPS hps, HWND hwnd,
                             Colormap colormap));
 extern MRESULT EXPENTRY TkOS2TopLevelProc _ANSI_ARGS_((HWND hwnd, ULONG message,
                             MPARAM param1, MPARAM param2));
+extern void		TkOS2InitFontCache _ANSI_ARGS_((void));
 extern MRESULT EXPENTRY TkOS2FrameProc _ANSI_ARGS_((HWND hwnd, ULONG message,
                             MPARAM param1, MPARAM param2));
 extern void		TkOS2UpdateCursor _ANSI_ARGS_((TkWindow *winPtr));
+extern void		TkOS2WindowIndexChanged _ANSI_ARGS_((
+			    TkWindow *winPtr));
 extern void		TkOS2WmConfigure _ANSI_ARGS_((TkWindow *winPtr,
                             SWP *pos));
 extern int		TkOS2WmInstallColormaps _ANSI_ARGS_((HWND hwnd,
 			    int message, int isForemost));
+extern void		TkOS2WmRealizeColormap _ANSI_ARGS_((Colormap colormap));
 extern void		TkOS2WmSetLimits _ANSI_ARGS_((HWND hwnd,
                             TRACKINFO *info));
 extern void 		TkOS2XInit _ANSI_ARGS_((HAB hInstance));
@@ -425,8 +634,14 @@ extern LONG		TkOS2WindowWidth _ANSI_ARGS_ ((TkOS2Drawable *todPtr));
 extern char		*TkOS2ReverseImageLines _ANSI_ARGS_ ((XImage *image));
 extern BOOL		TkOS2ScaleFont _ANSI_ARGS_ ((HPS hps, ULONG pointSize,
 			    ULONG pointWidth));
+extern void		TkOS2TextWidths _ANSI_ARGS_ ((XFontStruct *font_struct,
+			    int nruns, _Xconst char **strings, int *counts,
+			    int *widths, XCharStruct *extents));
 extern void *TkOS2AllocMem _ANSI_ARGS_((size_t size));
 extern void TkOS2FreeMem _ANSI_ARGS_((void *mem));
+extern int TkOS2MemStats _ANSI_ARGS_((int cls, size_t *sizePtr,
+			    unsigned long *allocsPtr, unsigned long *inUsePtr,
+			    unsigned long *peakPtr, unsigned long *chunksPtr));
 
 /* Global variables */
 extern HAB hab;	/* Anchor block */
@@ -9,9 +9,313 @@
  * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
  */
 
-#include "tkOS2Int.h"
+/*
+ * TkOS2AllocMem used to map every request straight to DosAllocMem, which
+ * commits whole pages and takes 64 KB of address space per call.  Requests
+ * up to MAX_SMALL bytes are now served from per size class free lists,
+ * carved out of CHUNK_SIZE chunks; larger ones still go to the system
+ * directly, without a header, so a 64 KB buffer takes exactly one 64 KB
+ * allocation and stays page aligned.  A chunk whose blocks have all been
+ * freed goes back to the system, unless its size class has fewer than
+ * KEEP_EMPTY empty chunks, so a class that is emptied and refilled over
+ * and over doesn't allocate and free a chunk every time.
+ *
+ * Compiling with TKOS2MEM_MMAP defined replaces DosAllocMem by mmap and
+ * the OS/2 mutex by a pthread mutex, so this file can be built and
+ * exercised on its own on other systems.
+ */
+
+#ifdef TKOS2MEM_MMAP
+#   include <stdio.h>
+#   include <stddef.h>
+#   include <string.h>
+#   include <sys/mman.h>
+#   include <pthread.h>
+#   include <stdlib.h>
+#   define _ANSI_ARGS_(x)	x
+#   define panic(msg)	(fprintf(stderr, "%s\n", msg), abort())
+extern void *TkOS2AllocMem _ANSI_ARGS_((size_t size));
+extern void TkOS2FreeMem _ANSI_ARGS_((void *mem));
+#else
+#   include "tkOS2Int.h"
+#endif
+
+#define CHUNK_SIZE	65536
+#define NUM_CLASSES	10
+#define MIN_CLASS_SHIFT	5	/* Smallest class holds 32 bytes. */
+#define MAX_SMALL	((1 << (MIN_CLASS_SHIFT + NUM_CLASSES - 1)) \
+			    - sizeof(BlockHeader))
+
+#define MAGIC_SMALL	0x4b54534dUL	/* "MSTK" */
+#define KEEP_EMPTY	1	/* Empty chunks kept per size class. */
+
+#define PAGE_MASK	4095	/* System allocations are page aligned. */
+#define LARGE_BUCKETS	64
+
+/*
+ * Every small block starts with a header that points to the descriptor
+ * of its chunk, which holds the size class.  Sizes include the header.  Small blocks are never page aligned, since
+ * the header is at the start of a block carved out of a chunk, so a page
+ * aligned pointer handed to TkOS2FreeMem is a large block.  Large blocks
+ * are remembered in a small hash table by address, with their size.
+ */
+
+typedef union BlockHeader {
+    struct {
+	unsigned long magic;
+	unsigned long info;
+    } h;
+    double align;		/* Keep the data after it aligned. */
+} BlockHeader;
+
+typedef struct FreeBlock {
+    struct FreeBlock *nextPtr;
+} FreeBlock;
+
+typedef struct LargeBlock {
+    void *mem;			/* Address returned by SysAlloc. */
+    size_t size;		/* Size of the system allocation. */
+    struct LargeBlock *nextPtr;	/* Next in the same bucket. */
+} LargeBlock;
+
+/*
+ * Each chunk has a descriptor with its own free list and count of blocks
+ * in use.  The chunks of a size class that have room for another block
+ * are kept on a doubly linked list; full chunks are taken off it.
+ * Descriptors are carved out of chunks of their own, which are never
+ * returned, and recycled through spareChunks.
+ */
+
+typedef struct Chunk {
+    char *base;			/* Address returned by SysAlloc. */
+    int cls;			/* Size class of the blocks. */
+    FreeBlock *freeList;	/* Freed blocks of this chunk. */
+    size_t carved;		/* Bytes handed out from base so far. */
+    unsigned long live;		/* Blocks in use. */
+    struct Chunk *prevPtr;	/* Neighbours on the list of chunks with */
+    struct Chunk *nextPtr;	/* room, or nextPtr in spareChunks. */
+} Chunk;
+
+typedef struct SizeClass {
+    Chunk *availPtr;		/* Chunks with room for another block. */
+    unsigned long emptyChunks;	/* Chunks without blocks in use. */
+    unsigned long allocs;	/* Statistics, see TkOS2MemStats. */
+    unsigned long frees;
+    unsigned long inUse;
+    unsigned long peak;
+    unsigned long chunks;
+} SizeClass;
+
+static SizeClass classes[NUM_CLASSES];
+static Chunk *spareChunks = NULL;
+static char *descPtr = NULL;
+static size_t descLeft = 0;
+static unsigned long largeAllocs = 0, largeInUse = 0;
+static LargeBlock *largeBlocks[LARGE_BUCKETS];
+
+#define LARGE_HASH(mem)	((((unsigned long) (mem)) >> 12) % LARGE_BUCKETS)
+
+#ifdef TKOS2MEM_MMAP
+static pthread_mutex_t memLock = PTHREAD_MUTEX_INITIALIZER;
+#   define LOCK()	pthread_mutex_lock(&memLock)
+#   define UNLOCK()	pthread_mutex_unlock(&memLock)
+#else
+static HMTX memLock = NULLHANDLE;
+static void		Lock _ANSI_ARGS_((void));
+#   define LOCK()	Lock()
+#   define UNLOCK()	DosReleaseMutexSem(memLock)
+#endif
+
+static void *		SysAlloc _ANSI_ARGS_((size_t size));
+static void		SysFree _ANSI_ARGS_((void *mem, size_t size));
+static Chunk *		NewChunk _ANSI_ARGS_((int cls));
+static void		FreeChunk _ANSI_ARGS_((Chunk *chunkPtr));
+
+#ifndef TKOS2MEM_MMAP
+/*
+ *----------------------------------------------------------------------
+ *
+ * Lock --
+ *
+ *	Get exclusive access to the free lists, creating the mutex
+ *	semaphore the first time.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May block until another thread releases the lists.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Lock()
+{
+    if (memLock == NULLHANDLE) {
+	DosEnterCritSec();
+	if (memLock == NULLHANDLE) {
+	    DosCreateMutexSem(NULL, &memLock, 0L, FALSE);
+	}
+	DosExitCritSec();
+    }
+    DosRequestMutexSem(memLock, SEM_INDEFINITE_WAIT);
+}
+#endif
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SysAlloc, SysFree --
+ *
+ *	Get committed, zeroed read/write memory from the system and give
+ *	it back.
+ *
+ * Results:
+ *	SysAlloc returns the base address or NULL.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+SysAlloc(size)
+    size_t size;
+{
+    void *mem;
+#ifdef TKOS2MEM_MMAP
+    mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+	    -1, 0);
+    return (mem == MAP_FAILED) ? NULL : mem;
+#else
+    APIRET rc;
+
+    rc = DosAllocMem(&mem, size, PAG_READ|PAG_WRITE|PAG_COMMIT);
+    if (rc != NO_ERROR) {
+#ifdef DEBUG
+    printf("    DosAllocMem ERROR %d\n", rc);
+#endif
+        return NULL;
+    }
+    return mem;
+#endif
+}
+
+static void
+SysFree(mem, size)
+    void *mem;
+    size_t size;
+{
+#ifdef TKOS2MEM_MMAP
+    munmap(mem, size);
+#else
+    DosFreeMem((PVOID)mem);
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NewChunk --
+ *
+ *	Get a chunk for a size class from the system and put it on the
+ *	list of chunks with room.  Must be called with the lock held.
+ *
+ * Results:
+ *	The descriptor of the new chunk, or NULL.
+ *
+ * Side effects:
+ *	May allocate a chunk for descriptors as well.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Chunk *
+NewChunk(cls)
+    int cls;
+{
+    SizeClass *classPtr = &classes[cls];
+    Chunk *chunkPtr;
+    char *base;
+
+    base = (char *) SysAlloc(CHUNK_SIZE);
+    if (base == NULL) {
+	return NULL;
+    }
+    if (spareChunks != NULL) {
+	chunkPtr = spareChunks;
+	spareChunks = chunkPtr->nextPtr;
+    } else {
+	if (descLeft < sizeof(Chunk)) {
+	    descPtr = (char *) SysAlloc(CHUNK_SIZE);
+	    if (descPtr == NULL) {
+		descLeft = 0;
+		SysFree((void *) base, CHUNK_SIZE);
+		return NULL;
+	    }
+	    descLeft = CHUNK_SIZE;
+	}
+	chunkPtr = (Chunk *) descPtr;
+	descPtr += sizeof(Chunk);
+	descLeft -= sizeof(Chunk);
+    }
+    chunkPtr->base = base;
+    chunkPtr->cls = cls;
+    chunkPtr->freeList = NULL;
+    chunkPtr->carved = 0;
+    chunkPtr->live = 0;
+    chunkPtr->prevPtr = NULL;
+    chunkPtr->nextPtr = classPtr->availPtr;
+    if (classPtr->availPtr != NULL) {
+	classPtr->availPtr->prevPtr = chunkPtr;
+    }
+    classPtr->availPtr = chunkPtr;
+    classPtr->emptyChunks++;
+    classPtr->chunks++;
+    return chunkPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeChunk --
+ *
+ *	Give an empty chunk back to the system.  Must be called with the
+ *	lock held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Takes the chunk off the list of chunks with room and recycles
+ *	its descriptor.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeChunk(chunkPtr)
+    Chunk *chunkPtr;
+{
+    SizeClass *classPtr = &classes[chunkPtr->cls];
+
+    if (chunkPtr->prevPtr != NULL) {
+	chunkPtr->prevPtr->nextPtr = chunkPtr->nextPtr;
+    } else {
+	classPtr->availPtr = chunkPtr->nextPtr;
+    }
+    if (chunkPtr->nextPtr != NULL) {
+	chunkPtr->nextPtr->prevPtr = chunkPtr->prevPtr;
+    }
+    classPtr->chunks--;
+    SysFree((void *) chunkPtr->base, CHUNK_SIZE);
+    chunkPtr->base = NULL;
+    chunkPtr->nextPtr = spareChunks;
+    spareChunks = chunkPtr;
+}
 
-
 /*
  *----------------------------------------------------------------------
  *
@@ -20,10 +324,11 @@
  *	Allocate memory, read/write access and committed.
  *
  * Results:
- *	Base address of allocated memory or NULL.
+ *	Base address of allocated memory or NULL.  The memory is zeroed,
+ *	like memory from DosAllocMem.
  *
  * Side effects:
- *	None.
+ *	May allocate a new chunk for the size class.
  *
  *----------------------------------------------------------------------
  */
@@ -32,26 +337,87 @@ void *
 TkOS2AllocMem (size)
 size_t	size;
 {
-    void *mem;
-    APIRET rc;
+    BlockHeader *hdrPtr;
+    SizeClass *classPtr;
+    Chunk *chunkPtr;
+    LargeBlock *largePtr;
+    size_t blockSize;
+    int cls;
+
 #ifdef DEBUG
     printf("TkOS2AllocMem %d\n", size);
 #endif
-    rc = DosAllocMem(&mem, size, PAG_READ|PAG_WRITE|PAG_COMMIT);
-    if (rc == NO_ERROR) {
-#ifdef DEBUG
-    printf("    returning %x\n", mem);
-#endif
-        return (void *)mem;
+    if (size > MAX_SMALL) {
+	largePtr = (LargeBlock *) TkOS2AllocMem(sizeof(LargeBlock));
+	if (largePtr == NULL) {
+	    return NULL;
+	}
+	largePtr->mem = SysAlloc(size);
+	if (largePtr->mem == NULL) {
+	    TkOS2FreeMem((void *) largePtr);
+	    return NULL;
+	}
+	largePtr->size = size;
+	LOCK();
+	largePtr->nextPtr = largeBlocks[LARGE_HASH(largePtr->mem)];
+	largeBlocks[LARGE_HASH(largePtr->mem)] = largePtr;
+	largeAllocs++;
+	largeInUse++;
+	UNLOCK();
+	return largePtr->mem;
+    }
+
+    cls = 0;
+    blockSize = 1 << MIN_CLASS_SHIFT;
+    while (blockSize - sizeof(BlockHeader) < size) {
+	cls++;
+	blockSize <<= 1;
+    }
+    classPtr = &classes[cls];
+
+    LOCK();
+    chunkPtr = classPtr->availPtr;
+    if (chunkPtr == NULL) {
+	chunkPtr = NewChunk(cls);
+	if (chunkPtr == NULL) {
+	    UNLOCK();
+	    return NULL;
+	}
     }
-    else {
+    if (chunkPtr->freeList != NULL) {
+	hdrPtr = (BlockHeader *) chunkPtr->freeList;
+	chunkPtr->freeList = chunkPtr->freeList->nextPtr;
+    } else {
+	hdrPtr = (BlockHeader *) (chunkPtr->base + chunkPtr->carved);
+	chunkPtr->carved += blockSize;
+    }
+    if (chunkPtr->live++ == 0) {
+	classPtr->emptyChunks--;
+    }
+    if ((chunkPtr->freeList == NULL)
+	    && (chunkPtr->carved + blockSize > CHUNK_SIZE)) {
+	/* The chunk is full now */
+	classPtr->availPtr = chunkPtr->nextPtr;
+	if (chunkPtr->nextPtr != NULL) {
+	    chunkPtr->nextPtr->prevPtr = NULL;
+	}
+    }
+    classPtr->allocs++;
+    classPtr->inUse++;
+    if (classPtr->inUse > classPtr->peak) {
+	classPtr->peak = classPtr->inUse;
+    }
+    UNLOCK();
+
+    hdrPtr->h.magic = MAGIC_SMALL;
+    hdrPtr->h.info = (unsigned long) chunkPtr;
+    memset((void *) (hdrPtr + 1), 0, blockSize - sizeof(BlockHeader));
 #ifdef DEBUG
-    printf("    DosAllocMem ERROR %d\n", rc);
+    printf("    returning %x (class %d)\n", hdrPtr + 1, cls);
 #endif
-        return (void *)NULL;
-    }
+    return (void *) (hdrPtr + 1);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -63,7 +429,9 @@ size_t	size;
  *	Memory is freed, unless NULL was given.
  *
  * Side effects:
- *	None.
+ *	Small blocks go back to the free list of their chunk, and the
+ *	chunk to the system if it is empty and enough empty chunks are
+ *	kept already.  Large blocks go back to the system.
  *
  *----------------------------------------------------------------------
  */
@@ -72,5 +440,119 @@ void
 TkOS2FreeMem (mem)
 void	*mem;
 {
-    if (mem != (void *)NULL) DosFreeMem((PVOID)mem);
+    BlockHeader *hdrPtr;
+    SizeClass *classPtr;
+    Chunk *chunkPtr;
+    FreeBlock *blockPtr;
+    LargeBlock *largePtr, **linkPtr;
+    size_t blockSize;
+
+    if (mem == (void *)NULL) {
+	return;
+    }
+    if (((unsigned long) mem & PAGE_MASK) == 0) {
+	LOCK();
+	for (linkPtr = &largeBlocks[LARGE_HASH(mem)]; *linkPtr != NULL;
+		linkPtr = &(*linkPtr)->nextPtr) {
+	    if ((*linkPtr)->mem == mem) {
+		break;
+	    }
+	}
+	largePtr = *linkPtr;
+	if (largePtr == NULL) {
+	    UNLOCK();
+	    panic("TkOS2FreeMem: not a block from TkOS2AllocMem");
+	}
+	*linkPtr = largePtr->nextPtr;
+	largeInUse--;
+	UNLOCK();
+	SysFree(mem, largePtr->size);
+	TkOS2FreeMem((void *) largePtr);
+	return;
+    }
+    hdrPtr = ((BlockHeader *) mem) - 1;
+    chunkPtr = (Chunk *) hdrPtr->h.info;
+    if (hdrPtr->h.magic != MAGIC_SMALL || chunkPtr == NULL
+	    || (char *) hdrPtr < chunkPtr->base
+	    || (char *) hdrPtr >= chunkPtr->base + CHUNK_SIZE) {
+	panic("TkOS2FreeMem: not a block from TkOS2AllocMem");
+    }
+    hdrPtr->h.magic = 0;
+    classPtr = &classes[chunkPtr->cls];
+    blockSize = 1 << (MIN_CLASS_SHIFT + chunkPtr->cls);
+    blockPtr = (FreeBlock *) hdrPtr;
+    LOCK();
+    if ((chunkPtr->freeList == NULL)
+	    && (chunkPtr->carved + blockSize > CHUNK_SIZE)) {
+	/* The chunk was full, it has room again */
+	chunkPtr->prevPtr = NULL;
+	chunkPtr->nextPtr = classPtr->availPtr;
+	if (classPtr->availPtr != NULL) {
+	    classPtr->availPtr->prevPtr = chunkPtr;
+	}
+	classPtr->availPtr = chunkPtr;
+    }
+    blockPtr->nextPtr = chunkPtr->freeList;
+    chunkPtr->freeList = blockPtr;
+    classPtr->frees++;
+    classPtr->inUse--;
+    if (--chunkPtr->live == 0) {
+	if (classPtr->emptyChunks >= KEEP_EMPTY) {
+	    FreeChunk(chunkPtr);
+	} else {
+	    classPtr->emptyChunks++;
+	}
+    }
+    UNLOCK();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2MemStats --
+ *
+ *	Report the usage of one size class of TkOS2AllocMem.  Class
+ *	NUM_CLASSES stands for the large blocks passed through to the
+ *	system, for which only allocations and blocks in use are counted.
+ *
+ * Results:
+ *	Returns 0 if cls is out of range.  Otherwise fills in the
+ *	largest request size of the class (0 for large blocks), the
+ *	number of allocations, blocks in use, the peak of blocks in use
+ *	and the number of chunks currently held, and returns 1.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2MemStats (cls, sizePtr, allocsPtr, inUsePtr, peakPtr, chunksPtr)
+int		cls;
+size_t		*sizePtr;
+unsigned long	*allocsPtr;
+unsigned long	*inUsePtr;
+unsigned long	*peakPtr;
+unsigned long	*chunksPtr;
+{
+    if (cls < 0 || cls > NUM_CLASSES) {
+	return 0;
+    }
+    LOCK();
+    if (cls == NUM_CLASSES) {
+	*sizePtr = 0;
+	*allocsPtr = largeAllocs;
+	*inUsePtr = largeInUse;
+	*peakPtr = 0;
+	*chunksPtr = 0;
+    } else {
+	*sizePtr = (1 << (MIN_CLASS_SHIFT + cls)) - sizeof(BlockHeader);
+	*allocsPtr = classes[cls].allocs;
+	*inUsePtr = classes[cls].inUse;
+	*peakPtr = classes[cls].peak;
+	*chunksPtr = classes[cls].chunks;
+    }
+    UNLOCK();
+    return 1;
 }
@@ -14,7 +14,151 @@
 
 #include "tkOS2Int.h"
 
-
+/*
+ * Tk creates and frees temporary pixmaps all the time for double buffered
+ * redraws.  Instead of opening a memory DC, creating a PS and a bitmap for
+ * every one of them and destroying them again in Tk_FreePixmap, freed
+ * DC/PS pairs are kept in a small pool and freed bitmaps in a cache keyed
+ * by their size and depth, to be picked up by the next Tk_GetPixmap.
+ *
+ * The bitmap cache only hands out bitmaps of exactly the requested size:
+ * a pixmap's height is taken from its bitmap dimension to flip Y
+ * coordinates, but stipple patterns and GpiQueryBitmapBits work on the
+ * real bitmap, so an oversized bitmap would show through.
+ */
+
+#define PS_POOL_SIZE		8
+#define BITMAP_CACHE_SIZE	16
+
+typedef struct {
+    HDC dc;
+    HPS hps;
+} PooledPS;
+
+typedef struct {
+    HBITMAP handle;
+    int width, height, depth;
+} CachedBitmap;
+
+static PooledPS psPool[PS_POOL_SIZE];
+static int numPooledPS = 0;
+static CachedBitmap bitmapCache[BITMAP_CACHE_SIZE];	/* Oldest first. */
+static int numCachedBitmaps = 0;
+static TkOS2PixmapStats pixmapStats;
+
+/*
+ * Forward declarations for procedures defined in this file:
+ */
+
+static int		GetPooledPS _ANSI_ARGS_((TkOS2Drawable *todPtr,
+			    SIZEL *sizlPtr));
+static HBITMAP		GetCachedBitmap _ANSI_ARGS_((int width, int height,
+			    int depth));
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetPooledPS --
+ *
+ *	Provide a memory DC and PS for a new pixmap, from the pool if
+ *	possible.
+ *
+ * Results:
+ *	Fills in the dc and hps of the pixmap and returns 1, or returns
+ *	0 if no DC or PS could be created.
+ *
+ * Side effects:
+ *	A pooled PS is reset to its initial state and the new page size.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GetPooledPS(todPtr, sizlPtr)
+    TkOS2Drawable *todPtr;
+    SIZEL *sizlPtr;
+{
+    DEVOPENSTRUC dop = {0L, (PSZ)"DISPLAY", NULL, 0L, 0L, 0L, 0L, 0L, 0L};
+
+    if (numPooledPS > 0) {
+        numPooledPS--;
+        todPtr->bitmap.dc = psPool[numPooledPS].dc;
+        todPtr->bitmap.hps = psPool[numPooledPS].hps;
+        if (GpiSetPS(todPtr->bitmap.hps, sizlPtr, PU_PELS)) {
+            pixmapStats.psReused++;
+            return 1;
+        }
+#ifdef DEBUG
+printf("GpiSetPS failed in Tk_GetPixmap, lastError %x\n", WinGetLastError(hab));
+#endif
+        GpiDestroyPS(todPtr->bitmap.hps);
+        DevCloseDC(todPtr->bitmap.dc);
+    }
+
+    todPtr->bitmap.dc = DevOpenDC(hab, OD_MEMORY, (PSZ)"*", 5L,
+                                  (PDEVOPENDATA)&dop, NULLHANDLE);
+    if (todPtr->bitmap.dc == DEV_ERROR) {
+#ifdef DEBUG
+printf("DevOpenDC failed in Tk_GetPixmap\n");
+#endif
+        return 0;
+    }
+#ifdef DEBUG
+printf("DevOpenDC in Tk_GetPixmap returns %x\n", todPtr->bitmap.dc);
+#endif
+    todPtr->bitmap.hps = GpiCreatePS(hab, todPtr->bitmap.dc, sizlPtr,
+                                     PU_PELS | GPIT_NORMAL | GPIA_ASSOC);
+    if (todPtr->bitmap.hps == GPI_ERROR) {
+        DevCloseDC(todPtr->bitmap.dc);
+#ifdef DEBUG
+printf("GpiCreatePS failed in Tk_GetPixmap\n");
+#endif
+        return 0;
+    }
+#ifdef DEBUG
+printf("GpiCreatePS in Tk_GetPixmap returns %x\n", todPtr->bitmap.hps);
+#endif
+    pixmapStats.psCreated++;
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetCachedBitmap --
+ *
+ *	Look for a freed bitmap of the given size and depth.
+ *
+ * Results:
+ *	The bitmap handle, or NULLHANDLE if there is none.
+ *
+ * Side effects:
+ *	Removes the bitmap from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HBITMAP
+GetCachedBitmap(width, height, depth)
+    int width, height, depth;
+{
+    HBITMAP handle;
+    int i;
+
+    /* Search newest first, it is most likely to be asked for again */
+    for (i = numCachedBitmaps - 1; i >= 0; i--) {
+        if (bitmapCache[i].width == width && bitmapCache[i].height == height
+                && bitmapCache[i].depth == depth) {
+            handle = bitmapCache[i].handle;
+            numCachedBitmaps--;
+            memmove((VOID *) &bitmapCache[i], (VOID *) &bitmapCache[i + 1],
+                    (numCachedBitmaps - i) * sizeof(CachedBitmap));
+            return handle;
+        }
+    }
+    return NULLHANDLE;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -26,7 +170,8 @@
  *	Returns a handle to a new pixmap.
  *
  * Side effects:
- *	Allocates a new OS/2 bitmap, hps, DC.
+ *	Allocates a new OS/2 bitmap, hps, DC, or reuses ones released
+ *	by Tk_FreePixmap.
  *
  *----------------------------------------------------------------------
  */
@@ -42,12 +187,9 @@ Tk_GetPixmap(display, d, width, height, depth)
     TkOS2Drawable *newTodPtr, *todPtr;
     BITMAPINFOHEADER2 bmpInfo;
     LONG rc;
-    DEVOPENSTRUC dop = {0L, (PSZ)"DISPLAY", NULL, 0L, 0L, 0L, 0L, 0L, 0L};
-    SIZEL sizl = {0,0}; /* use same page size as device */
-/*
-SIZEL sizl;
-*/
-sizl.cx = width; sizl.cy = height;
+    SIZEL sizl;
+
+    sizl.cx = width; sizl.cy = height;
     
     display->request++;
 
@@ -58,13 +200,17 @@ sizl.cx = width; sizl.cy = height;
 
     newTodPtr->type = TOD_BITMAP;
     newTodPtr->bitmap.depth = depth;
+    newTodPtr->bitmap.gcGeneration = 0;
+    newTodPtr->bitmap.keepAttrs = 0;
     todPtr = (TkOS2Drawable *)d;
     if (todPtr->type != TOD_BITMAP) {
 #ifdef DEBUG
 printf("Tk_GetPixmap %x, depth %d, parent %x, %dx%d\n", newTodPtr, depth,
 todPtr->window.handle, sizl.cx, sizl.cy);
 #endif
-        newTodPtr->bitmap.parent = todPtr->window.handle;
+        newTodPtr->bitmap.parent = TkOS2IsLightweight(d)
+		? TkOS2GetHeavyweight(todPtr->window.winPtr, NULL)
+		: todPtr->window.handle;
         if (todPtr->window.winPtr == NULL) {
             newTodPtr->bitmap.colormap = DefaultColormap(display,
                     DefaultScreen(display));
@@ -79,55 +225,40 @@ depth, todPtr->bitmap.parent, sizl.cx, sizl.cy);
         newTodPtr->bitmap.colormap = todPtr->bitmap.colormap;
         newTodPtr->bitmap.parent = todPtr->bitmap.parent;
     }
-    /*
-    bmpInfo.cbFix = sizeof(BITMAPINFOHEADER2);
-    */
-    bmpInfo.cbFix = 16L;
-    bmpInfo.cx = width;
-    bmpInfo.cy = height;
-    bmpInfo.cPlanes = 1;
-    bmpInfo.cBitCount = depth;
-    newTodPtr->bitmap.dc = DevOpenDC(hab, OD_MEMORY, (PSZ)"*", 5L,
-                                     (PDEVOPENDATA)&dop, NULLHANDLE);
-    if (newTodPtr->bitmap.dc == DEV_ERROR) {
-#ifdef DEBUG
-printf("DevOpenDC failed in Tk_GetPixmap\n");
-#endif
-        ckfree((char *) newTodPtr);
-        return (Pixmap)None;
-    }
-#ifdef DEBUG
-printf("DevOpenDC in Tk_GetPixmap returns %x\n", newTodPtr->bitmap.dc);
-#endif
-    newTodPtr->bitmap.hps = GpiCreatePS(hab, newTodPtr->bitmap.dc, &sizl,
-                                        PU_PELS | GPIT_NORMAL | GPIA_ASSOC);
-    if (newTodPtr->bitmap.hps == GPI_ERROR) {
-        DevCloseDC(newTodPtr->bitmap.dc);
-#ifdef DEBUG
-printf("GpiCreatePS failed in Tk_GetPixmap\n");
-#endif
+    if (!GetPooledPS(newTodPtr, &sizl)) {
         ckfree((char *) newTodPtr);
         return (Pixmap)None;
     }
-#ifdef DEBUG
-printf("GpiCreatePS in Tk_GetPixmap returns %x\n", newTodPtr->bitmap.hps);
-#endif
-    newTodPtr->bitmap.handle = GpiCreateBitmap(newTodPtr->bitmap.hps,
-                                               &bmpInfo, 0L, NULL, NULL);
 
-    if (newTodPtr->bitmap.handle == NULLHANDLE) {
+    newTodPtr->bitmap.handle = GetCachedBitmap(width, height, depth);
+    if (newTodPtr->bitmap.handle != NULLHANDLE) {
+        pixmapStats.bitmapsReused++;
+    } else {
+        /*
+        bmpInfo.cbFix = sizeof(BITMAPINFOHEADER2);
+        */
+        bmpInfo.cbFix = 16L;
+        bmpInfo.cx = width;
+        bmpInfo.cy = height;
+        bmpInfo.cPlanes = 1;
+        bmpInfo.cBitCount = depth;
+        newTodPtr->bitmap.handle = GpiCreateBitmap(newTodPtr->bitmap.hps,
+                                                   &bmpInfo, 0L, NULL, NULL);
+
+        if (newTodPtr->bitmap.handle == NULLHANDLE) {
 #ifdef DEBUG
 printf("GpiCreateBitmap ERROR %x in Tk_GetPixmap\n", WinGetLastError(hab));
 #endif
-	ckfree((char *) newTodPtr);
-	return (Pixmap)None;
-    }
+            GpiDestroyPS(newTodPtr->bitmap.hps);
+            DevCloseDC(newTodPtr->bitmap.dc);
+	    ckfree((char *) newTodPtr);
+	    return (Pixmap)None;
+        }
 #ifdef DEBUG
 printf("GpiCreateBitmap in Tk_GetPixmap returns %x\n", newTodPtr->bitmap.handle);
 #endif
-    sizl.cx = width;
-    sizl.cy = height;
-    rc = GpiSetBitmapDimension(newTodPtr->bitmap.handle, &sizl);
+        pixmapStats.bitmapsCreated++;
+        rc = GpiSetBitmapDimension(newTodPtr->bitmap.handle, &sizl);
 #ifdef DEBUG
 if (rc == FALSE) {
 printf("    GpiSetBitmapDimension ERROR, lastError %x\n", WinGetLastError(hab));
@@ -141,11 +272,13 @@ printf("    GpiQueryBitmapDimension ERROR, lastError %x\n", WinGetLastError(hab)
 printf("    GpiQueryBitmapDimension: %dx%d\n", sizl.cx, sizl.cy);
 }
 #endif
+    }
     rc = GpiSetBitmap(newTodPtr->bitmap.hps, newTodPtr->bitmap.handle);
     if (rc == HBM_ERROR) {
 #ifdef DEBUG
 printf("GpiSetBitmap returned HBM_ERROR, lastError %x\n", WinGetLastError(hab));
 #endif
+	GpiDeleteBitmap(newTodPtr->bitmap.handle);
         GpiDestroyPS(newTodPtr->bitmap.hps);
         DevCloseDC(newTodPtr->bitmap.dc);
         ckfree((char *) newTodPtr);
@@ -158,7 +291,7 @@ newTodPtr->bitmap.handle, newTodPtr->bitmap.hps, rc);
 
     return (Pixmap)newTodPtr;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -170,7 +303,8 @@ newTodPtr->bitmap.handle, newTodPtr->bitmap.hps, rc);
  *	None.
  *
  * Side effects:
- *	Deletes the bitmap created by Tk_GetPixmap.
+ *	Puts the bitmap created by Tk_GetPixmap in the bitmap cache and
+ *	its DC and PS in the pool, or deletes them if there is no room.
  *
  *----------------------------------------------------------------------
  */
@@ -182,6 +316,7 @@ Tk_FreePixmap(display, pixmap)
 {
     TkOS2Drawable *todPtr = (TkOS2Drawable *) pixmap;
     HBITMAP hbm;
+    SIZEL sizl;
 
 #ifdef DEBUG
 printf("Tk_FreePixmap %x\n", todPtr);
@@ -193,13 +328,156 @@ printf("Tk_FreePixmap %x\n", todPtr);
 #ifdef DEBUG
 printf("    GpiSetBitmap hps %x returned %x\n", todPtr->bitmap.hps, hbm);
 #endif
-	GpiDeleteBitmap(todPtr->bitmap.handle);
-        GpiDestroyPS(todPtr->bitmap.hps);
-        DevCloseDC(todPtr->bitmap.dc);
+
+        if (GpiQueryBitmapDimension(todPtr->bitmap.handle, &sizl)) {
+            if (numCachedBitmaps == BITMAP_CACHE_SIZE) {
+                /* Evict the oldest bitmap */
+                GpiDeleteBitmap(bitmapCache[0].handle);
+                pixmapStats.bitmapsDeleted++;
+                numCachedBitmaps--;
+                memmove((VOID *) &bitmapCache[0], (VOID *) &bitmapCache[1],
+                        numCachedBitmaps * sizeof(CachedBitmap));
+            }
+            bitmapCache[numCachedBitmaps].handle = todPtr->bitmap.handle;
+            bitmapCache[numCachedBitmaps].width = sizl.cx;
+            bitmapCache[numCachedBitmaps].height = sizl.cy;
+            bitmapCache[numCachedBitmaps].depth = todPtr->bitmap.depth;
+            numCachedBitmaps++;
+        } else {
+	    GpiDeleteBitmap(todPtr->bitmap.handle);
+            pixmapStats.bitmapsDeleted++;
+        }
+
+        if (numPooledPS < PS_POOL_SIZE) {
+            psPool[numPooledPS].dc = todPtr->bitmap.dc;
+            psPool[numPooledPS].hps = todPtr->bitmap.hps;
+            numPooledPS++;
+        } else {
+            GpiDestroyPS(todPtr->bitmap.hps);
+            DevCloseDC(todPtr->bitmap.dc);
+            pixmapStats.psDestroyed++;
+        }
 	ckfree((char *)todPtr);
     }
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GetPixmapStats --
+ *
+ *	Report how often Tk_GetPixmap could reuse pooled resources.
+ *
+ * Results:
+ *	Fills in the statistics structure, including the number of
+ *	currently pooled PS's and cached bitmaps.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2GetPixmapStats(statsPtr)
+    TkOS2PixmapStats *statsPtr;
+{
+    *statsPtr = pixmapStats;
+    statsPtr->psPooled = numPooledPS;
+    statsPtr->bitmapsCached = numCachedBitmaps;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2PixmapCmd --
+ *
+ *	This procedure is invoked to process the "os2pixmap" Tcl
+ *	command:
+ *
+ *	    os2pixmap stats
+ *	    os2pixmap reset
+ *
+ * Results:
+ *	A standard Tcl result.  "stats" returns a list of names and
+ *	values: the DC/PS pairs created, reused from the pool and
+ *	destroyed, the same for bitmaps, and how many of each are
+ *	pooled now.
+ *
+ * Side effects:
+ *	"reset" clears the counters.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2PixmapCmd(clientData, interp, argc, argv)
+    ClientData clientData;	/* Not used. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings. */
+{
+    TkOS2PixmapStats stats;
+    char string[300];
+    size_t length;
+
+    if (argc != 2) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" option\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+    length = strlen(argv[1]);
+    if ((argv[1][0] == 'r') && (strncmp(argv[1], "reset", length) == 0)) {
+	memset((char *) &pixmapStats, 0, sizeof(pixmapStats));
+    } else if ((argv[1][0] == 's')
+	    && (strncmp(argv[1], "stats", length) == 0)) {
+	TkOS2GetPixmapStats(&stats);
+	sprintf(string, "psCreated %lu psReused %lu psDestroyed %lu "
+		"bitmapsCreated %lu bitmapsReused %lu bitmapsDeleted %lu "
+		"psPooled %d bitmapsCached %d", stats.psCreated,
+		stats.psReused, stats.psDestroyed, stats.bitmapsCreated,
+		stats.bitmapsReused, stats.bitmapsDeleted, stats.psPooled,
+		stats.bitmapsCached);
+	Tcl_AppendResult(interp, string, (char *) NULL);
+    } else {
+	Tcl_AppendResult(interp, "bad option \"", argv[1],
+		"\": must be reset or stats", (char *) NULL);
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2FreePixmapPools --
+ *
+ *	Destroy all pooled DC/PS pairs and cached bitmaps.  Called when
+ *	signing off from PM.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees PM resources.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2FreePixmapPools()
+{
+    while (numCachedBitmaps > 0) {
+        numCachedBitmaps--;
+        GpiDeleteBitmap(bitmapCache[numCachedBitmaps].handle);
+    }
+    while (numPooledPS > 0) {
+        numPooledPS--;
+        GpiDestroyPS(psPool[numPooledPS].hps);
+        DevCloseDC(psPool[numPooledPS].dc);
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
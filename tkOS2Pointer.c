@@ -14,7 +14,11 @@
 #include "tkOS2Int.h"
 
 /*
- * Check for enter/leave events every MOUSE_TIMER_INTERVAL milliseconds.
+ * PM doesn't tell a window the pointer left it for a window that isn't
+ * ours, so after the pointer has moved inside a Tk window we check once
+ * more, MOUSE_TIMER_INTERVAL milliseconds later.  The check is only
+ * repeated while the pointer keeps moving: a pointer that rests in a
+ * window costs nothing.
  */
 
 #define MOUSE_TIMER_INTERVAL 250
@@ -55,14 +59,18 @@ static TkWindow *lastMouseWinPtr;
 static Tcl_TimerToken mouseTimer;
 				/* Handle to the latest mouse timer. */
 static int mouseTimerSet;	/* Non-zero if the mouse timer is active. */
+static int mouseCheckPending;	/* Non-zero if MouseIdleProc is scheduled. */
 
 /*
  * Forward declarations of procedures used in this file.
  */
 
+static void		CheckMousePosition (void);
+static TkWindow *	GetPointWindow (POINTL *posPtr, HWND *hwndPtr);
 static void		InitializeCrossingEvent (
     			    XEvent* eventPtr, TkWindow *winPtr,
 			    long x, long y);
+static void		MouseIdleProc (ClientData clientData);
 static void		MouseTimerProc (ClientData clientData);
 static int		UpdateMousePosition (HWND hwnd,
 			    TkWindow *winPtr, long x, long y);
@@ -95,6 +103,7 @@ printf("TkOS2PointerInit\n");
     restrictWinPtr = NULL;
 
     mouseTimerSet = 0;
+    mouseCheckPending = 0;
     WinQueryPointerPos(HWND_DESKTOP, &lastMousePos);
     lastMouseWindow = WinWindowFromPoint(HWND_DESKTOP, &lastMousePos, TRUE);
     lastMouseWinPtr = NULL;
@@ -129,6 +138,8 @@ grabWinPtr %x, restrictWinPtr %x\n", lastMouseWinPtr, grabWinPtr, restrictWinPtr
 printf("    Setting lastMouseWinPtr to NULL\n");
 #endif
 	lastMouseWinPtr = NULL;
+	lastMouseWindow = NULLHANDLE;
+	lastMousePos.x = -1;
     }
     if (winPtr == grabWinPtr) {
 #ifdef DEBUG
@@ -184,7 +195,6 @@ TkOS2PointerEvent(eventPtr, winPtr)
 {
     POINTL pos;
     HWND hwnd;
-    TkOS2Drawable *todPtr;
 
 #ifdef DEBUG
 printf("TkOS2PointerEvent, x_root %d, y_root %d, winPtr %x, display %x\n",
@@ -206,18 +216,12 @@ printf("    captured, eventPtr %x\n", eventPtr);
 	pos.x = eventPtr->xmotion.x_root;
         /* Translate Y coordinate to PM */
 	pos.y = yScreen - eventPtr->xmotion.y_root;
-        hwnd = WinWindowFromPoint(HWND_DESKTOP, &pos, TRUE);
-	todPtr = TkOS2GetDrawableFromHandle(hwnd);
-	if (todPtr && (todPtr->type == TOD_WINDOW)) {
-	    winPtr = TkOS2GetWinPtr(todPtr);
-	} else {
-	    winPtr = NULL;
-	}
+	winPtr = GetPointWindow(&pos, &hwnd);
     } else {
 #ifdef DEBUG
 printf("    not captured\n");
 #endif
-	hwnd = TkOS2GetHWND(Tk_WindowId(winPtr));
+	hwnd = TkOS2GetHeavyweight(winPtr, NULL);
     }
 
     switch (eventPtr->type) {
@@ -276,7 +280,7 @@ printf("    ButtonPress\n");
 		    }
 		    captured = 1;
 		    WinSetCapture(HWND_DESKTOP,
-		                  TkOS2GetHWND(Tk_WindowId(restrictWinPtr)));
+		                  TkOS2GetHeavyweight(restrictWinPtr, NULL));
 		}
 	    }
 	    break;
@@ -384,13 +388,15 @@ XGrabPointer(display, grab_window, owner_events, event_mask, pointer_mode,
     Cursor cursor;
     Time time;
 {
-    HWND hwnd = TkOS2GetHWND(grab_window);
+    HWND hwnd;
 
 #ifdef DEBUG
 printf("XGrabPointer\n");
 #endif
 
     grabWinPtr = TkOS2GetWinPtr(grab_window);
+    hwnd = TkOS2IsLightweight(grab_window)
+	    ? TkOS2GetHeavyweight(grabWinPtr, NULL) : TkOS2GetHWND(grab_window);
     captured = 1;
     restrictWinPtr = NULL;
     if (WinSetCapture(HWND_DESKTOP, hwnd)) {
@@ -702,10 +708,46 @@ printf("    calling InitializeCrossingEvent with targetPtr %x\n", targetPtr);
 /*
  *----------------------------------------------------------------------
  *
- * MouseTimerProc --
+ * GetPointWindow --
+ *
+ *	Find the window at a screen position, and the Tk window it
+ *	belongs to.  If the pointer didn't move since the last pointer
+ *	event, the last answer is used, otherwise the spatial index of
+ *	the toplevel is searched, see TkOS2RootCoordsToWindow.
+ *
+ * Results:
+ *	Returns the Tk window at the position, which may be a lightweight
+ *	window, or NULL if the window there isn't managed by Tk.
+ *	*hwndPtr is set to the PM window.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TkWindow *
+GetPointWindow(posPtr, hwndPtr)
+    POINTL *posPtr;		/* Position in PM screen coordinates. */
+    HWND *hwndPtr;		/* Returns the PM window at posPtr. */
+{
+    if (posPtr->x == lastMousePos.x && posPtr->y == lastMousePos.y) {
+	/* Mouse hasn't moved */
+	*hwndPtr = lastMouseWindow;
+	return lastMouseWinPtr;
+    }
+    /* Translate Y coordinate to X */
+    return TkOS2RootCoordsToWindow(posPtr->x, yScreen - posPtr->y, hwndPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CheckMousePosition --
  *
  *	Check the current mouse position and look for enter/leave 
- *	events.
+ *	events.  Nothing is done if the mouse hasn't moved since the
+ *	last pointer event we saw.
  *
  * Results:
  *	None.
@@ -716,55 +758,111 @@ printf("    calling InitializeCrossingEvent with targetPtr %x\n", targetPtr);
  *----------------------------------------------------------------------
  */
 
-void
-MouseTimerProc(clientData)
-    ClientData clientData;
+static void
+CheckMousePosition()
 {
     POINTL pos;
     HWND hwnd;
-    TkOS2Drawable *todPtr;
     TkWindow *winPtr;
 
+    WinQueryPointerPos(HWND_DESKTOP, &pos);
+    if (pos.x == lastMousePos.x && pos.y == lastMousePos.y) {
+	return;
+    }
+    winPtr = GetPointWindow(&pos, &hwnd);
+
+    /*
+     * Generate enter/leave events.
+     */
+
+    /* Translate Y coordinate to X */
+    UpdateMousePosition(hwnd, winPtr, pos.x, yScreen - pos.y);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MouseTimerProc --
+ *
+ *	Look for enter/leave events a while after the mouse last moved
+ *	in a Tk window, in case it left for a window that isn't ours.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May schedule a new timer and/or generate enter/leave events.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+MouseTimerProc(clientData)
+    ClientData clientData;
+{
 #ifdef DEBUG
 printf("MouseTimerProc\n");
 #endif
 
     mouseTimerSet = 0;
+    CheckMousePosition();
+}
 
-    /*
-     * Get the current mouse position and window.  Don't do anything
-     * if the mouse hasn't moved since the last time we looked.
-     */
+/*
+ *----------------------------------------------------------------------
+ *
+ * MouseIdleProc --
+ *
+ *	Look for enter/leave events after the pointer was seen on the
+ *	frame of a toplevel, see TkOS2PointerLeft.  By the time this
+ *	runs, a pointer event from the window it went to, if that is
+ *	a Tk window too, has been seen already.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May generate enter/leave events.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    WinQueryPointerPos(HWND_DESKTOP, &pos);
-    if (pos.x == lastMousePos.y && pos.y == lastMousePos.y) {
-	/* Mouse hasn't moved */
-	hwnd = lastMouseWindow;
-    } else {
-        /* Mouse has moved, redetermine window */
-        hwnd = WinWindowFromPoint(HWND_DESKTOP, &pos, TRUE);
-    }
+static void
+MouseIdleProc(clientData)
+    ClientData clientData;
+{
+    mouseCheckPending = 0;
+    CheckMousePosition();
+}
 
-    /*
-     * Check to see if the current window is managed by Tk.
-     */
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2PointerLeft --
+ *
+ *	Called by the frame window procedure when the pointer moves
+ *	over the decorative frame of a toplevel, so a crossing to a
+ *	window that isn't managed by Tk is noticed right away instead
+ *	of by MouseTimerProc.  PM has no message for the pointer
+ *	leaving a window.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Schedules MouseIdleProc.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    if (hwnd == lastMouseWindow) {
-	winPtr = lastMouseWinPtr;
-    } else {
-	todPtr = TkOS2GetDrawableFromHandle(hwnd);
-	if (todPtr && (todPtr->type == TOD_WINDOW)) {
-	    winPtr = TkOS2GetWinPtr(todPtr);
-	} else {
-	    winPtr = NULL;
-	}
+void
+TkOS2PointerLeft(hwnd)
+    HWND hwnd;			/* Frame window the pointer is in. */
+{
+    if (!mouseCheckPending && (lastMouseWinPtr != NULL)) {
+	mouseCheckPending = 1;
+	Tcl_DoWhenIdle(MouseIdleProc, (ClientData) NULL);
     }
-
-    /*
-     * Generate enter/leave events.
-     */
-
-    UpdateMousePosition(hwnd, winPtr, pos.x, pos.y);
 }
 
 /*
@@ -908,7 +1006,9 @@ XSetInputFocus(display, focus, revert_to, time)
     int revert_to;
     Time time;
 {
-    HWND hwnd = TkOS2GetHWND(focus);
+    HWND hwnd = TkOS2IsLightweight(focus)
+	    ? TkOS2GetHeavyweight(TkOS2GetWinPtr(focus), NULL)
+	    : TkOS2GetHWND(focus);
 #ifdef DEBUG
 printf("XSetInputFocus\n");
 #endif
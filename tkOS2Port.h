@@ -88,6 +88,29 @@
 #define XDefaultColormap(display, screen) ((screen)->cmap)
 #define XDefaultDepth(display, screen) ((screen)->root_depth)
 
+/*
+ * Allocation of a set of colors in one go, see tkOS2Color.c.
+ */
+
+extern int TkOS2AllocColors _ANSI_ARGS_((Display *display,
+	Colormap colormap, XColor *colors, int ncolors, int *status));
+
+/*
+ * Images whose pixels stay in PM line order between updates, see
+ * tkOS2Image.c.
+ */
+
+extern int TkOS2ShmAttach _ANSI_ARGS_((XImage *image, int bytesPerLine,
+	int height));
+extern void TkOS2ShmDetach _ANSI_ARGS_((XImage *image));
+
+/*
+ * Magic numbers of photo image file formats, see tkImgPhoto.c.
+ */
+
+extern int Tk_CreatePhotoFormatSignature _ANSI_ARGS_((char *name,
+	int offset, char *bytes, int length));
+
 #ifndef __EMX__
 
 /*
@@ -18,10 +18,71 @@
  * Forward declarations for procedures defined in this file:
  */
 
+static void		CommitGeometryProc _ANSI_ARGS_((
+			    ClientData clientData));
+static TkWindow *	HeavyweightAncestor _ANSI_ARGS_((TkWindow *winPtr,
+			    int *xPtr, int *yPtr));
 static void             NotifyVisibility _ANSI_ARGS_((XEvent *eventPtr,
                             TkWindow *winPtr));
+static void		SetChildGeometry _ANSI_ARGS_((Window w, int x, int y,
+			    int width, int height));
+static int		SetPendingVisibility _ANSI_ARGS_((HWND hwnd,
+			    int show));
 static void             StackWindow _ANSI_ARGS_((Window w, Window sibling,
                             int stack_mode));
+static int		WantLightweight _ANSI_ARGS_((TkWindow *winPtr,
+			    Window parent));
+
+/*
+ * Geometry transactions.  Child windows aren't moved and resized right
+ * away: the new geometry is recorded in the pending array and everything
+ * changed during one pass of the event loop is applied from an idle
+ * handler, with one WinSetMultWindowPos call per parent.  When pack,
+ * grid or place lay out a dialog again, PM then recomputes the clipping
+ * and repaints once per parent instead of once for every slave.
+ * Drawing into a window flushes the pending changes first, see
+ * TkOS2GetDrawablePS, so nothing is ever drawn at a stale size.
+ */
+
+typedef struct {
+    HWND hwnd;			/* Window to change. */
+    HWND parent;		/* Its parent. */
+    int x, y;			/* New position relative to the parent, in
+				 * X (top-down) coordinates. */
+    int width, height;		/* New size. */
+    ULONG fl;			/* SWP_ flags to pass to PM. */
+} PendingGeometry;
+
+static PendingGeometry *pending = NULL;
+				/* Changes not yet passed to PM. */
+static int numPending = 0;	/* Number of entries used in pending. */
+static int maxPending = 0;	/* Number of entries allocated. */
+static Tcl_HashTable pendingTable;
+				/* Maps a window handle to its index in
+				 * pending. */
+static int pendingInitialized = 0;
+static int geometryBatching = 1;
+				/* 0 means pass every change on at once. */
+static TkOS2GeometryStats geometryStats;
+
+/*
+ * Lightweight windows.  A window created in this mode gets no PM window
+ * of its own: it draws into its nearest ancestor that has one (its
+ * "heavyweight"), through a PS that is translated to the window's origin
+ * and clipped to its rectangle, and pointer events are hit-tested against
+ * it by TranslateEvent.  This saves a PM window, and all the messages
+ * that come with it, for every label or button in a big dialog.  Children
+ * of a lightweight window are lightweight too; toplevels never are.
+ */
+
+static Tcl_HashTable lightweightClasses;
+				/* Classes whose windows are created
+				 * lightweight, keyed by class Uid. */
+static int classesInitialized = 0;
+static TkWindow *requestPtr = NULL;
+				/* Window being created by
+				 * TkOS2SetLightweight, if any. */
+static int requestLightweight;	/* Mode requested for requestPtr. */
 
 /*
  *----------------------------------------------------------------------
@@ -62,6 +123,19 @@ printf("TkMakeWindow winPtr %x\n", winPtr);
 
     todPtr->type = TOD_WINDOW;
     todPtr->window.winPtr = winPtr;
+    todPtr->window.flags = 0;
+    todPtr->window.rootGeneration = 0;
+    todPtr->window.lightChildren = 0;
+
+    if (WantLightweight(winPtr, parent)) {
+#ifdef DEBUG
+printf("    lightweight, parent %x\n", parent);
+#endif
+	todPtr->window.flags |= TOD_LIGHTWEIGHT;
+	todPtr->window.handle = NULLHANDLE;
+	((TkOS2Drawable *) parent)->window.lightChildren++;
+	return (Window)todPtr;
+    }
 
     if (parent != None) {
 	parentWin = TkOS2GetHWND(parent);
@@ -175,6 +249,17 @@ printf("XDestroyWindow handle %x, winPtr->flags %x\n", hwnd, winPtr->flags);
      */
 
     TkOS2PointerDeadWindow(winPtr);
+    TkOS2WindowIndexChanged(winPtr);
+    if ((todPtr->window.flags & TOD_LIGHTWEIGHT) && (winPtr->flags & TK_MAPPED)
+	    && !(winPtr->flags & TK_PARENT_DESTROYED)) {
+	TkOS2InvalidateWindow(winPtr);
+    }
+    if ((todPtr->window.flags & TOD_LIGHTWEIGHT)
+	    && !(winPtr->flags & TK_PARENT_DESTROYED)
+	    && (winPtr->parentPtr != NULL)
+	    && (winPtr->parentPtr->window != None)) {
+	((TkOS2Drawable *) winPtr->parentPtr->window)->window.lightChildren--;
+    }
     todPtr->window.winPtr = NULL;
 
     /*
@@ -234,8 +319,13 @@ printf("XMapWindow %x\n", TkOS2GetHWND(w));
 
     display->request++;
 
-    WinShowWindow(TkOS2GetHWND(w), TRUE);
     winPtr->flags |= TK_MAPPED;
+    TkOS2WindowIndexChanged(winPtr);
+    if (TkOS2IsLightweight(w)) {
+	TkOS2InvalidateWindow(winPtr);
+    } else if (!SetPendingVisibility(TkOS2GetHWND(w), 1)) {
+	WinShowWindow(TkOS2GetHWND(w), TRUE);
+    }
 
     event.type = MapNotify;
     event.xmap.serial = display->request;
@@ -345,8 +435,13 @@ printf("XUnmapWindow hwnd %x\n", TkOS2GetHWND(w));
 
     display->request++;
 
-    WinShowWindow(TkOS2GetHWND(w), FALSE);
     winPtr->flags &= ~TK_MAPPED;
+    TkOS2WindowIndexChanged(winPtr);
+    if (TkOS2IsLightweight(w)) {
+	TkOS2InvalidateWindow(winPtr);
+    } else if (!SetPendingVisibility(TkOS2GetHWND(w), 0)) {
+	WinShowWindow(TkOS2GetHWND(w), FALSE);
+    }
 
     event.type = UnmapNotify;
     event.xunmap.serial = display->request;
@@ -386,17 +481,13 @@ XMoveResizeWindow(display, w, x, y, width, height)
     unsigned int width;
     unsigned int height;
 {
-    SWP parPos;
-    WinQueryWindowPos(WinQueryWindow(TkOS2GetHWND(w), QW_PARENT), &parPos);
     display->request++;
-    /* Translate Y coordinates to PM: relative to parent */
-    WinSetWindowPos(TkOS2GetHWND(w), HWND_TOP, x,
-                    parPos.cy - height - y,
-                    width, height, SWP_MOVE | SWP_SIZE);
 #ifdef DEBUG
-printf("XMoveResizeWindow hwnd %x, x %d, y %d (x11y: %d), w %d, h %d\n",
-TkOS2GetHWND(w), x, parPos.cy - height - y, y, width, height);
+printf("XMoveResizeWindow hwnd %x, x %d, y %d, w %d, h %d\n",
+TkOS2GetHWND(w), x, y, width, height);
 #endif
+    TkOS2RootCoordsChanged();
+    SetChildGeometry(w, x, y, (int) width, (int) height);
 }
 
 /*
@@ -423,21 +514,14 @@ XMoveWindow(display, w, x, y)
     int y;
 {
     TkWindow *winPtr = TkOS2GetWinPtr(w);
-    SWP parPos;
-    WinQueryWindowPos(WinQueryWindow(TkOS2GetHWND(w), QW_PARENT), &parPos);
 
     display->request++;
-
-    /* Translate Y coordinates to PM, relative to parent */
-    WinSetWindowPos(TkOS2GetHWND(w), HWND_TOP, x,
-                    parPos.cy - winPtr->changes.height - y,
-                    winPtr->changes.width, winPtr->changes.height,
-                    SWP_MOVE /*| SWP_SIZE*/);
 #ifdef DEBUG
 printf("XMoveWindow hwnd %x, x %d, y %d, w %d, h %d\n", TkOS2GetHWND(w),
-x, parPos.cy - winPtr->changes.height - y,
-winPtr->changes.width, winPtr->changes.height);
+x, y, winPtr->changes.width, winPtr->changes.height);
 #endif
+    TkOS2RootCoordsChanged();
+    SetChildGeometry(w, x, y, winPtr->changes.width, winPtr->changes.height);
 }
 
 /*
@@ -464,21 +548,14 @@ XResizeWindow(display, w, width, height)
     unsigned int height;
 {
     TkWindow *winPtr = TkOS2GetWinPtr(w);
-    SWP parPos;
-    WinQueryWindowPos(WinQueryWindow(TkOS2GetHWND(w), QW_PARENT), &parPos);
 
     display->request++;
-
-    /* Translate Y coordinates to PM; relative to parent */
-    WinSetWindowPos(TkOS2GetHWND(w), HWND_TOP, winPtr->changes.x,
-                    parPos.cy - winPtr->changes.height - winPtr->changes.y,
-                    winPtr->changes.width, winPtr->changes.height,
-                    /*SWP_MOVE |*/ SWP_SIZE);
 #ifdef DEBUG
 printf("XResizeWindow hwnd %x, x %d, y %d, w %d, h %d\n", TkOS2GetHWND(w),
-winPtr->changes.x, parPos.cy - winPtr->changes.height - winPtr->changes.y,
-winPtr->changes.width, winPtr->changes.height);
+winPtr->changes.x, winPtr->changes.y, width, height);
 #endif
+    SetChildGeometry(w, winPtr->changes.x, winPtr->changes.y, (int) width,
+	    (int) height);
 }
 
 /*
@@ -509,6 +586,15 @@ printf("XRaiseWindow hwnd %x\n", window);
 #endif
 
     display->request++;
+    TkOS2WindowIndexChanged(TkOS2GetWinPtr(w));
+    if (TkOS2IsLightweight(w)) {
+	/*
+	 * The stacking order is that of the Tk child list, just redraw.
+	 */
+
+	TkOS2InvalidateWindow(TkOS2GetWinPtr(w));
+	return;
+    }
     rc = WinSetWindowPos(window, HWND_TOP, 0, 0, 0, 0, SWP_ZORDER);
 #ifdef DEBUG
 if (rc!=TRUE) printf("    WinSetWindowPos ERROR %x\n",
@@ -561,19 +647,16 @@ pos.cy);
      */
 
     if (value_mask & (CWX|CWY|CWWidth|CWHeight)) {
-        /* Translate Y coordinates to PM */
-        WinSetWindowPos(window, HWND_TOP, winPtr->changes.x,
-                        TkOS2WindowHeight((TkOS2Drawable *)w)
-                                 - winPtr->changes.height - winPtr->changes.y,
-                        winPtr->changes.width, winPtr->changes.height,
-                        SWP_MOVE | SWP_SIZE);
 #ifdef DEBUG
 printf("    CWX/CWY    hwnd %x, x %d, y %d, w %d, h %d\n", window,
-       winPtr->changes.x,
-       TkOS2WindowHeight((TkOS2Drawable *)w)
-                         - winPtr->changes.height - winPtr->changes.y,
+       winPtr->changes.x, winPtr->changes.y,
        winPtr->changes.width, winPtr->changes.height);
 #endif
+	if (value_mask & (CWX|CWY)) {
+	    TkOS2RootCoordsChanged();
+	}
+        SetChildGeometry(w, winPtr->changes.x, winPtr->changes.y,
+		winPtr->changes.width, winPtr->changes.height);
     }
 
     /*
@@ -581,7 +664,13 @@ printf("    CWX/CWY    hwnd %x, x %d, y %d, w %d, h %d\n", window,
      */
 
     if (value_mask & CWStackMode) {
-	if ((value_mask & CWSibling) && (values->sibling != None)) {
+	TkOS2WindowIndexChanged(winPtr);
+    }
+    if ((value_mask & CWStackMode) && TkOS2IsLightweight(w)) {
+	TkOS2InvalidateWindow(winPtr);
+    } else if (value_mask & CWStackMode) {
+	if ((value_mask & CWSibling) && (values->sibling != None)
+		&& !TkOS2IsLightweight(values->sibling)) {
 	    HWND sibling = TkOS2GetHWND(values->sibling);
 #ifdef DEBUG
 printf("    CWStackMode\n");
@@ -606,8 +695,8 @@ printf("    CWStackMode\n");
 		
 	WinSetWindowPos(window, insertAfter, 0, 0, 0, 0, SWP_ZORDER);
     } 
-WinQueryWindowPos(window, &pos);
 #ifdef DEBUG
+WinQueryWindowPos(window, &pos);
 printf("After XConfigureWindow %x, pos (%d,%d;%dx%d)\n", window, pos.x, pos.y,
 pos.cx, pos.cy);
 #endif
@@ -637,24 +726,35 @@ XClearWindow(display, w)
     RECTL rect;
     LONG brush, oldColor, oldPattern;
     HPAL oldPalette, palette;
-    TkWindow *winPtr;
-    HWND hwnd = TkOS2GetHWND(w);
-    HPS hps = WinGetPS(hwnd);
+    TkWindow *winPtr = TkOS2GetWinPtr(w);
+    HWND hwnd;
+    HPS hps;
 
 #ifdef DEBUG
 printf("XClearWindow\n");
 #endif
 
+    if (TkOS2IsLightweight(w)) {
+	hps = TkOS2GetLightweightPS(winPtr, &hwnd);
+	rect.xLeft = 0;
+	rect.yBottom = 0;
+	rect.xRight = winPtr->changes.width;
+	rect.yTop = winPtr->changes.height;
+    } else {
+	hwnd = TkOS2GetHWND(w);
+	hps = WinGetPS(hwnd);
+	TkOS2ExcludeLightweight(hps, winPtr);
+	WinQueryWindowRect(hwnd, &rect);
+    }
+
     palette = TkOS2GetPalette(display->screens[0].cmap);
     oldPalette = GpiSelectPalette(hps, palette);
 
     display->request++;
 
-    winPtr = TkOS2GetWinPtr(w);
     oldColor = GpiQueryColor(hps);
     oldPattern = GpiQueryPattern(hps);
     GpiSetPattern(hps, PATSYM_SOLID);
-    WinQueryWindowRect(hwnd, &rect);
     WinFillRect(hps, &rect, winPtr->atts.background_pixel);
 #ifdef DEBUG
 printf("WinFillRect in XClearWindow\n");
@@ -735,6 +835,9 @@ rc = GpiQueryBitmapDimension(todPtr->bitmap.handle, &sizl);
 printf(", bitmapdimension y %d\n", sizl.cy);
 #endif
 return sizl.cy;
+    } else if (todPtr->window.flags & TOD_LIGHTWEIGHT) {
+	return (todPtr->window.winPtr == NULL) ? 0
+		: todPtr->window.winPtr->changes.height;
     } else {
         handle = todPtr->window.handle;
         parent = WinQueryWindow(handle, QW_PARENT);
@@ -832,6 +935,9 @@ rc = GpiQueryBitmapDimension(todPtr->bitmap.handle, &sizl);
 printf(", bitmapdimension x %d\n", sizl.cx);
 #endif
 return sizl.cx;
+    } else if (todPtr->window.flags & TOD_LIGHTWEIGHT) {
+	return (todPtr->window.winPtr == NULL) ? 0
+		: todPtr->window.winPtr->changes.width;
     } else {
         handle = todPtr->window.handle;
         parent = WinQueryWindow(handle, QW_PARENT);
@@ -884,3 +990,1004 @@ return TkOS2GetWinPtr(todPtr)->wmInfoPtr->height;
 }
     return pos.cx;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetChildGeometry --
+ *
+ *	Move and resize a window relative to its parent.  For child
+ *	windows the change is recorded and passed on to PM by
+ *	TkOS2FlushGeometry together with the other changes made in the
+ *	same pass of the event loop.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May schedule CommitGeometryProc.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetChildGeometry(w, x, y, width, height)
+    Window w;
+    int x, y;			/* Position relative to parent. */
+    int width, height;
+{
+    TkWindow *winPtr = TkOS2GetWinPtr(w);
+    HWND hwnd, parent;
+    PendingGeometry *geomPtr;
+    Tcl_HashEntry *hPtr;
+    int new;
+
+    if (winPtr != NULL) {
+	TkOS2WindowIndexChanged(winPtr);
+    }
+    if (TkOS2IsLightweight(w)) {
+	/*
+	 * Tk has already stored the new geometry in winPtr->changes, all
+	 * there is to do is to redraw the parent, which covers both the
+	 * old and the new area.
+	 */
+
+	if ((winPtr != NULL) && (winPtr->flags & TK_MAPPED)) {
+	    TkOS2InvalidateWindow(winPtr->parentPtr);
+	}
+	return;
+    }
+    hwnd = TkOS2GetHWND(w);
+    parent = WinQueryWindow(hwnd, QW_PARENT);
+
+    geometryStats.requests++;
+    if (!geometryBatching || (winPtr == NULL)
+	    || (winPtr->flags & TK_TOP_LEVEL)) {
+	SWP parPos;
+
+	WinQueryWindowPos(parent, &parPos);
+	geometryStats.pmCalls++;
+	/* Translate Y coordinates to PM: relative to parent */
+	WinSetWindowPos(hwnd, HWND_TOP, x, parPos.cy - height - y,
+		width, height, SWP_MOVE | SWP_SIZE);
+	return;
+    }
+
+    if (!pendingInitialized) {
+	Tcl_InitHashTable(&pendingTable, TCL_ONE_WORD_KEYS);
+	pendingInitialized = 1;
+    }
+    hPtr = Tcl_CreateHashEntry(&pendingTable, (char *) hwnd, &new);
+    if (new) {
+	if (numPending == maxPending) {
+	    if (pending == NULL) {
+		maxPending = 32;
+		pending = (PendingGeometry *) ckalloc(
+			maxPending * sizeof(PendingGeometry));
+	    } else {
+		maxPending *= 2;
+		pending = (PendingGeometry *) ckrealloc((char *) pending,
+			maxPending * sizeof(PendingGeometry));
+	    }
+	}
+	if (numPending == 0) {
+	    Tcl_DoWhenIdle(CommitGeometryProc, (ClientData) NULL);
+	}
+	Tcl_SetHashValue(hPtr, (ClientData) numPending);
+	geomPtr = &pending[numPending++];
+	geomPtr->hwnd = hwnd;
+	geomPtr->parent = parent;
+	geomPtr->fl = 0;
+    } else {
+	geomPtr = &pending[(int) Tcl_GetHashValue(hPtr)];
+    }
+    geomPtr->x = x;
+    geomPtr->y = y;
+    geomPtr->width = width;
+    geomPtr->height = height;
+    geomPtr->fl |= SWP_MOVE | SWP_SIZE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetPendingVisibility --
+ *
+ *	If a window has a geometry change pending, show or hide it
+ *	together with that change instead of right away, so it doesn't
+ *	appear at its old position first.
+ *
+ * Results:
+ *	Returns 1 if the show or hide was added to a pending change,
+ *	0 if the caller has to do it itself.
+ *
+ * Side effects:
+ *	May change a pending entry.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SetPendingVisibility(hwnd, show)
+    HWND hwnd;
+    int show;			/* 1 to show, 0 to hide the window. */
+{
+    Tcl_HashEntry *hPtr;
+    PendingGeometry *geomPtr;
+
+    if (numPending == 0) {
+	return 0;
+    }
+    hPtr = Tcl_FindHashEntry(&pendingTable, (char *) hwnd);
+    if (hPtr == NULL) {
+	return 0;
+    }
+    geomPtr = &pending[(int) Tcl_GetHashValue(hPtr)];
+    geomPtr->fl &= ~(SWP_SHOW | SWP_HIDE);
+    geomPtr->fl |= show ? SWP_SHOW : SWP_HIDE;
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CommitGeometryProc --
+ *
+ *	Idle handler that passes the pending geometry changes on to PM.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	See TkOS2FlushGeometry.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CommitGeometryProc(clientData)
+    ClientData clientData;	/* Not used. */
+{
+    TkOS2FlushGeometry();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2FlushGeometry --
+ *
+ *	Pass all pending geometry changes on to PM, with one
+ *	WinSetMultWindowPos call for all children of the same parent.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Moves, resizes, shows and hides windows.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2FlushGeometry()
+{
+    PendingGeometry *geomPtr;
+    Tcl_HashEntry *hPtr;
+    SWP *swps, parPos;
+    HWND parent;
+    LONG parentHeight;
+    int i, j, n;
+
+    if (numPending == 0) {
+	return;
+    }
+    Tcl_CancelIdleCall(CommitGeometryProc, (ClientData) NULL);
+    swps = (SWP *) ckalloc(numPending * sizeof(SWP));
+
+    for (i = 0; i < numPending; i++) {
+	parent = pending[i].parent;
+	if (parent == NULLHANDLE) {
+	    continue;		/* Done with an earlier parent. */
+	}
+
+	/*
+	 * The Y coordinates are relative to the bottom of the parent, so
+	 * if the parent is being resized too, use its new height.
+	 */
+
+	hPtr = Tcl_FindHashEntry(&pendingTable, (char *) parent);
+	if (hPtr != NULL) {
+	    parentHeight = pending[(int) Tcl_GetHashValue(hPtr)].height;
+	} else {
+	    WinQueryWindowPos(parent, &parPos);
+	    parentHeight = parPos.cy;
+	}
+
+	n = 0;
+	for (j = i; j < numPending; j++) {
+	    geomPtr = &pending[j];
+	    if (geomPtr->parent != parent) {
+		continue;
+	    }
+	    swps[n].fl = geomPtr->fl;
+	    swps[n].cx = geomPtr->width;
+	    swps[n].cy = geomPtr->height;
+	    swps[n].x = geomPtr->x;
+	    /* Translate Y coordinates to PM: relative to parent */
+	    swps[n].y = parentHeight - geomPtr->height - geomPtr->y;
+	    swps[n].hwndInsertBehind = HWND_TOP;
+	    swps[n].hwnd = geomPtr->hwnd;
+	    swps[n].ulReserved1 = 0;
+	    swps[n].ulReserved2 = 0;
+	    n++;
+	    if (j > i) {
+		geomPtr->parent = NULLHANDLE;
+	    }
+	}
+	geometryStats.pmCalls++;
+	if (WinSetMultWindowPos(hab, swps, n) != TRUE) {
+#ifdef DEBUG
+	    printf("WinSetMultWindowPos parent %x, %d windows ERROR %x\n",
+		    parent, n, WinGetLastError(hab));
+#endif
+	}
+    }
+    ckfree((char *) swps);
+
+    numPending = 0;
+    Tcl_DeleteHashTable(&pendingTable);
+    Tcl_InitHashTable(&pendingTable, TCL_ONE_WORD_KEYS);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2CancelGeometry --
+ *
+ *	Forget the pending geometry change of a window that is being
+ *	destroyed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The last pending entry may move into the freed slot.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2CancelGeometry(hwnd)
+    HWND hwnd;
+{
+    Tcl_HashEntry *hPtr;
+    int i;
+
+    if (numPending == 0) {
+	return;
+    }
+    hPtr = Tcl_FindHashEntry(&pendingTable, (char *) hwnd);
+    if (hPtr == NULL) {
+	return;
+    }
+    i = (int) Tcl_GetHashValue(hPtr);
+    Tcl_DeleteHashEntry(hPtr);
+    numPending--;
+    if (i < numPending) {
+	pending[i] = pending[numPending];
+	hPtr = Tcl_FindHashEntry(&pendingTable, (char *) pending[i].hwnd);
+	Tcl_SetHashValue(hPtr, (ClientData) i);
+    }
+    if (numPending == 0) {
+	Tcl_CancelIdleCall(CommitGeometryProc, (ClientData) NULL);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2SetGeometryBatching --
+ *
+ *	Turn batching of child geometry changes on or off.
+ *
+ * Results:
+ *	Returns the previous setting.
+ *
+ * Side effects:
+ *	Turning batching off passes the pending changes on to PM.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2SetGeometryBatching(batch)
+    int batch;			/* 0 to pass every change on at once. */
+{
+    int old = geometryBatching;
+
+    geometryBatching = batch;
+    if (!batch) {
+	TkOS2FlushGeometry();
+    }
+    return old;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GetGeometryStats --
+ *
+ *	Report how many PM positioning calls geometry batching saved.
+ *
+ * Results:
+ *	Fills in *statsPtr.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2GetGeometryStats(statsPtr)
+    TkOS2GeometryStats *statsPtr;
+{
+    *statsPtr = geometryStats;
+    statsPtr->callsSaved = (geometryStats.requests > geometryStats.pmCalls)
+	    ? geometryStats.requests - geometryStats.pmCalls : 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GeometryCmd --
+ *
+ *	This procedure is invoked to process the "os2geometry" Tcl
+ *	command:
+ *
+ *	    os2geometry batch ?boolean?
+ *	    os2geometry stats
+ *	    os2geometry reset
+ *
+ *	"batch" turns batching of child geometry changes on or off and
+ *	returns the setting; turning it off helps to tell whether a
+ *	layout problem comes from batching.
+ *
+ * Results:
+ *	A standard Tcl result.  "stats" returns a list of names and
+ *	values.
+ *
+ * Side effects:
+ *	See the user documentation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2GeometryCmd(clientData, interp, argc, argv)
+    ClientData clientData;	/* Not used. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings. */
+{
+    TkOS2GeometryStats stats;
+    char string[200];
+    size_t length;
+    int c, batch;
+
+    if (argc < 2) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" option ?arg?\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+    c = argv[1][0];
+    length = strlen(argv[1]);
+    if ((c == 'b') && (strncmp(argv[1], "batch", length) == 0)) {
+	if (argc > 3) {
+	    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		    " batch ?boolean?\"", (char *) NULL);
+	    return TCL_ERROR;
+	}
+	if (argc == 3) {
+	    if (Tcl_GetBoolean(interp, argv[2], &batch) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    TkOS2SetGeometryBatching(batch);
+	}
+	Tcl_AppendResult(interp, geometryBatching ? "1" : "0",
+		(char *) NULL);
+    } else if ((c == 'r') && (strncmp(argv[1], "reset", length) == 0)) {
+	memset((char *) &geometryStats, 0, sizeof(geometryStats));
+    } else if ((c == 's') && (strncmp(argv[1], "stats", length) == 0)) {
+	TkOS2GetGeometryStats(&stats);
+	sprintf(string, "batch %d requests %lu pmCalls %lu callsSaved %lu",
+		geometryBatching, stats.requests, stats.pmCalls,
+		stats.callsSaved);
+	Tcl_AppendResult(interp, string, (char *) NULL);
+    } else {
+	Tcl_AppendResult(interp, "bad option \"", argv[1],
+		"\": must be batch, reset, or stats", (char *) NULL);
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WantLightweight --
+ *
+ *	Decide whether a window that is about to be created should be
+ *	lightweight.
+ *
+ * Results:
+ *	Returns 1 if the window should get no PM window of its own.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+WantLightweight(winPtr, parent)
+    TkWindow *winPtr;
+    Window parent;
+{
+    if ((parent == None) || (winPtr->flags & TK_TOP_LEVEL)) {
+	return 0;
+    }
+    if (TkOS2IsLightweight(parent)) {
+	return 1;
+    }
+    if (winPtr == requestPtr) {
+	return requestLightweight;
+    }
+    if (classesInitialized && (winPtr->classUid != NULL)
+	    && (Tcl_FindHashEntry(&lightweightClasses,
+		    (char *) winPtr->classUid) != NULL)) {
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2SetLightweight --
+ *
+ *	Create a window in lightweight or in normal mode, regardless of
+ *	the setting for its class.  Since the mode can't be changed once
+ *	the window exists, this creates the window right away.
+ *
+ * Results:
+ *	Returns 1 if the window now is in the requested mode, 0 if it
+ *	already existed in the other mode, is a toplevel or is a child
+ *	of a lightweight window.
+ *
+ * Side effects:
+ *	May create the window and its ancestors.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2SetLightweight(tkwin, lightweight)
+    Tk_Window tkwin;
+    int lightweight;		/* 1 for a lightweight window, 0 for one
+				 * with its own PM window. */
+{
+    TkWindow *winPtr = (TkWindow *) tkwin;
+
+    if (winPtr->window == None) {
+	requestPtr = winPtr;
+	requestLightweight = lightweight;
+	Tk_MakeWindowExist(tkwin);
+	requestPtr = NULL;
+	if (winPtr->window == None) {
+	    return 0;
+	}
+    }
+    return (TkOS2IsLightweight(winPtr->window) ? 1 : 0)
+	    == (lightweight ? 1 : 0);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2SetLightweightClass --
+ *
+ *	Select whether windows of a class are created lightweight.
+ *	Existing windows are not affected.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Changes the lightweightClasses table.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2SetLightweightClass(className, lightweight)
+    char *className;		/* Class name, e.g. "Label". */
+    int lightweight;		/* 1 to create new windows of the class
+				 * lightweight, 0 to give them PM windows. */
+{
+    Tcl_HashEntry *hPtr;
+    int new;
+
+    if (!classesInitialized) {
+	Tcl_InitHashTable(&lightweightClasses, TCL_ONE_WORD_KEYS);
+	classesInitialized = 1;
+    }
+    if (lightweight) {
+	Tcl_CreateHashEntry(&lightweightClasses, (char *) Tk_GetUid(className),
+		&new);
+    } else {
+	hPtr = Tcl_FindHashEntry(&lightweightClasses,
+		(char *) Tk_GetUid(className));
+	if (hPtr != NULL) {
+	    Tcl_DeleteHashEntry(hPtr);
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2LightweightCmd --
+ *
+ *	This procedure is invoked to process the "os2lightweight" Tcl
+ *	command:
+ *
+ *	    os2lightweight window pathName ?boolean?
+ *	    os2lightweight class className ?boolean?
+ *
+ *	"window" creates the window right away, lightweight or with a PM
+ *	window of its own, see TkOS2SetLightweight; without a boolean it
+ *	tells whether the window exists and is lightweight.  "class"
+ *	selects whether windows of the class created from now on are
+ *	lightweight, see TkOS2SetLightweightClass; without a boolean it
+ *	returns the current setting.  Children of lightweight windows
+ *	are always lightweight, toplevels never are.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	See the user documentation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2LightweightCmd(clientData, interp, argc, argv)
+    ClientData clientData;	/* Not used. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings. */
+{
+    Tk_Window tkwin;
+    size_t length;
+    int c, lightweight;
+
+    if ((argc < 3) || (argc > 4)) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" option name ?boolean?\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+    if ((argc == 4)
+	    && (Tcl_GetBoolean(interp, argv[3], &lightweight) != TCL_OK)) {
+	return TCL_ERROR;
+    }
+    c = argv[1][0];
+    length = strlen(argv[1]);
+    if ((c == 'w') && (strncmp(argv[1], "window", length) == 0)) {
+	tkwin = Tk_NameToWindow(interp, argv[2], Tk_MainWindow(interp));
+	if (tkwin == NULL) {
+	    return TCL_ERROR;
+	}
+	if (argc == 4) {
+	    if (!TkOS2SetLightweight(tkwin, lightweight)) {
+		Tcl_AppendResult(interp, "can't make \"", argv[2], "\" ",
+			lightweight ? "lightweight" : "heavyweight",
+			(char *) NULL);
+		return TCL_ERROR;
+	    }
+	}
+	Tcl_AppendResult(interp, ((Tk_WindowId(tkwin) != None)
+		&& TkOS2IsLightweight(Tk_WindowId(tkwin))) ? "1" : "0",
+		(char *) NULL);
+    } else if ((c == 'c') && (strncmp(argv[1], "class", length) == 0)) {
+	if (argc == 4) {
+	    TkOS2SetLightweightClass(argv[2], lightweight);
+	}
+	Tcl_AppendResult(interp, (classesInitialized
+		&& (Tcl_FindHashEntry(&lightweightClasses,
+			(char *) Tk_GetUid(argv[2])) != NULL)) ? "1" : "0",
+		(char *) NULL);
+    } else {
+	Tcl_AppendResult(interp, "bad option \"", argv[1],
+		"\": must be class or window", (char *) NULL);
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HeavyweightAncestor --
+ *
+ *	Find the window a lightweight window draws into.
+ *
+ * Results:
+ *	Returns winPtr itself or its nearest ancestor that has a PM
+ *	window, and the position of winPtr within it in X coordinates.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TkWindow *
+HeavyweightAncestor(winPtr, xPtr, yPtr)
+    TkWindow *winPtr;
+    int *xPtr, *yPtr;
+{
+    int x = 0, y = 0;
+
+    while (TkOS2IsLightweight(winPtr->window)) {
+	x += winPtr->changes.x;
+	y += winPtr->changes.y;
+	winPtr = winPtr->parentPtr;
+    }
+    *xPtr = x;
+    *yPtr = y;
+    return winPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GetHeavyweight --
+ *
+ *	Find the PM window a window draws into and receives its input
+ *	through.
+ *
+ * Results:
+ *	Returns the PM window.  If originPtr isn't NULL, it is set to the
+ *	lower left corner of winPtr in PM coordinates of that window.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+HWND
+TkOS2GetHeavyweight(winPtr, originPtr)
+    TkWindow *winPtr;
+    POINTL *originPtr;
+{
+    TkWindow *heavyPtr;
+    int x, y;
+
+    heavyPtr = HeavyweightAncestor(winPtr, &x, &y);
+    if (originPtr != NULL) {
+	originPtr->x = x;
+	originPtr->y = (heavyPtr == winPtr) ? 0
+		: TkOS2WindowHeight((TkOS2Drawable *) heavyPtr->window)
+		  - y - winPtr->changes.height;
+    }
+    return TkOS2GetHWND(heavyPtr->window);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ExcludeChildren --
+ *
+ *	Keep drawing into a window out of the area of its mapped
+ *	lightweight children, as WS_CLIPCHILDREN does for the others.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Changes the clip region of hps.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ExcludeChildren(hps, winPtr, x, y, height)
+    HPS hps;			/* Untransformed PS of the heavyweight. */
+    TkWindow *winPtr;
+    LONG x, y;			/* Lower left corner of winPtr in hps. */
+    LONG height;		/* Height of winPtr. */
+{
+    TkWindow *childPtr;
+    RECTL rect;
+
+    if (((TkOS2Drawable *) winPtr->window)->window.lightChildren == 0) {
+	return;
+    }
+    for (childPtr = winPtr->childList; childPtr != NULL;
+	    childPtr = childPtr->nextPtr) {
+	if ((childPtr->window == None) || !(childPtr->flags & TK_MAPPED)
+		|| !TkOS2IsLightweight(childPtr->window)) {
+	    continue;
+	}
+	rect.xLeft = x + childPtr->changes.x;
+	rect.xRight = rect.xLeft + childPtr->changes.width;
+	rect.yTop = y + height - childPtr->changes.y;
+	rect.yBottom = rect.yTop - childPtr->changes.height;
+	GpiExcludeClipRectangle(hps, &rect);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2ExcludeLightweight --
+ *
+ *	Keep drawing into a window with a PM window of its own out of
+ *	the area of its mapped lightweight children.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May change the clip region of hps.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2ExcludeLightweight(hps, winPtr)
+    HPS hps;			/* PS obtained for the window. */
+    TkWindow *winPtr;		/* Window with a PM window, or NULL. */
+{
+    if ((winPtr == NULL) || (winPtr->window == None)
+	    || (((TkOS2Drawable *) winPtr->window)->window.lightChildren
+		== 0)) {
+	return;
+    }
+    ExcludeChildren(hps, winPtr, 0, 0,
+	    TkOS2WindowHeight((TkOS2Drawable *) winPtr->window));
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GetLightweightPS --
+ *
+ *	Get a PS to draw into a lightweight window.  This is a PS of its
+ *	heavyweight, clipped to the window and translated so that the
+ *	window's lower left corner is at the origin; callers can treat it
+ *	as a PS of a window of the lightweight window's size.
+ *
+ * Results:
+ *	Returns the PS, to be released with WinReleasePS, and the PM
+ *	window it belongs to in *hwndPtr.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+HPS
+TkOS2GetLightweightPS(winPtr, hwndPtr)
+    TkWindow *winPtr;		/* Lightweight window. */
+    HWND *hwndPtr;
+{
+    TkWindow *ancPtr;
+    POINTL origin;
+    RECTL rect;
+    MATRIXLF matrix;
+    HPS hps;
+    LONG x, y;
+
+    *hwndPtr = TkOS2GetHeavyweight(winPtr, &origin);
+    hps = WinGetPS(*hwndPtr);
+
+    /*
+     * Clipping is set up in device coordinates, before translating:
+     * the window is clipped by its lightweight ancestors, the
+     * heavyweight does the rest.
+     */
+
+    x = origin.x;
+    y = origin.y;
+    for (ancPtr = winPtr; TkOS2IsLightweight(ancPtr->window);
+	    ancPtr = ancPtr->parentPtr) {
+	rect.xLeft = x;
+	rect.yBottom = y;
+	rect.xRight = x + ancPtr->changes.width;
+	rect.yTop = y + ancPtr->changes.height;
+	GpiIntersectClipRectangle(hps, &rect);
+	x -= ancPtr->changes.x;
+	y -= ancPtr->parentPtr->changes.height - ancPtr->changes.y
+		- ancPtr->changes.height;
+    }
+    ExcludeChildren(hps, winPtr, origin.x, origin.y, winPtr->changes.height);
+
+    matrix.fxM11 = MAKEFIXED(1, 0);
+    matrix.fxM12 = 0;
+    matrix.lM13 = 0;
+    matrix.fxM21 = 0;
+    matrix.fxM22 = MAKEFIXED(1, 0);
+    matrix.lM23 = 0;
+    matrix.lM31 = origin.x;
+    matrix.lM32 = origin.y;
+    matrix.lM33 = 1;
+    rc = GpiSetDefaultViewMatrix(hps, 9L, &matrix, TRANSFORM_REPLACE);
+#ifdef DEBUG
+if (rc!=TRUE) printf("GpiSetDefaultViewMatrix ERROR %x\n", WinGetLastError(hab));
+#endif
+    return hps;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2LightweightAt --
+ *
+ *	Find the lightweight window under a point of a window, for
+ *	dispatching pointer events.
+ *
+ * Results:
+ *	Returns the topmost mapped lightweight descendant of winPtr that
+ *	contains the point, or winPtr itself if there is none.  *xPtr
+ *	and *yPtr are made relative to the returned window.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TkWindow *
+TkOS2LightweightAt(winPtr, xPtr, yPtr)
+    TkWindow *winPtr;
+    int *xPtr, *yPtr;		/* Point in X coordinates of winPtr. */
+{
+    TkWindow *childPtr, *hitPtr;
+    int x = *xPtr, y = *yPtr;
+
+    do {
+	/*
+	 * The child list runs from the bottom of the stacking order to
+	 * the top, so the last hit is the one that is visible.
+	 */
+
+	hitPtr = NULL;
+	for (childPtr = winPtr->childList; childPtr != NULL;
+		childPtr = childPtr->nextPtr) {
+	    if ((childPtr->window != None) && (childPtr->flags & TK_MAPPED)
+		    && TkOS2IsLightweight(childPtr->window)
+		    && (x >= childPtr->changes.x)
+		    && (x < childPtr->changes.x + childPtr->changes.width)
+		    && (y >= childPtr->changes.y)
+		    && (y < childPtr->changes.y + childPtr->changes.height)) {
+		hitPtr = childPtr;
+	    }
+	}
+	if (hitPtr != NULL) {
+	    x -= hitPtr->changes.x;
+	    y -= hitPtr->changes.y;
+	    winPtr = hitPtr;
+	}
+    } while (hitPtr != NULL);
+    *xPtr = x;
+    *yPtr = y;
+    return winPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2ExposeLightweight --
+ *
+ *	Pass an Expose event of a window on to the lightweight windows
+ *	that are drawn in the exposed area.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Queues Expose events after the one for winPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2ExposeLightweight(winPtr, eventPtr)
+    TkWindow *winPtr;		/* Window the event is for. */
+    XEvent *eventPtr;		/* Expose event queued for winPtr. */
+{
+    TkWindow *childPtr;
+    XEvent event;
+    int x1, y1, x2, y2;
+
+    for (childPtr = winPtr->childList; childPtr != NULL;
+	    childPtr = childPtr->nextPtr) {
+	if ((childPtr->window == None) || !(childPtr->flags & TK_MAPPED)
+		|| !TkOS2IsLightweight(childPtr->window)) {
+	    continue;
+	}
+	x1 = eventPtr->xexpose.x - childPtr->changes.x;
+	y1 = eventPtr->xexpose.y - childPtr->changes.y;
+	x2 = x1 + eventPtr->xexpose.width;
+	y2 = y1 + eventPtr->xexpose.height;
+	if (x1 < 0) {
+	    x1 = 0;
+	}
+	if (y1 < 0) {
+	    y1 = 0;
+	}
+	if (x2 > childPtr->changes.width) {
+	    x2 = childPtr->changes.width;
+	}
+	if (y2 > childPtr->changes.height) {
+	    y2 = childPtr->changes.height;
+	}
+	if ((x1 >= x2) || (y1 >= y2)) {
+	    continue;
+	}
+	event = *eventPtr;
+	event.xexpose.window = childPtr->window;
+	event.xexpose.x = x1;
+	event.xexpose.y = y1;
+	event.xexpose.width = x2 - x1;
+	event.xexpose.height = y2 - y1;
+	Tk_QueueWindowEvent(&event, TCL_QUEUE_TAIL);
+	TkOS2ExposeLightweight(childPtr, &event);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2InvalidateWindow --
+ *
+ *	Have a window redrawn.  For a lightweight window, its area of
+ *	the heavyweight is invalidated, which in turn exposes the window
+ *	and anything else drawn there.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	PM will send a WM_PAINT message.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2InvalidateWindow(winPtr)
+    TkWindow *winPtr;
+{
+    POINTL origin;
+    RECTL rect;
+    HWND hwnd;
+
+    if ((winPtr == NULL) || (winPtr->window == None)) {
+	return;
+    }
+    if (!TkOS2IsLightweight(winPtr->window)) {
+	WinInvalidateRect(TkOS2GetHWND(winPtr->window), NULL, FALSE);
+	return;
+    }
+    hwnd = TkOS2GetHeavyweight(winPtr, &origin);
+    rect.xLeft = origin.x;
+    rect.yBottom = origin.y;
+    rect.xRight = origin.x + winPtr->changes.width;
+    rect.yTop = origin.y + winPtr->changes.height;
+    WinInvalidateRect(hwnd, &rect, FALSE);
+}
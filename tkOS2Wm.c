@@ -32,6 +32,30 @@ static WmInfo *foregroundWmPtr = NULL;	/* Points to the foreground window. */
 
 static int wmTracing = 0;
 
+/*
+ * Top-level geometry is changed once per burst of requests.  Requests
+ * from widgets, "wm geometry", gridding and the like only mark the
+ * window with WM_UPDATE_PENDING (ScheduleGeometryUpdate).  The changes
+ * are committed from an idle handler, which waits for further idle
+ * passes as long as the geometry managers keep asking for new sizes,
+ * and then reconfigures the frames of all pending toplevels with one
+ * WinSetMultWindowPos call.  The commit is always an idle handler,
+ * never a timer, so "update idletasks" applies it.
+ */
+
+#define MAX_SETTLE_PASSES	8	/* Most idle passes to wait for the
+					 * layout to settle. */
+
+static int commitScheduled = 0;		/* CommitFrameGeometry is scheduled
+					 * as an idle handler. */
+static unsigned long geometryRequests = 0;
+					/* Number of ScheduleGeometryUpdate
+					 * calls so far. */
+static unsigned long settledRequests = 0;
+					/* Value of geometryRequests at the
+					 * last idle pass. */
+static int settlePasses = 0;		/* Idle passes waited this frame. */
+
 /*
  * The following structure is the official type record for geometry
  * management of top-level windows.
@@ -63,6 +87,55 @@ static HPAL systemPalette = NULLHANDLE;
 
 static TkWindow *createWindow = NULL;
 
+/*
+ * Tk_GetRootCoords caches the root origin of a window in its drawable,
+ * stamped with rootGeneration.  Anything that moves a window, or a
+ * toplevel's client area within the screen, starts a new generation, so
+ * all cached origins become invalid at once without visiting them; they
+ * are computed again, from the parent's cached origin, when asked for.
+ */
+
+static unsigned long rootGeneration = 1;
+
+/*
+ * Spatial index of the mapped windows of a toplevel.  Tk_CoordsToWindow
+ * and the pointer code look up the window at a point for every motion
+ * event during drags; with the index, PM is only asked for the frame at
+ * the point, instead of walking its whole window tree, and the window
+ * handle doesn't have to be looked up.  The index is a uniform grid over
+ * the client area of the toplevel.  Each cell lists the windows whose
+ * visible rectangle overlaps it, in the order of a preorder walk of the
+ * window tree with siblings from the bottom of the stacking order to the
+ * top, so the last one in the list that contains a point is the one that
+ * is visible there.  Changes to the window layout only mark the index
+ * stale; it is rebuilt on the next query.
+ */
+
+#define INDEX_CELL_SIZE	32	/* Preferred width and height of a cell. */
+#define INDEX_MAX_CELLS	64	/* Maximum number of cells in a row or
+				 * column. */
+
+typedef struct {
+    TkWindow *winPtr;
+    int x1, y1, x2, y2;		/* Visible part of the window, in
+				 * coordinates of the toplevel. */
+} IndexEntry;
+
+typedef struct TkOS2WindowIndex {
+    int stale;			/* 1 means rebuild before the next query. */
+    int width, height;		/* Size of the toplevel when built. */
+    int cellWidth, cellHeight;
+    int columns, rows;
+    IndexEntry *entries;	/* Mapped descendants, in preorder. */
+    int numEntries, maxEntries;
+    int *cellStart;		/* For every cell, the index in cellItems of
+				 * its first entry; one extra element marks
+				 * the end of the last cell. */
+    int maxCells;
+    int *cellItems;		/* Entry numbers, grouped by cell. */
+    int maxItems;
+} WindowIndex;
+
 /*
  * Forward declarations for procedures defined in this file:
  */
@@ -73,11 +146,23 @@ static void     GetMaxSize _ANSI_ARGS_((WmInfo *wmPtr, int *maxWidthPtr,
 static void     GetMinSize _ANSI_ARGS_((WmInfo *wmPtr, int *minWidthPtr,
                     int *minHeightPtr));
 static void	IconifyWindow _ANSI_ARGS_((TkWindow *winPtr));
+static void	AddIndexEntries _ANSI_ARGS_((WindowIndex *indexPtr,
+		    TkWindow *winPtr, int x, int y, int clipX1, int clipY1,
+		    int clipX2, int clipY2));
+static void	ApplySizeLimits _ANSI_ARGS_((TkWindow *winPtr,
+		    int *widthPtr, int *heightPtr));
+static void	BuildWindowIndex _ANSI_ARGS_((TkWindow *topPtr));
+static void	CommitFrameGeometry _ANSI_ARGS_((ClientData clientData));
+static int	ComputeFrameGeometry _ANSI_ARGS_((TkWindow *winPtr,
+		    SWP *swpPtr));
+static void	FlushFrameGeometry _ANSI_ARGS_((void));
+static void	InstallColormapsIdle _ANSI_ARGS_((ClientData clientData));
 static void     InvalidateSubTree _ANSI_ARGS_((TkWindow *winPtr,
                     Colormap colormap));
 static int	ParseGeometry _ANSI_ARGS_((Tcl_Interp *interp, char *string,
                     TkWindow *winPtr));
 static void     RefreshColormap _ANSI_ARGS_((Colormap colormap));
+static void	ScheduleGeometryUpdate _ANSI_ARGS_((TkWindow *winPtr));
 static void	TopLevelEventProc _ANSI_ARGS_((ClientData clientData,
                     XEvent *eventPtr));
 static void	TopLevelReqProc _ANSI_ARGS_((ClientData dummy,
@@ -304,6 +389,7 @@ printf("TkWmNewWindow, x %d y %d\n", wmPtr->x, wmPtr->y);
 
     wmPtr->cmapList = NULL;
     wmPtr->cmapCount = 0;
+    wmPtr->indexPtr = NULL;
 
     wmPtr->configWidth = -1;
     wmPtr->configHeight = -1;
@@ -489,6 +575,7 @@ printf("NO border: xIP %d, yIP %d, bW %d, bH %d\n", wmPtr->xInParent,
 wmPtr->yInParent, wmPtr->borderWidth, wmPtr->borderHeight);
 #endif
         }
+        TkOS2RootCoordsChanged();
         if (wmPtr->exStyle & FCF_TITLEBAR) {
             wmPtr->borderHeight += titleBar;
 #ifdef DEBUG
@@ -532,6 +619,9 @@ printf("+ height %d -> %d\n", winPtr->changes.height, height);
         parentPtr = (TkOS2Drawable *) ckalloc(sizeof(TkOS2Drawable));
         parentPtr->type = TOD_WM_WINDOW;
         parentPtr->window.winPtr = winPtr;
+        parentPtr->window.flags = 0;
+        parentPtr->window.rootGeneration = 0;
+        parentPtr->window.lightChildren = 0;
         wmPtr->reparent = (Window)parentPtr;
 
         createWindow = winPtr;
@@ -695,9 +785,6 @@ printf("    display %x\n", winPtr->display);
     } else if (wmPtr->hints.initial_state == WithdrawnState) {
 	return;
     } else {
-	if (wmPtr->flags & WM_UPDATE_PENDING) {
-	    Tcl_CancelIdleCall(UpdateGeometryInfo, (ClientData) winPtr);
-	}
 	UpdateGeometryInfo((ClientData) winPtr);
     }
 
@@ -879,8 +966,22 @@ printf("TkWmDeadWindow\n");
     if (wmPtr->clientMachine != NULL) {
 	ckfree((char *) wmPtr->clientMachine);
     }
-    if (wmPtr->flags & WM_UPDATE_PENDING) {
-	Tcl_CancelIdleCall(UpdateGeometryInfo, (ClientData) winPtr);
+    if (wmPtr->flags & WM_COLORMAPS_PENDING) {
+	Tcl_CancelIdleCall(InstallColormapsIdle, (ClientData) winPtr);
+    }
+    if (wmPtr->indexPtr != NULL) {
+	WindowIndex *indexPtr = wmPtr->indexPtr;
+
+	if (indexPtr->entries != NULL) {
+	    ckfree((char *) indexPtr->entries);
+	}
+	if (indexPtr->cellStart != NULL) {
+	    ckfree((char *) indexPtr->cellStart);
+	}
+	if (indexPtr->cellItems != NULL) {
+	    ckfree((char *) indexPtr->cellItems);
+	}
+	ckfree((char *) indexPtr);
     }
 
     /*
@@ -1305,14 +1406,9 @@ printf("   %s %s %s\n", argv[0], argv[1], argv[2]);
 	 * Now we need to force the updated colormaps to be installed.
 	 */
 
-        if (wmPtr == foregroundWmPtr) {
-            TkOS2WmInstallColormaps(TkOS2GetHWND(wmPtr->reparent),
-/* WM_QUERYNEWPALETTE -> WM_REALIZEPALETTE + focus notification */
-                    WM_REALIZEPALETTE, 1);
-        } else {
-            TkOS2WmInstallColormaps(TkOS2GetHWND(wmPtr->reparent),
-/* WM_PALETTECHANGED -> WM_REALIZEPALETTE + focus notification */
-                    WM_REALIZEPALETTE, 0);
+        if (!(wmPtr->flags & WM_COLORMAPS_PENDING)) {
+            wmPtr->flags |= WM_COLORMAPS_PENDING;
+            Tcl_DoWhenIdle(InstallColormapsIdle, (ClientData) winPtr);
         }
         if (freeProc)
 	    (*freeProc)(windowArgc,windowArgs);
@@ -2113,10 +2209,7 @@ printf("   %s %s %s\n", argv[0], argv[1], argv[2]);
     return TCL_OK;
 
     updateGeom:
-    if (!(wmPtr->flags & (WM_UPDATE_PENDING|WM_NEVER_MAPPED))) {
-	Tcl_DoWhenIdle(UpdateGeometryInfo, (ClientData) winPtr);
-	wmPtr->flags |= WM_UPDATE_PENDING;
-    }
+    ScheduleGeometryUpdate(winPtr);
     return TCL_OK;
 }
 
@@ -2212,10 +2305,7 @@ printf("Tk_SetGrid\n");
     wmPtr->widthInc = widthInc;
     wmPtr->heightInc = heightInc;
     wmPtr->sizeHintsFlags |= PBaseSize|PResizeInc;
-    if (!(wmPtr->flags & (WM_UPDATE_PENDING|WM_NEVER_MAPPED))) {
-	Tcl_DoWhenIdle(UpdateGeometryInfo, (ClientData) winPtr);
-	wmPtr->flags |= WM_UPDATE_PENDING;
-    }
+    ScheduleGeometryUpdate(winPtr);
 }
 
 /*
@@ -2273,10 +2363,7 @@ printf("Tk_UnsetGrid\n");
     wmPtr->widthInc = 1;
     wmPtr->heightInc = 1;
 
-    if (!(wmPtr->flags & (WM_UPDATE_PENDING|WM_NEVER_MAPPED))) {
-	Tcl_DoWhenIdle(UpdateGeometryInfo, (ClientData) winPtr);
-	wmPtr->flags |= WM_UPDATE_PENDING;
-    }
+    ScheduleGeometryUpdate(winPtr);
 }
 
 /*
@@ -2356,30 +2443,162 @@ TopLevelReqProc(dummy, tkwin)
     Tk_Window tkwin;			/* Information about window. */
 {
     TkWindow *winPtr = (TkWindow *) tkwin;
-    WmInfo *wmPtr;
 
 #ifdef DEBUG
 printf("TopLevelReqProc\n");
 #endif
 
-    wmPtr = winPtr->wmInfoPtr;
-    if (!(wmPtr->flags & (WM_UPDATE_PENDING|WM_NEVER_MAPPED))) {
-	Tcl_DoWhenIdle(UpdateGeometryInfo, (ClientData) winPtr);
-	wmPtr->flags |= WM_UPDATE_PENDING;
-    }
+    ScheduleGeometryUpdate(winPtr);
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScheduleGeometryUpdate --
+ *
+ *	Arrange for the geometry of a top-level window to be brought
+ *	up to date when the application is next idle, see
+ *	CommitFrameGeometry.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May create an idle handler.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ScheduleGeometryUpdate(winPtr)
+    TkWindow *winPtr;		/* Top-level window. */
+{
+    register WmInfo *wmPtr = winPtr->wmInfoPtr;
+
+    if (wmPtr->flags & WM_NEVER_MAPPED) {
+	return;
+    }
+    wmPtr->flags |= WM_UPDATE_PENDING;
+    geometryRequests++;
+    if (commitScheduled) {
+	return;
+    }
+    commitScheduled = 1;
+    settledRequests = geometryRequests;
+    settlePasses = 0;
+    Tcl_DoWhenIdle(CommitFrameGeometry, (ClientData) NULL);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CommitFrameGeometry --
+ *
+ *	Idle handler that applies the geometry of all top-level windows
+ *	with pending changes.  If the idle handlers run before it in the
+ *	same pass requested new sizes, the commit is put off until the
+ *	next pass, so that a window being built is resized once to its
+ *	final size instead of growing in steps.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Top-level windows may be moved and resized.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CommitFrameGeometry(clientData)
+    ClientData clientData;	/* Not used. */
+{
+    if ((geometryRequests != settledRequests)
+	    && (settlePasses < MAX_SETTLE_PASSES)) {
+	settledRequests = geometryRequests;
+	settlePasses++;
+	Tcl_DoWhenIdle(CommitFrameGeometry, (ClientData) NULL);
+	return;
+    }
+    commitScheduled = 0;
+    FlushFrameGeometry();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FlushFrameGeometry --
+ *
+ *	Move and resize the frames of all top-level windows marked with
+ *	WM_UPDATE_PENDING, with a single WinSetMultWindowPos call.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Top-level windows may be moved and resized.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FlushFrameGeometry()
+{
+    register WmInfo *wmPtr;
+    SWP *swps;
+    int n;
+
+    n = 0;
+    for (wmPtr = firstWmPtr; wmPtr != NULL; wmPtr = wmPtr->nextPtr) {
+	if (wmPtr->flags & WM_UPDATE_PENDING) {
+	    n++;
+	}
+    }
+    if (n == 0) {
+	return;
+    }
+    swps = (SWP *) ckalloc(n * sizeof(SWP));
+
+    n = 0;
+    for (wmPtr = firstWmPtr; wmPtr != NULL; wmPtr = wmPtr->nextPtr) {
+	if (!(wmPtr->flags & WM_UPDATE_PENDING)) {
+	    continue;
+	}
+	wmPtr->flags &= ~WM_UPDATE_PENDING;
+	if (ComputeFrameGeometry(wmPtr->winPtr, &swps[n])) {
+	    wmPtr->flags |= WM_SYNC_PENDING;
+	    n++;
+	}
+    }
+
+    if (n > 0) {
+#ifdef DEBUG
+	printf("FlushFrameGeometry: %d toplevels\n", n);
+#endif
+	if (WinSetMultWindowPos(hab, swps, n) != TRUE) {
+#ifdef DEBUG
+	    printf("WinSetMultWindowPos ERROR %x\n", WinGetLastError(hab));
+#endif
+	}
+	for (wmPtr = firstWmPtr; wmPtr != NULL; wmPtr = wmPtr->nextPtr) {
+	    wmPtr->flags &= ~WM_SYNC_PENDING;
+	}
+    }
+    ckfree((char *) swps);
+}
+
 /*
  *----------------------------------------------------------------------
  *
  * UpdateGeometryInfo --
  *
  *	This procedure is invoked when a top-level window is first
- *	mapped, and also as a when-idle procedure, to bring the
+ *	mapped and when its position is set explicitly, to bring the
  *	geometry and/or position of a top-level window back into
  *	line with what has been requested by the user and/or widgets.
- *	This procedure doesn't return until the window manager has
- *	responded to the geometry change.
+ *	Other changes go through ScheduleGeometryUpdate and are applied
+ *	once per burst of requests.  This procedure doesn't return until
+ *	the window manager has responded to the geometry change.
  *
  * Results:
  *	None.
@@ -2397,13 +2616,54 @@ UpdateGeometryInfo(clientData)
 {
     register TkWindow *winPtr = (TkWindow *) clientData;
     register WmInfo *wmPtr = winPtr->wmInfoPtr;
-    int x, y, width, height;
+    SWP swp;
 
 #ifdef DEBUG
 printf("UpdateGeometryInfo\n");
 #endif
 
     wmPtr->flags &= ~WM_UPDATE_PENDING;
+    if (!ComputeFrameGeometry(winPtr, &swp)) {
+	return;
+    }
+
+    wmPtr->flags |= WM_SYNC_PENDING;
+#ifdef DEBUG
+printf("    WinSetWindowPos(%x, HWND_TOP, %d, %d, %d, %d, SWP_SIZE|SWP_MOVE)\n",
+swp.hwnd, swp.x, swp.y, swp.cx, swp.cy);
+#endif
+    WinSetWindowPos(swp.hwnd, swp.hwndInsertBehind, swp.x, swp.y, swp.cx,
+	    swp.cy, swp.fl);
+    wmPtr->flags &= ~WM_SYNC_PENDING;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ComputeFrameGeometry --
+ *
+ *	Compute the size and position the frame of a top-level window
+ *	should have, given the requests of the user and the widgets and
+ *	the size limits (see TkOS2WmSetLimits).
+ *
+ * Results:
+ *	Returns 1 and fills in *swpPtr if the frame must be moved or
+ *	resized, 0 if it is already configured correctly.
+ *
+ * Side effects:
+ *	While the window is being created (WM_CREATE_PENDING) its
+ *	geometry is stored in winPtr->changes directly.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ComputeFrameGeometry(winPtr, swpPtr)
+    TkWindow *winPtr;		/* Top-level window. */
+    SWP *swpPtr;		/* Filled in with the new frame geometry. */
+{
+    register WmInfo *wmPtr = winPtr->wmInfoPtr;
+    int x, y, width, height;
 
     /*
      * Compute the new size for the top-level window.  See the
@@ -2439,6 +2699,8 @@ printf("UpdateGeometryInfo\n");
 	height = 1;
     }
 
+    ApplySizeLimits(winPtr, &width, &height);
+
     /*
      * Compute the new position for the upper-left pixel of the window's
      * decorative frame.  This is tricky, because we need to include the
@@ -2465,46 +2727,103 @@ printf("UpdateGeometryInfo\n");
      * the size check on what we *asked for* last time, not what we got.
      */
 
-    if ((wmPtr->flags & WM_MOVE_PENDING)
-	    || (width != wmPtr->configWidth)
-	    || (height != wmPtr->configHeight)) {
-	wmPtr->configWidth = width;
-	wmPtr->configHeight = height;
-
-       /*
-        * Don't bother moving the window if we are in the process of
-        * creating it.  Just update the geometry info based on what
-        * we asked for.
-        */
-
-        if (!(wmPtr->flags & WM_CREATE_PENDING)) {
-            TkOS2Drawable *todPtr = (TkOS2Drawable *)
-                              WinQueryWindowULong(TkOS2GetHWND(wmPtr->reparent),
-                              QWL_USER);
-            USHORT windowHeight = TkOS2WindowHeight(todPtr);
-
-            wmPtr->flags |= WM_SYNC_PENDING;
-            /* Make sure we get the right size/position */
-#ifdef DEBUG
-printf("    WinSetWindowPos(%x, HWND_TOP, %d, %d, %d, %d, SWP_SIZE|SWP_MOVE)\n",
-TkOS2GetHWND(wmPtr->reparent), x, yScreen - (y + height + wmPtr->borderHeight),
-width + wmPtr->borderWidth, height + wmPtr->borderHeight);
-#endif
-	    WinSetWindowPos(TkOS2GetHWND(wmPtr->reparent), HWND_TOP,
-                x, yScreen - (y + height + wmPtr->borderHeight),
-                width + wmPtr->borderWidth, height + wmPtr->borderHeight,
-		SWP_SIZE | SWP_MOVE);
+    if (!(wmPtr->flags & WM_MOVE_PENDING)
+	    && (width == wmPtr->configWidth)
+	    && (height == wmPtr->configHeight)) {
+	return 0;
+    }
+    wmPtr->configWidth = width;
+    wmPtr->configHeight = height;
+
+    /*
+     * Don't bother moving the window if we are in the process of
+     * creating it.  Just update the geometry info based on what
+     * we asked for.
+     */
+
+    if (wmPtr->flags & WM_CREATE_PENDING) {
+	TkOS2RootCoordsChanged();
+	winPtr->changes.x = x;
+	winPtr->changes.y = y;
+	winPtr->changes.width = width;
+	winPtr->changes.height = height;
+	return 0;
+    }
+
+    swpPtr->fl = SWP_SIZE | SWP_MOVE;
+    swpPtr->cx = width + wmPtr->borderWidth;
+    swpPtr->cy = height + wmPtr->borderHeight;
+    swpPtr->x = x;
+    swpPtr->y = yScreen - (y + height + wmPtr->borderHeight);
+    swpPtr->hwndInsertBehind = HWND_TOP;
+    swpPtr->hwnd = TkOS2GetHWND(wmPtr->reparent);
+    swpPtr->ulReserved1 = 0;
+    swpPtr->ulReserved2 = 0;
+    return 1;
+}
+
 /*
-*/
-            wmPtr->flags &= ~WM_SYNC_PENDING;
-        } else {
-            winPtr->changes.x = x;
-            winPtr->changes.y = y;
-            winPtr->changes.width = width;
-            winPtr->changes.height = height;
-        }
-    } else {
-	return;
+ *----------------------------------------------------------------------
+ *
+ * ApplySizeLimits --
+ *
+ *	Clip the client size of a top-level window to the limits PM
+ *	enforces when the user resizes it, see TkOS2WmSetLimits.
+ *
+ * Results:
+ *	*widthPtr and *heightPtr are adjusted.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ApplySizeLimits(winPtr, widthPtr, heightPtr)
+    TkWindow *winPtr;		/* Top-level window. */
+    int *widthPtr, *heightPtr;	/* Client size in pixels. */
+{
+    register WmInfo *wmPtr = winPtr->wmInfoPtr;
+    int minWidth, minHeight, maxWidth, maxHeight;
+    int baseWidth, baseHeight, incWidth, incHeight;
+
+    GetMinSize(wmPtr, &minWidth, &minHeight);
+    GetMaxSize(wmPtr, &maxWidth, &maxHeight);
+    baseWidth = baseHeight = 0;
+    incWidth = incHeight = 1;
+    if (wmPtr->gridWin != NULL) {
+	baseWidth = winPtr->reqWidth - (wmPtr->reqGridWidth * wmPtr->widthInc);
+	if (baseWidth < 0) {
+	    baseWidth = 0;
+	}
+	baseHeight = winPtr->reqHeight
+		- (wmPtr->reqGridHeight * wmPtr->heightInc);
+	if (baseHeight < 0) {
+	    baseHeight = 0;
+	}
+	incWidth = wmPtr->widthInc;
+	incHeight = wmPtr->heightInc;
+    }
+
+    /*
+     * The default maximum is the size of the screen; only an explicit
+     * "wm maxsize" shrinks the window, as under X.
+     */
+
+    if ((wmPtr->maxWidth > 0)
+	    && (*widthPtr > baseWidth + maxWidth * incWidth)) {
+	*widthPtr = baseWidth + maxWidth * incWidth;
+    }
+    if ((wmPtr->maxHeight > 0)
+	    && (*heightPtr > baseHeight + maxHeight * incHeight)) {
+	*heightPtr = baseHeight + maxHeight * incHeight;
+    }
+    if (*widthPtr < baseWidth + minWidth * incWidth) {
+	*widthPtr = baseWidth + minWidth * incWidth;
+    }
+    if (*heightPtr < baseHeight + minHeight * incHeight) {
+	*heightPtr = baseHeight + minHeight * incHeight;
     }
 }
 
@@ -2629,10 +2948,7 @@ printf("ParseGeometry\n");
     }
     wmPtr->flags = flags;
 
-    if (!(wmPtr->flags & (WM_UPDATE_PENDING|WM_NEVER_MAPPED))) {
-	Tcl_DoWhenIdle(UpdateGeometryInfo, (ClientData) winPtr);
-	wmPtr->flags |= WM_UPDATE_PENDING;
-    }
+    ScheduleGeometryUpdate(winPtr);
     return TCL_OK;
 
     error:
@@ -2657,7 +2973,8 @@ printf("ParseGeometry\n");
  *	in the virtual root are returned.
  *
  * Side effects:
- *	None.
+ *	Caches the coordinates of tkwin and its ancestors, see
+ *	rootGeneration.
  *
  *----------------------------------------------------------------------
  */
@@ -2670,31 +2987,72 @@ Tk_GetRootCoords(tkwin, xPtr, yPtr)
 {
     int x, y;
     register TkWindow *winPtr = (TkWindow *) tkwin;
+    TkOS2Window *cachePtr = NULL;
 
 #ifdef DEBUG
 printf("Tk_GetRootCoords\n");
 #endif
 
+    if (winPtr->window != None) {
+	cachePtr = &((TkOS2Drawable *) winPtr->window)->window;
+	if (cachePtr->rootGeneration == rootGeneration) {
+	    *xPtr = cachePtr->rootX;
+	    *yPtr = cachePtr->rootY;
+	    return;
+	}
+    }
+
     /*
-     * Search back through this window's parents all the way to a
-     * top-level window, combining the offsets of each window within
-     * its parent.
+     * Add the offset of this window within its parent to the parent's
+     * origin, which is usually cached already.
      */
 
-    x = y = 0;
-    while (1) {
-	x += winPtr->changes.x + winPtr->changes.border_width;
-	y += winPtr->changes.y + winPtr->changes.border_width;
-	if (winPtr->flags & TK_TOP_LEVEL) {
-	    x += winPtr->wmInfoPtr->xInParent;
-	    y += winPtr->wmInfoPtr->yInParent;
-	    break;
-	}
-	winPtr = winPtr->parentPtr;
+    x = winPtr->changes.x + winPtr->changes.border_width;
+    y = winPtr->changes.y + winPtr->changes.border_width;
+    if (winPtr->flags & TK_TOP_LEVEL) {
+	x += winPtr->wmInfoPtr->xInParent;
+	y += winPtr->wmInfoPtr->yInParent;
+    } else {
+	int parentX, parentY;
+
+	Tk_GetRootCoords((Tk_Window) winPtr->parentPtr, &parentX, &parentY);
+	x += parentX;
+	y += parentY;
+    }
+    if (cachePtr != NULL) {
+	cachePtr->rootX = x;
+	cachePtr->rootY = y;
+	cachePtr->rootGeneration = rootGeneration;
     }
     *xPtr = x;
     *yPtr = y;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2RootCoordsChanged --
+ *
+ *	Called when a window moves within its parent or on the screen,
+ *	to invalidate the root coordinates cached by Tk_GetRootCoords.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Starts a new generation of cached root coordinates.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2RootCoordsChanged()
+{
+    rootGeneration++;
+    if (rootGeneration == 0) {
+	rootGeneration = 1;	/* 0 means nothing cached */
+    }
+}
 
 /*
  *----------------------------------------------------------------------
@@ -2724,29 +3082,332 @@ Tk_CoordsToWindow(rootX, rootY, tkwin)
 				 * root, not the real root. */
     Tk_Window tkwin;		/* Token for any window in application;
 				 * used to identify the display. */
+{
+    HWND hwnd;
+    TkWindow *winPtr;
+
+    winPtr = TkOS2RootCoordsToWindow(rootX, rootY, &hwnd);
+#ifdef DEBUG
+    printf("Tk_CoordsToWindow (%d,%d): %x\n", rootX, rootY, winPtr);
+#endif
+    if ((winPtr != NULL)
+	    && (winPtr->mainPtr == ((TkWindow *) tkwin)->mainPtr)) {
+	return (Tk_Window) winPtr;
+    }
+    return NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2RootCoordsToWindow --
+ *
+ *	Find the Tk window at a point of the screen.  PM is only asked
+ *	which frame is at the point, the window inside it is found in
+ *	the spatial index of the toplevel.
+ *
+ * Results:
+ *	Returns the topmost Tk window at the point, which may be a
+ *	lightweight window, or NULL if there is none.  *hwndPtr is set
+ *	to the PM window at the point: the one the Tk window draws into,
+ *	or the frame if there is no Tk window.
+ *
+ * Side effects:
+ *	May rebuild the index.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TkWindow *
+TkOS2RootCoordsToWindow(rootX, rootY, hwndPtr)
+    int rootX, rootY;		/* Point in X root coordinates. */
+    HWND *hwndPtr;
 {
     POINTL pos;
     HWND hwnd;
     TkOS2Drawable *todPtr;
-    TkWindow *winPtr;
+    TkWindow *topPtr, *winPtr;
+    WindowIndex *indexPtr;
+    IndexEntry *entryPtr;
+    int x, y, cell, i;
 
     pos.x = rootX;
     /* Translate to PM coordinates */
     pos.y = yScreen - rootY;
-    hwnd = WinWindowFromPoint(HWND_DESKTOP, &pos, TRUE);
-#ifdef DEBUG
-    printf("Tk_CoordsToWindow (%d,%d): %x\n", pos.x, pos.y, hwnd);
-#endif
-    if (hwnd == HWND_DESKTOP) return NULL;
-
+    hwnd = WinWindowFromPoint(HWND_DESKTOP, &pos, FALSE);
+    *hwndPtr = hwnd;
     todPtr = TkOS2GetDrawableFromHandle(hwnd);
-    if (todPtr && (todPtr->type == TOD_WINDOW)) {
-	winPtr = TkOS2GetWinPtr(todPtr);
-	if (winPtr->mainPtr == ((TkWindow *) tkwin)->mainPtr) {
-	    return (Tk_Window) winPtr;
+    if ((todPtr == NULL) || (todPtr->type == TOD_BITMAP)) {
+	return NULL;
+    }
+    topPtr = TkOS2GetWinPtr(todPtr);
+    if ((topPtr == NULL) || !(topPtr->flags & TK_TOP_LEVEL)
+	    || (topPtr->wmInfoPtr == NULL)) {
+	return NULL;
+    }
+
+    /*
+     * Make the point relative to the client area of the toplevel;
+     * outside of it, the point is on the frame.
+     */
+
+    Tk_GetRootCoords((Tk_Window) topPtr, &x, &y);
+    x = rootX - x;
+    y = rootY - y;
+    if ((x < 0) || (y < 0) || (x >= topPtr->changes.width)
+	    || (y >= topPtr->changes.height)) {
+	return NULL;
+    }
+
+    indexPtr = topPtr->wmInfoPtr->indexPtr;
+    if ((indexPtr == NULL) || indexPtr->stale
+	    || (indexPtr->width != topPtr->changes.width)
+	    || (indexPtr->height != topPtr->changes.height)) {
+	BuildWindowIndex(topPtr);
+	indexPtr = topPtr->wmInfoPtr->indexPtr;
+    }
+
+    winPtr = topPtr;
+    cell = (y / indexPtr->cellHeight) * indexPtr->columns
+	    + x / indexPtr->cellWidth;
+    for (i = indexPtr->cellStart[cell + 1] - 1;
+	    i >= indexPtr->cellStart[cell]; i--) {
+	entryPtr = &indexPtr->entries[indexPtr->cellItems[i]];
+	if ((x >= entryPtr->x1) && (x < entryPtr->x2)
+		&& (y >= entryPtr->y1) && (y < entryPtr->y2)) {
+	    winPtr = entryPtr->winPtr;
+	    break;
 	}
     }
-    return NULL;
+    *hwndPtr = TkOS2GetHeavyweight(winPtr, NULL);
+    return winPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2WindowIndexChanged --
+ *
+ *	Called when a window is mapped, unmapped, moved, resized,
+ *	restacked or destroyed, to mark the spatial index of its
+ *	toplevel stale.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The index will be rebuilt on the next query.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2WindowIndexChanged(winPtr)
+    TkWindow *winPtr;
+{
+    while (!(winPtr->flags & TK_TOP_LEVEL)) {
+	winPtr = winPtr->parentPtr;
+	if (winPtr == NULL) {
+	    return;
+	}
+    }
+    if ((winPtr->wmInfoPtr != NULL) && (winPtr->wmInfoPtr->indexPtr != NULL)) {
+	winPtr->wmInfoPtr->indexPtr->stale = 1;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BuildWindowIndex --
+ *
+ *	(Re)build the spatial index of a toplevel.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Allocates or reuses the index of topPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+BuildWindowIndex(topPtr)
+    TkWindow *topPtr;
+{
+    WindowIndex *indexPtr = topPtr->wmInfoPtr->indexPtr;
+    IndexEntry *entryPtr;
+    int width = topPtr->changes.width;
+    int height = topPtr->changes.height;
+    int numCells, col, row, col1, col2, row1, row2, cell, i;
+
+    if (indexPtr == NULL) {
+	indexPtr = (WindowIndex *) ckalloc(sizeof(WindowIndex));
+	indexPtr->entries = NULL;
+	indexPtr->maxEntries = 0;
+	indexPtr->cellStart = NULL;
+	indexPtr->maxCells = 0;
+	indexPtr->cellItems = NULL;
+	indexPtr->maxItems = 0;
+	topPtr->wmInfoPtr->indexPtr = indexPtr;
+    }
+    indexPtr->stale = 0;
+    indexPtr->width = width;
+    indexPtr->height = height;
+
+    indexPtr->numEntries = 0;
+    AddIndexEntries(indexPtr, topPtr, 0, 0, 0, 0, width, height);
+
+    /*
+     * Lay out the grid.
+     */
+
+    indexPtr->cellWidth = INDEX_CELL_SIZE;
+    if (width > INDEX_CELL_SIZE * INDEX_MAX_CELLS) {
+	indexPtr->cellWidth = (width + INDEX_MAX_CELLS - 1) / INDEX_MAX_CELLS;
+    }
+    indexPtr->cellHeight = INDEX_CELL_SIZE;
+    if (height > INDEX_CELL_SIZE * INDEX_MAX_CELLS) {
+	indexPtr->cellHeight = (height + INDEX_MAX_CELLS - 1) / INDEX_MAX_CELLS;
+    }
+    indexPtr->columns = (width + indexPtr->cellWidth - 1) / indexPtr->cellWidth;
+    indexPtr->rows = (height + indexPtr->cellHeight - 1) / indexPtr->cellHeight;
+    if (indexPtr->columns < 1) {
+	indexPtr->columns = 1;
+    }
+    if (indexPtr->rows < 1) {
+	indexPtr->rows = 1;
+    }
+    numCells = indexPtr->columns * indexPtr->rows;
+    if (numCells + 1 > indexPtr->maxCells) {
+	if (indexPtr->cellStart != NULL) {
+	    ckfree((char *) indexPtr->cellStart);
+	}
+	indexPtr->maxCells = numCells + 1;
+	indexPtr->cellStart = (int *) ckalloc(indexPtr->maxCells * sizeof(int));
+    }
+
+    /*
+     * Count the entries of every cell, then turn the counts into start
+     * positions and fill in the entries.  Filling in moves every start
+     * position on to the start of the next cell; shift them back.
+     */
+
+    for (cell = 0; cell <= numCells; cell++) {
+	indexPtr->cellStart[cell] = 0;
+    }
+    for (i = 0; i < indexPtr->numEntries; i++) {
+	entryPtr = &indexPtr->entries[i];
+	col1 = entryPtr->x1 / indexPtr->cellWidth;
+	col2 = (entryPtr->x2 - 1) / indexPtr->cellWidth;
+	row1 = entryPtr->y1 / indexPtr->cellHeight;
+	row2 = (entryPtr->y2 - 1) / indexPtr->cellHeight;
+	for (row = row1; row <= row2; row++) {
+	    for (col = col1; col <= col2; col++) {
+		indexPtr->cellStart[row * indexPtr->columns + col + 1]++;
+	    }
+	}
+    }
+    for (cell = 1; cell <= numCells; cell++) {
+	indexPtr->cellStart[cell] += indexPtr->cellStart[cell - 1];
+    }
+    if (indexPtr->cellStart[numCells] > indexPtr->maxItems) {
+	if (indexPtr->cellItems != NULL) {
+	    ckfree((char *) indexPtr->cellItems);
+	}
+	indexPtr->maxItems = indexPtr->cellStart[numCells];
+	indexPtr->cellItems = (int *) ckalloc(indexPtr->maxItems * sizeof(int));
+    }
+    for (i = 0; i < indexPtr->numEntries; i++) {
+	entryPtr = &indexPtr->entries[i];
+	col1 = entryPtr->x1 / indexPtr->cellWidth;
+	col2 = (entryPtr->x2 - 1) / indexPtr->cellWidth;
+	row1 = entryPtr->y1 / indexPtr->cellHeight;
+	row2 = (entryPtr->y2 - 1) / indexPtr->cellHeight;
+	for (row = row1; row <= row2; row++) {
+	    for (col = col1; col <= col2; col++) {
+		cell = row * indexPtr->columns + col;
+		indexPtr->cellItems[indexPtr->cellStart[cell]++] = i;
+	    }
+	}
+    }
+    for (cell = numCells; cell > 0; cell--) {
+	indexPtr->cellStart[cell] = indexPtr->cellStart[cell - 1];
+    }
+    indexPtr->cellStart[0] = 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddIndexEntries --
+ *
+ *	Add the visible mapped descendants of a window to a spatial
+ *	index, in preorder.  Toplevels have their own index.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May grow the entries array.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AddIndexEntries(indexPtr, winPtr, x, y, clipX1, clipY1, clipX2, clipY2)
+    WindowIndex *indexPtr;
+    TkWindow *winPtr;
+    int x, y;			/* Origin of winPtr in the toplevel. */
+    int clipX1, clipY1, clipX2, clipY2;
+				/* Visible part of winPtr. */
+{
+    TkWindow *childPtr;
+    IndexEntry *entryPtr;
+    int cx, cy, x1, y1, x2, y2;
+
+    for (childPtr = winPtr->childList; childPtr != NULL;
+	    childPtr = childPtr->nextPtr) {
+	if ((childPtr->flags & TK_TOP_LEVEL) || (childPtr->window == None)
+		|| !(childPtr->flags & TK_MAPPED)) {
+	    continue;
+	}
+	cx = x + childPtr->changes.x + childPtr->changes.border_width;
+	cy = y + childPtr->changes.y + childPtr->changes.border_width;
+	x1 = (cx > clipX1) ? cx : clipX1;
+	y1 = (cy > clipY1) ? cy : clipY1;
+	x2 = cx + childPtr->changes.width;
+	y2 = cy + childPtr->changes.height;
+	if (x2 > clipX2) {
+	    x2 = clipX2;
+	}
+	if (y2 > clipY2) {
+	    y2 = clipY2;
+	}
+	if ((x1 >= x2) || (y1 >= y2)) {
+	    continue;
+	}
+	if (indexPtr->numEntries == indexPtr->maxEntries) {
+	    if (indexPtr->entries == NULL) {
+		indexPtr->maxEntries = 32;
+		indexPtr->entries = (IndexEntry *) ckalloc(
+			indexPtr->maxEntries * sizeof(IndexEntry));
+	    } else {
+		indexPtr->maxEntries *= 2;
+		indexPtr->entries = (IndexEntry *) ckrealloc(
+			(char *) indexPtr->entries,
+			indexPtr->maxEntries * sizeof(IndexEntry));
+	    }
+	}
+	entryPtr = &indexPtr->entries[indexPtr->numEntries++];
+	entryPtr->winPtr = childPtr;
+	entryPtr->x1 = x1;
+	entryPtr->y1 = y1;
+	entryPtr->x2 = x2;
+	entryPtr->y2 = y2;
+	AddIndexEntries(indexPtr, childPtr, cx, cy, x1, y1, x2, y2);
+    }
 }
 
 /*
@@ -2845,9 +3506,6 @@ printf("Tk_MoveToplevelWindow\n");
      */
 
     if (!(wmPtr->flags & WM_NEVER_MAPPED)) {
-	if (wmPtr->flags & WM_UPDATE_PENDING) {
-	    Tcl_CancelIdleCall(UpdateGeometryInfo, (ClientData) winPtr);
-	}
 	UpdateGeometryInfo((ClientData) winPtr);
     }
 }
@@ -3085,14 +3743,9 @@ printf("TkWmAddToColormapWindows\n");
      * Now we need to force the updated colormaps to be installed.
      */
 
-    if (topPtr->wmInfoPtr == foregroundWmPtr) {
-        TkOS2WmInstallColormaps(TkOS2GetHWND(topPtr->wmInfoPtr->reparent),
-/* WM_QUERYNEWPALETTE -> WM_REALIZEPALETTE + focus notification */
-                WM_REALIZEPALETTE, 1);
-    } else {
-        TkOS2WmInstallColormaps(TkOS2GetHWND(topPtr->wmInfoPtr->reparent),
-/* WM_PALETTECHANGED -> WM_REALIZEPALETTE + focus notification */
-                WM_REALIZEPALETTE, 0);
+    if (!(topPtr->wmInfoPtr->flags & WM_COLORMAPS_PENDING)) {
+        topPtr->wmInfoPtr->flags |= WM_COLORMAPS_PENDING;
+        Tcl_DoWhenIdle(InstallColormapsIdle, (ClientData) topPtr);
     }
 }
 
@@ -3310,6 +3963,13 @@ pos->x, pos->y, pos->cx, pos->cy, x11y, pos->fl);
      * Update the shape of the contained window.
      */
 
+    if ((width != winPtr->changes.width)
+	    || (height != winPtr->changes.height)) {
+	TkOS2WindowIndexChanged(winPtr);
+    }
+    if ((pos->x != winPtr->changes.x) || ((int) x11y != winPtr->changes.y)) {
+	TkOS2RootCoordsChanged();
+    }
     winPtr->changes.x = pos->x;
     winPtr->changes.y = x11y;
     winPtr->changes.width = width;
@@ -3487,6 +4147,7 @@ printf("TkOS2WmInstallColormap\n");
     }
     i = 1;
 
+    TkOS2SyncPalette(winPtr->atts.colormap);
     oldPalette = GpiSelectPalette(hps, TkOS2GetPalette(winPtr->atts.colormap));
     if ( WinRealizePalette(hwnd, hps, &colorsChanged) > 0 ) {
         RefreshColormap(winPtr->atts.colormap);
@@ -3500,6 +4161,7 @@ HPS winPS;
         }
 */
 winPS = WinGetPS(TkOS2GetHWND(winPtr->window));
+        TkOS2SyncPalette(winPtr->atts.colormap);
         GpiSelectPalette(winPS, TkOS2GetPalette(winPtr->atts.colormap));
         if ( WinRealizePalette(TkOS2GetHWND(winPtr->window), winPS, &colorsChanged) > 0 ) {
         }
@@ -3510,6 +4172,111 @@ WinReleasePS(winPS);
     return TRUE;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * InstallColormapsIdle --
+ *
+ *	Installs the colormaps of a toplevel after its list of colormap
+ *	windows changed.  Invoked as a when-idle handler, so several
+ *	changes in a row cause a single palette realization.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May change the system palette and generate damage.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+InstallColormapsIdle(clientData)
+    ClientData clientData;	/* Toplevel whose colormaps changed. */
+{
+    TkWindow *winPtr = (TkWindow *) clientData;
+    WmInfo *wmPtr = winPtr->wmInfoPtr;
+
+    wmPtr->flags &= ~WM_COLORMAPS_PENDING;
+    if (wmPtr->reparent == None) {
+	return;
+    }
+    /*
+     * WM_QUERYNEWPALETTE -> WM_REALIZEPALETTE + focus notification
+     * WM_PALETTECHANGED -> WM_REALIZEPALETTE + focus notification
+     */
+    TkOS2WmInstallColormaps(TkOS2GetHWND(wmPtr->reparent), WM_REALIZEPALETTE,
+	    (wmPtr == foregroundWmPtr) ? 1 : 0);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2WmRealizeColormap --
+ *
+ *	Realizes a colormap whose entries changed, once in each mapped
+ *	toplevel that uses it, and generates damage for the windows
+ *	using it if the system palette changed.  Called from the idle
+ *	handler that tkOS2Color.c schedules for stale colormaps.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May change the system palette and generate damage.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2WmRealizeColormap(colormap)
+    Colormap colormap;
+{
+    WmInfo *wmPtr;
+    TkWindow *winPtr;
+    HWND hwnd;
+    HPS hps;
+    HPAL oldPalette;
+    ULONG colorsChanged;
+    int i, uses;
+
+#ifdef DEBUG
+printf("TkOS2WmRealizeColormap %x\n", colormap);
+#endif
+
+    for (wmPtr = firstWmPtr; wmPtr != NULL; wmPtr = wmPtr->nextPtr) {
+        winPtr = wmPtr->winPtr;
+        if (!Tk_IsMapped(winPtr) || wmPtr->reparent == None) {
+            continue;
+        }
+        uses = (winPtr->atts.colormap == colormap);
+        for (i = 0; !uses && i < wmPtr->cmapCount; i++) {
+            uses = (wmPtr->cmapList[i]->atts.colormap == colormap);
+        }
+        if (!uses) {
+            continue;
+        }
+
+        hwnd = TkOS2GetHWND(wmPtr->reparent);
+        hps = WinGetPS(hwnd);
+        oldPalette = GpiSelectPalette(hps, TkOS2GetPalette(colormap));
+        if (WinRealizePalette(hwnd, hps, &colorsChanged) > 0) {
+            if (wmPtr->cmapCount > 0) {
+                for (i = 0; i < wmPtr->cmapCount; i++) {
+                    if ((wmPtr->cmapList[i]->atts.colormap == colormap)
+                            && Tk_IsMapped(wmPtr->cmapList[i])) {
+                        InvalidateSubTree(wmPtr->cmapList[i], colormap);
+                    }
+                }
+            } else {
+                InvalidateSubTree(winPtr, colormap);
+            }
+        }
+        GpiSelectPalette(hps, oldPalette);
+        WinReleasePS(hps);
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -3590,7 +4357,7 @@ printf("InvalidateSubTree win %x, cmap %x\n", winPtr, colormap);
 #endif
 
     if (winPtr->atts.colormap == colormap) {
-        WinInvalidateRect(TkOS2GetHWND(winPtr->window), NULL, FALSE);
+        TkOS2InvalidateWindow(winPtr);
     }
 /*** 
 /***     for (childPtr = winPtr->childList; childPtr != NULL;
@@ -28,19 +28,276 @@ extern void             TclOS2FlushEvents _ANSI_ARGS_((void));
  */
 
 static Display *os2Display;	/* Display that represents OS/2 PM screen. */
-static Tcl_HashTable windowTable;
-				/* Table of child windows indexed by handle. */
+
+/*
+ * Table of the windows created by Tk, indexed by handle.  Lookups happen
+ * several times for every pointer event, so instead of a Tcl_HashTable
+ * this is an open-addressed table with the handles stored inline and
+ * linear probing, kept between 1/8 and 1/2 full.  Removing an entry
+ * moves later entries of its probe sequence back, so there are no
+ * deleted markers to skip.  The last handle found is remembered
+ * separately, since the same window is usually looked up several times
+ * in a row.
+ */
+
+typedef struct {
+    HWND hwnd;			/* NULLHANDLE if the slot is free. */
+    TkOS2Drawable *todPtr;	/* Drawable of the window. */
+} WindowSlot;
+
+#define MIN_WINDOW_BITS	6	/* Smallest table has 64 slots. */
+
+static WindowSlot *windowSlots = NULL;
+				/* The table. */
+static int windowBits;		/* The table has 1 << windowBits slots. */
+static int numWindows;		/* Number of slots in use. */
+static HWND lastHwnd = NULLHANDLE;
+static TkOS2Drawable *lastTodPtr = NULL;
+				/* Result of the last successful lookup. */
+
+/*
+ * Fibonacci hashing: window handles tend to differ in the low bits only,
+ * so multiply to spread those over the bits that are used.
+ */
+
+#define WINDOW_INDEX(hwnd) \
+	((int) ((((unsigned long) (hwnd) * 2654435769UL) & 0xffffffffUL) \
+	    >> (32 - windowBits)))
 static char os2ScreenName[] = "PM:0";
                                 /* Default name of OS2 display. */
 static ATOM topLevelAtom, childAtom;
                                 /* Atoms for the classes registered by Tk. */
 
+/*
+ * Motion compression.  A MotionNotify translated from WM_MOUSEMOVE is
+ * held back in pendingMotion instead of being passed to
+ * TkOS2PointerEvent (and queued) at once.  If the next event is another
+ * motion event for the same window with the same button and modifier
+ * state, it simply replaces the held one, so a fast drag costs one
+ * UpdateMousePosition and one binding invocation per pass of the
+ * notifier instead of one per WM_MOUSEMOVE.  Any other event flushes the
+ * held one first, so the order of events is kept, and the check
+ * procedure of our event source flushes it before Tcl services the
+ * event queue.
+ */
+
+static int motionCompression = 1;
+				/* 0 means pass on every motion event. */
+static XEvent pendingMotion;	/* Motion event held back. */
+static TkWindow *pendingMotionWinPtr = NULL;
+				/* Window pendingMotion was reported to, or
+				 * NULL if no event is held back. */
+static int pendingMotionTimed = 0;
+				/* 1 if a WM_MOUSEMOVE behind pendingMotion
+				 * was timed, see QueueLatencyStamp. */
+static double pendingMotionStart;
+				/* When the oldest such message came. */
+static TkOS2MotionStats motionStats;
+
+/*
+ * Redraw pacing.  The area of a WM_PAINT isn't passed on as an Expose
+ * event right away: it is added to the damage recorded for the window,
+ * and the check procedure of our redraw event source presents all
+ * damage, toplevel by toplevel, at most once every frameInterval
+ * milliseconds.  All WM_PAINTs a window gets within one frame become
+ * one Expose event for their bounding box.  A frame is put off while
+ * keyboard or mouse input is waiting in the PM queue, so bindings run
+ * first, and while the widgets are still redrawing the last frame, but
+ * never for more than MAX_FRAME_DEFER intervals.  When events are
+ * serviced without waiting ("update") the damage is presented at once,
+ * so the script never runs on with areas that PM considers painted but
+ * Tk hasn't redrawn.  Pacing is off unless turned on with
+ * "os2redraw interval".
+ */
+
+#define MAX_FRAME_DEFER 4
+#define MAX_FRAME_INTERVAL 1000	/* Longest frame interval accepted, in
+				 * milliseconds. */
+
+typedef struct {
+    HWND hwnd;			/* Damaged window. */
+    HWND top;			/* Its toplevel, to group the damage. */
+    int x1, y1, x2, y2;		/* Bounding box of the damage, in X
+				 * (top-down) coordinates. */
+    int timed;			/* 1 if a WM_PAINT behind the damage was
+				 * timed, see QueueLatencyStamp. */
+    double start;		/* When the oldest such message came. */
+} Damage;
+
+static int frameInterval = 0;	/* Least milliseconds between frames, 0
+				 * means pass Expose events on at once. */
+static Damage *damage = NULL;	/* Damage not yet presented. */
+static int numDamage = 0;	/* Number of entries used in damage. */
+static int maxDamage = 0;	/* Number of entries allocated. */
+static Tcl_HashTable damageTable;
+				/* Maps a window handle to its index in
+				 * damage. */
+static int damageInitialized = 0;
+static ULONG lastPresent = 0;	/* When the last frame was presented. */
+static ULONG firstDamage;	/* When the oldest damage was recorded. */
+static ULONG deferredDamage;	/* firstDamage of the last frame counted
+				 * in redrawStats.inputDeferred. */
+static int frameDrawing = 0;	/* 1 while the widgets redraw the last
+				 * frame presented. */
+static TkOS2RedrawStats redrawStats;
+
+/*
+ * Latency tracking, off unless turned on with TkOS2SetLatencyTracking
+ * or "os2latency enable 1".  The window procedures stamp each message
+ * with the high resolution timer when they get it, and the time until
+ * they return goes into the "proc" histogram of the message type.  If
+ * TranslateEvent made Tk events from the message, an event queued
+ * behind them (QueueLatencyEvent) measures the time until Tk had
+ * handled them, for the "handled" histogram; the number of such events
+ * waiting in the queue is sampled at the same time.  A motion event held
+ * back by motion compression and the damage of a WM_PAINT held back for
+ * the next frame keep the stamp of the oldest message behind them, and
+ * the event is queued when they are finally passed on to Tk, so the
+ * "handled" time of WM_MOUSEMOVE and WM_PAINT includes the time they
+ * were held back.
+ */
+
+#define LATENCY_BUCKETS	12	/* Buckets per latency histogram. */
+#define DEPTH_BUCKETS	8	/* Buckets of queue depth: 0, 1, 2-3,
+				 * 4-7, ..., 64 and more. */
+
+static unsigned long latencyLimits[LATENCY_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000
+};				/* Upper limits of the buckets, in
+				 * microseconds; the last bucket is open. */
+
+typedef struct {
+    unsigned long count;	/* Number of samples. */
+    double total;		/* Sum of the samples. */
+    unsigned long max;		/* Largest sample. */
+    unsigned long buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+typedef struct {
+    ULONG message;		/* PM message type. */
+    LatencyHistogram proc;	/* Until the window procedure returned. */
+    LatencyHistogram handled;	/* Until Tk had handled the events. */
+} MessageLatency;
+
+typedef struct MessageStamp {
+    ULONG message;		/* Message being handled. */
+    double start;		/* When the window procedure got it. */
+    struct MessageStamp *outerPtr;
+				/* Message whose handling sent this one,
+				 * or NULL. */
+} MessageStamp;
+
+typedef struct {
+    Tcl_Event header;		/* Standard information for all events. */
+    ULONG message;		/* Message the events before were made
+				 * from. */
+    double start;		/* When the window procedure got it. */
+} LatencyEvent;
+
+static struct {
+    ULONG message;
+    char *name;
+} messageNames[] = {
+    {WM_ACTIVATE,		"WM_ACTIVATE"},
+    {WM_ADJUSTWINDOWPOS,	"WM_ADJUSTWINDOWPOS"},
+    {WM_BUTTON1DBLCLK,		"WM_BUTTON1DBLCLK"},
+    {WM_BUTTON1DOWN,		"WM_BUTTON1DOWN"},
+    {WM_BUTTON1UP,		"WM_BUTTON1UP"},
+    {WM_BUTTON2DBLCLK,		"WM_BUTTON2DBLCLK"},
+    {WM_BUTTON2DOWN,		"WM_BUTTON2DOWN"},
+    {WM_BUTTON2UP,		"WM_BUTTON2UP"},
+    {WM_BUTTON3DBLCLK,		"WM_BUTTON3DBLCLK"},
+    {WM_BUTTON3DOWN,		"WM_BUTTON3DOWN"},
+    {WM_BUTTON3UP,		"WM_BUTTON3UP"},
+    {WM_CALCVALIDRECTS,		"WM_CALCVALIDRECTS"},
+    {WM_CHAR,			"WM_CHAR"},
+    {WM_CLOSE,			"WM_CLOSE"},
+    {WM_CREATE,			"WM_CREATE"},
+    {WM_DESTROY,		"WM_DESTROY"},
+    {WM_DESTROYCLIPBOARD,	"WM_DESTROYCLIPBOARD"},
+    {WM_ERASEBACKGROUND,	"WM_ERASEBACKGROUND"},
+    {WM_MINMAXFRAME,		"WM_MINMAXFRAME"},
+    {WM_MOUSEMOVE,		"WM_MOUSEMOVE"},
+    {WM_MOVE,			"WM_MOVE"},
+    {WM_PAINT,			"WM_PAINT"},
+    {WM_QUERYTRACKINFO,		"WM_QUERYTRACKINFO"},
+    {WM_REALIZEPALETTE,		"WM_REALIZEPALETTE"},
+    {WM_RENDERFMT,		"WM_RENDERFMT"},
+    {WM_SETFOCUS,		"WM_SETFOCUS"},
+    {WM_SIZE,			"WM_SIZE"},
+    {WM_TIMER,			"WM_TIMER"},
+    {WM_TRACKFRAME,		"WM_TRACKFRAME"},
+    {WM_WINDOWPOSCHANGED,	"WM_WINDOWPOSCHANGED"},
+    {0,				NULL}
+};
+
+static int latencyTracking = 0;	/* 1 means time messages. */
+static ULONG timerFrequency = 0;
+				/* Ticks per second of the high resolution
+				 * timer, 0 until tracking is turned on. */
+static double trackingSince;	/* When the counters were started. */
+static MessageStamp *currentStamp = NULL;
+				/* Innermost message being timed. */
+static Tcl_HashTable latencyTable;
+				/* Maps a message type to its
+				 * MessageLatency. */
+static int latencyInitialized = 0;
+static unsigned long messagesTracked = 0;
+				/* Messages timed. */
+static unsigned long eventsHandled = 0;
+				/* Of those, handled as Tk events. */
+static int latencyQueued = 0;	/* LatencyEvents waiting in the queue. */
+static int maxDepth = 0;	/* Largest value of latencyQueued. */
+static unsigned long depthBuckets[DEPTH_BUCKETS];
+
 /*
  * Forward declarations of procedures used in this file.
  */
 
+static void		AddDamage _ANSI_ARGS_((HWND hwnd, TkWindow *winPtr,
+			    XEvent *eventPtr));
+static void		AddLatency _ANSI_ARGS_((LatencyHistogram *histPtr,
+			    double micros));
+static void		AddWindow _ANSI_ARGS_((HWND hwnd,
+			    TkOS2Drawable *todPtr));
+static void		AppendHistogram _ANSI_ARGS_((Tcl_Interp *interp,
+			    LatencyHistogram *histPtr));
+static void		BeginMessage _ANSI_ARGS_((MessageStamp *stampPtr,
+			    ULONG message));
 static void             DeleteWindow _ANSI_ARGS_((HWND hwnd));
+static void		EndMessage _ANSI_ARGS_((MessageStamp *stampPtr));
+static void		FlushMotion _ANSI_ARGS_((void));
+static void		FrameDoneProc _ANSI_ARGS_((ClientData clientData));
+static int		FrameQueuedProc _ANSI_ARGS_((Tcl_Event *evPtr,
+			    int flags));
+static MessageLatency *	GetMessageLatency _ANSI_ARGS_((ULONG message));
 static void 		GetTranslatedKey (XKeyEvent *xkey);
+static MRESULT		HandleChildMessage _ANSI_ARGS_((HWND hwnd,
+			    ULONG message, MPARAM param1, MPARAM param2));
+static MRESULT		HandleFrameMessage _ANSI_ARGS_((HWND hwnd,
+			    ULONG message, MPARAM param1, MPARAM param2));
+static MRESULT		HandleTopLevelMessage _ANSI_ARGS_((HWND hwnd,
+			    ULONG message, MPARAM param1, MPARAM param2));
+static int		LatencyEventProc _ANSI_ARGS_((Tcl_Event *evPtr,
+			    int flags));
+static double		LatencyNow _ANSI_ARGS_((void));
+static void		MotionCheckProc _ANSI_ARGS_((ClientData clientData,
+			    int flags));
+static void		MotionSetupProc _ANSI_ARGS_((ClientData clientData,
+			    int flags));
+static void		PresentFrame _ANSI_ARGS_((void));
+static void		QueueLatencyEvent _ANSI_ARGS_((void));
+static void		QueueLatencyStamp _ANSI_ARGS_((ULONG message,
+			    double start));
+static void		QueueMotion _ANSI_ARGS_((XEvent *eventPtr,
+			    TkWindow *winPtr));
+static void		RedrawCheckProc _ANSI_ARGS_((ClientData clientData,
+			    int flags));
+static void		RedrawSetupProc _ANSI_ARGS_((ClientData clientData,
+			    int flags));
+static void		RemoveWindow _ANSI_ARGS_((HWND hwnd));
+static void		ResetLatency _ANSI_ARGS_((void));
+static void		ResizeWindowTable _ANSI_ARGS_((int bits));
 static void 		TranslateEvent (HWND hwnd, ULONG message,
 			    MPARAM param1, MPARAM param2);
 
@@ -298,7 +555,9 @@ XOpenDisplay(display_name)
 
     TkOS2PointerInit();
 
-    Tcl_InitHashTable(&windowTable, TCL_ONE_WORD_KEYS);
+    if (windowSlots == NULL) {
+	ResizeWindowTable(MIN_WINDOW_BITS);
+    }
 
     if (os2Display != NULL) {
 #ifdef DEBUG
@@ -356,6 +615,9 @@ XOpenDisplay(display_name)
     todPtr->type = TOD_WINDOW;
     todPtr->window.winPtr = NULL;
     todPtr->window.handle = HWND_DESKTOP;
+    todPtr->window.flags = 0;
+    todPtr->window.rootGeneration = 0;
+    todPtr->window.lightChildren = 0;
     screen->root = (Window)todPtr;
 
     screen->root_depth = aDevCaps[CAPS_COLOR_BITCOUNT];
@@ -414,6 +676,11 @@ XOpenDisplay(display_name)
     screen->cmap = XCreateColormap(os2Display, None, screen->root_visual,
 	    AllocNone);
 
+    Tcl_CreateEventSource(MotionSetupProc, MotionCheckProc,
+	    (ClientData) NULL);
+    Tcl_CreateEventSource(RedrawSetupProc, RedrawCheckProc,
+	    (ClientData) NULL);
+
     return os2Display;
 }
 
@@ -442,8 +709,25 @@ XBell(display, percent)
 }
 
 
-MRESULT EXPENTRY
-TkOS2FrameProc(hwnd, message, param1, param2)
+/*
+ *----------------------------------------------------------------------
+ *
+ * HandleFrameMessage --
+ *
+ *	Handles a message for the decorative frame of a top level
+ *	window, see TkOS2FrameProc.
+ *
+ * Results:
+ *	Standard OS/2 PM return value.
+ *
+ * Side effects:
+ *	Default frame behavior.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static MRESULT
+HandleFrameMessage(hwnd, message, param1, param2)
     HWND hwnd;
     ULONG message;
     MPARAM param1;
@@ -478,8 +762,6 @@ return CVR_REDRAW;
 	    CREATESTRUCT *info = (CREATESTRUCT *) PVOIDFROMMP(param2);
 */
             TkOS2Drawable *todPtr = (TkOS2Drawable *) PVOIDFROMMP(param1);
-	    Tcl_HashEntry *hPtr;
-	    int new;
 	    BOOL rc;
 #ifdef DEBUG
 printf("FrameProc: WM_CREATE hwnd %x, tod %x\n", hwnd, todPtr);
@@ -490,11 +772,7 @@ printf("FrameProc: WM_CREATE hwnd %x, tod %x\n", hwnd, todPtr);
 	     */
 
             todPtr->window.handle = hwnd;
-	    hPtr = Tcl_CreateHashEntry(&windowTable, (char *)hwnd, &new);
-	    if (!new) {
-		panic("Duplicate window handle: %p", hwnd);
-	    }
-	    Tcl_SetHashValue(hPtr, todPtr);
+	    AddWindow(hwnd, todPtr);
 
 	    /*
 	     * Store the pointer to the drawable structure passed into
@@ -670,7 +948,14 @@ printf("FrameProc: WM_SYSCOMMAND\n");
 	case WM_BUTTON1UP:
 	case WM_BUTTON2UP:
 	case WM_BUTTON3UP:
+            break;
+
 	case WM_MOUSEMOVE:
+	    /*
+	     * The pointer is on the frame itself, so it is outside of
+	     * the Tk window.
+	     */
+	    TkOS2PointerLeft(hwnd);
             break;
 
 	case WM_CHAR:
@@ -736,10 +1021,9 @@ printf("FrameProc: WM_DESTROYCLIPBOARD hwnd %x\n", hwnd);
 /*
  *----------------------------------------------------------------------
  *
- * TkOS2TopLevelProc --
+ * HandleTopLevelMessage --
  *
- *	Callback from Presentation Manager whenever an event occurs on a
- *	top level window.
+ *	Handles a message for a top level window, see TkOS2TopLevelProc.
  *
  * Results:
  *	Standard OS/2 PM return value.
@@ -750,8 +1034,8 @@ printf("FrameProc: WM_DESTROYCLIPBOARD hwnd %x\n", hwnd);
  *----------------------------------------------------------------------
  */
 
-MRESULT EXPENTRY
-TkOS2TopLevelProc(hwnd, message, param1, param2)
+static MRESULT
+HandleTopLevelMessage(hwnd, message, param1, param2)
     HWND hwnd;
     ULONG message;
     MPARAM param1;
@@ -779,8 +1063,6 @@ TkOS2TopLevelProc(hwnd, message, param1, param2)
 	    CREATESTRUCT *info = (CREATESTRUCT *) PVOIDFROMMP(param2);
 */
             TkOS2Drawable *todPtr = (TkOS2Drawable *) PVOIDFROMMP(param1);
-	    Tcl_HashEntry *hPtr;
-	    int new;
 	    BOOL rc;
 #ifdef DEBUG
 printf("Toplevel: WM_CREATE hwnd %x, tod %x\n", hwnd, todPtr);
@@ -791,11 +1073,7 @@ printf("Toplevel: WM_CREATE hwnd %x, tod %x\n", hwnd, todPtr);
 	     */
 
             todPtr->window.handle = hwnd;
-	    hPtr = Tcl_CreateHashEntry(&windowTable, (char *)hwnd, &new);
-	    if (!new) {
-		panic("Duplicate window handle: %p", hwnd);
-	    }
-	    Tcl_SetHashValue(hPtr, todPtr);
+	    AddWindow(hwnd, todPtr);
 
 	    /*
 	     * Store the pointer to the drawable structure passed into
@@ -982,10 +1260,9 @@ printf("Toplevel: WM_DESTROYCLIPBOARD hwnd %x\n", hwnd);
 /*
  *----------------------------------------------------------------------
  *
- * TkOS2ChildProc --
+ * HandleChildMessage --
  *
- *	Callback from Presentation Manager whenever an event occurs on
- *	a child window.
+ *	Handles a message for a child window, see TkOS2ChildProc.
  *
  * Results:
  *	Standard OS/2 PM return value.
@@ -996,8 +1273,8 @@ printf("Toplevel: WM_DESTROYCLIPBOARD hwnd %x\n", hwnd);
  *----------------------------------------------------------------------
  */
 
-MRESULT EXPENTRY
-TkOS2ChildProc(hwnd, message, param1, param2)
+static MRESULT
+HandleChildMessage(hwnd, message, param1, param2)
     HWND hwnd;
     ULONG message;
     MPARAM param1;
@@ -1012,8 +1289,6 @@ printf("ChildProc: WM_TRACKFRAME\n");
             break;
 	case WM_CREATE: {
 	    CREATESTRUCT *info = (CREATESTRUCT *) PVOIDFROMMP(param2);
-	    Tcl_HashEntry *hPtr;
-	    int new;
 #ifdef DEBUG
 printf("Child: WM_CREATE hwnd %x, info %x\n", hwnd, info);
 #endif
@@ -1022,11 +1297,7 @@ printf("Child: WM_CREATE hwnd %x, info %x\n", hwnd, info);
 	     * Add the window and handle to the window table.
 	     */
 
-	    hPtr = Tcl_CreateHashEntry(&windowTable, (char *)hwnd, &new);
-	    if (!new) {
-		panic("Duplicate window handle: %p", hwnd);
-	    }
-	    Tcl_SetHashValue(hPtr, info->pCtlData);
+	    AddWindow(hwnd, (TkOS2Drawable *) info->pCtlData);
 
 	    /*
 	     * Store the pointer to the drawable structure passed into
@@ -1117,7 +1388,6 @@ printf("Child: WM_BUTTON1UP\n");
 	    TranslateEvent(hwnd, WM_BUTTON3UP, param1, param2);
 	    break;
 
-
 	case WM_CLOSE:
 	    /*
 	     * The frame sends the WM_CLOSE to the client (child) if it exists,
@@ -1256,6 +1526,11 @@ event.xexpose.x, event.xexpose.y, event.xexpose.width, event.xexpose.height);
 /*
 */
 	    event.xexpose.count = 0;
+	    redrawStats.paints++;
+	    if (frameInterval > 0) {
+		AddDamage(hwnd, winPtr, &event);
+		return;
+	    }
 	    break;
 	}
 
@@ -1500,10 +1775,33 @@ printf("charcode %x\n", charcode);
 	    	    }
 	    }
 
-	    if ((event.type == MotionNotify)
-		    || (event.type == ButtonPress)
+	    /*
+	     * Pointer events go to the lightweight window under the
+	     * pointer, if there is one.
+	     */
+
+	    if ((event.type == MotionNotify) || (event.type == ButtonPress)
+		    || (event.type == ButtonRelease)) {
+		int x = event.xbutton.x, y = event.xbutton.y;
+		TkWindow *lightPtr = TkOS2LightweightAt(winPtr, &x, &y);
+
+		if (lightPtr != winPtr) {
+		    winPtr = lightPtr;
+		    event.xbutton.window = winPtr->window;
+		    event.xbutton.x = x;
+		    event.xbutton.y = y;
+		}
+	    }
+
+	    if (event.type == MotionNotify) {
+		QueueMotion(&event, winPtr);
+		return;
+	    }
+	    FlushMotion();
+	    if ((event.type == ButtonPress)
 		    || (event.type == ButtonRelease)) {
 		TkOS2PointerEvent(&event, winPtr);
+		QueueLatencyEvent();
 		return;
 	    }
 	    break;
@@ -1512,246 +1810,1764 @@ printf("charcode %x\n", charcode);
 	default:
 	    return;
     }
+    FlushMotion();
     Tk_QueueWindowEvent(&event, TCL_QUEUE_TAIL);
+    if (event.type == Expose) {
+	TkOS2ExposeLightweight(winPtr, &event);
+    }
+    QueueLatencyEvent();
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * TkOS2GetModifierState --
+ * QueueMotion --
  *
- *	This function constructs a state mask for the mouse buttons 
- *	and modifier keys.
+ *	Pass on a motion event, or hold it back in the hope that the
+ *	next event replaces it.  See the comment at pendingMotion.
  *
  * Results:
- *	Returns a composite value of all the modifier and button state
- *	flags that were set at the time the event occurred.
+ *	None.
  *
  * Side effects:
- *	None.
+ *	May flush or replace the motion event held back before.
  *
  *----------------------------------------------------------------------
  */
 
-unsigned int
-TkOS2GetModifierState(message, param1, param2)
-    ULONG message;		/* OS/2 PM message type */
-    MPARAM param1;		/* param1 of message, used if key message */
-    MPARAM param2;		/* param2 of message, used if key message */
+static void
+QueueMotion(eventPtr, winPtr)
+    XEvent *eventPtr;		/* MotionNotify to pass on. */
+    TkWindow *winPtr;		/* Window it was reported to. */
 {
-    unsigned int state = 0;	/* accumulated state flags */
-    int isKeyEvent = 0;		/* 1 if message is a key press or release */
-    int prevState = 0;		/* 1 if key was previously down */
-    USHORT flags= SHORT1FROMMP(param1);
-    UCHAR krepeat= CHAR3FROMMP(param1);
-    UCHAR scancode= CHAR4FROMMP(param1);
-    USHORT charcode= SHORT1FROMMP(param2);
-    USHORT vkeycode= SHORT2FROMMP(param2); /* function key */
-
-#ifdef DEBUG
-printf("TkOS2GetModifierState fl %x, krepeat %d, scan %x, char %d, VK %x\n",
-flags, krepeat, scancode, charcode, vkeycode);
-#endif
-    /*
-     * If the event is a key press or release, we check for autorepeat.
-     */
-    if ( (flags & KC_CHAR) || (flags & KC_VIRTUALKEY) ) {
-	isKeyEvent = TRUE;
-	prevState = flags & KC_PREVDOWN;
-#ifdef DEBUG
-printf("    isKeyEvent\n");
-#endif
+    TkOS2Drawable *todPtr = (TkOS2Drawable *) winPtr->window;
+
+    motionStats.motionEvents++;
+    if (pendingMotionWinPtr != NULL) {
+	if ((pendingMotionWinPtr == winPtr)
+		&& (pendingMotion.xmotion.state == eventPtr->xmotion.state)) {
+	    motionStats.collapsed++;
+	    pendingMotionWinPtr = NULL;
+	} else {
+	    FlushMotion();
+	}
     }
 
-    /*
-     * If the key being pressed or released is a modifier key, then
-     * we use its previous state, otherwise we look at the current state.
-     */
-
-    if (isKeyEvent && (vkeycode == VK_SHIFT)) {
-	state |= prevState ? ShiftMask : 0;
-    } else {
-	state |= (WinGetKeyState(HWND_DESKTOP, VK_SHIFT) & 0x8000)
-	         ? ShiftMask : 0;
-    }
-    if (isKeyEvent && (vkeycode == VK_CTRL)) {
-	state |= prevState ? ControlMask : 0;
-    } else {
-	state |= (WinGetKeyState(HWND_DESKTOP, VK_CTRL) & 0x8000)
-	         ? ControlMask : 0;
-    }
-    if (isKeyEvent && (vkeycode == VK_ALT)) {
-	state |= prevState ? Mod1Mask : 0;
-    } else {
-	state |= (WinGetKeyState(HWND_DESKTOP, VK_ALT) & 0x8000)
-	         ? Mod1Mask : 0;
+    if (!motionCompression || (todPtr->window.flags & TOD_ALL_MOTION)) {
+	motionStats.delivered++;
+	TkOS2PointerEvent(eventPtr, winPtr);
+	QueueLatencyEvent();
+	return;
     }
-    if (isKeyEvent && (vkeycode == VK_MENU)) {
-	state |= prevState ? Mod2Mask : 0;
-    } else {
-	state |= (WinGetKeyState(HWND_DESKTOP, VK_MENU) & 0x8000)
-	         ? Mod2Mask : 0;
+    pendingMotion = *eventPtr;
+    pendingMotionWinPtr = winPtr;
+    if (!pendingMotionTimed && (currentStamp != NULL)) {
+	pendingMotionTimed = 1;
+	pendingMotionStart = currentStamp->start;
     }
+}
 
-    /*
-     * For toggle keys, we have to check both the previous key state
-     * and the current toggle state.  The result is the state of the
-     * toggle before the event.
-     */
-
-    if ((vkeycode == VK_CAPSLOCK) && !( flags & KC_KEYUP)) {
-	state = (prevState ^ (WinGetKeyState(HWND_DESKTOP, VK_CAPSLOCK) & 0x0001))
-	        ? 0 : LockMask;
-    } else {
-	state |= (WinGetKeyState(HWND_DESKTOP, VK_CAPSLOCK) & 0x0001)
-	         ? LockMask : 0;
-    }
-    if ((vkeycode == VK_NUMLOCK) && !( flags & KC_KEYUP)) {
-	state = (prevState ^ (WinGetKeyState(HWND_DESKTOP, VK_NUMLOCK) & 0x0001))
-	        ? 0 : Mod1Mask;
-    } else {
-	state |= (WinGetKeyState(HWND_DESKTOP, VK_NUMLOCK) & 0x0001)
-	         ? Mod1Mask : 0;
-    }
-    if ((vkeycode == VK_SCRLLOCK) && !( flags & KC_KEYUP)) {
-	state = (prevState ^ (WinGetKeyState(HWND_DESKTOP, VK_SCRLLOCK) & 0x0001))
-	        ? 0 : Mod3Mask;
-    } else {
-	state |= (WinGetKeyState(HWND_DESKTOP, VK_SCRLLOCK) & 0x0001)
-	         ? Mod3Mask : 0;
-    }
+/*
+ *----------------------------------------------------------------------
+ *
+ * FlushMotion --
+ *
+ *	Pass the motion event held back by QueueMotion, if any, on to
+ *	TkOS2PointerEvent.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May queue events.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    /*
-     * If a mouse button is being pressed or released, we use the previous
-     * state of the button.
-     */
+static void
+FlushMotion()
+{
+    TkWindow *winPtr = pendingMotionWinPtr;
+    int timed = pendingMotionTimed;
 
-    if (message == WM_BUTTON1UP || (message != WM_BUTTON1DOWN
-	    && WinGetKeyState(HWND_DESKTOP, VK_BUTTON1) & 0x8000)) {
-	state |= Button1Mask;
-    }
-    if (message == WM_BUTTON2UP || (message != WM_BUTTON2DOWN
-	    && WinGetKeyState(HWND_DESKTOP, VK_BUTTON2) & 0x8000)) {
-	state |= Button2Mask;
+    if (winPtr == NULL) {
+	return;
     }
-    if (message == WM_BUTTON3UP || (message != WM_BUTTON3DOWN
-	    && WinGetKeyState(HWND_DESKTOP, VK_BUTTON3) & 0x8000)) {
-	state |= Button3Mask;
+    pendingMotionWinPtr = NULL;
+    pendingMotionTimed = 0;
+    if (winPtr->window != None) {
+	motionStats.delivered++;
+	TkOS2PointerEvent(&pendingMotion, winPtr);
+	if (timed) {
+	    QueueLatencyStamp(WM_MOUSEMOVE, pendingMotionStart);
+	}
     }
-#ifdef DEBUG
-printf("    returning state %x\n", state);
-#endif
-    return state;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * GetTranslatedKey --		NOT USED
+ * MotionSetupProc --
  *
- *	Retrieves WM_CHAR messages that are placed on the system queue
- *	by the TranslateMessage system call and places them in the
- *	given KeyPress event.
+ *	Event source setup procedure: don't let the notifier block
+ *	while a motion event is held back.
  *
  * Results:
- *	Sets the trans_chars and nchars member of the key event.
+ *	None.
  *
  * Side effects:
- *	Removes any WM_CHAR messages waiting on the top of the system
- *	event queue.
+ *	May set the maximum block time to zero.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-GetTranslatedKey(xkey)
-    XKeyEvent *xkey;
+MotionSetupProc(clientData, flags)
+    ClientData clientData;	/* Not used. */
+    int flags;
 {
-    QMSG msg;
-    
-    xkey->nchars = 0;
+    static Tcl_Time dontBlock = {0, 0};
 
-    while (xkey->nchars < XMaxTransChars
-	    && WinPeekMsg(hab, &msg, NULLHANDLE, 0, 0, PM_NOREMOVE)) {
-/* WM_SYSCHAR not in PM
-	if ((msg.msg == WM_CHAR) || msg.msg == WM_SYSCHAR) {
-*/
-	if ((msg.msg == WM_CHAR)) {
-	    xkey->trans_chars[xkey->nchars] = SHORT1FROMMP(msg.mp2);
-	    xkey->nchars++;
-	    WinGetMsg(hab, &msg, NULLHANDLE, 0, 0);
-            if ((msg.msg == WM_CHAR) && ((LONG)msg.mp2 & 0x20000000)) {
-                xkey->state = 0;
-            }
-	} else {
-	    break;
-	}
+    if (pendingMotionWinPtr != NULL) {
+	Tcl_SetMaxBlockTime(&dontBlock);
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * TkOS2GetDrawableFromHandle --
+ * MotionCheckProc --
  *
- *	Find the drawable associated with the given window handle.
+ *	Event source check procedure: called after the notifier has
+ *	dispatched the PM messages that were waiting, it queues the
+ *	motion event held back, if any.
  *
  * Results:
- *	Returns a drawable pointer if the window is managed by Tk.
- *	Otherwise it returns NULL.
+ *	None.
  *
  * Side effects:
- *	None.
+ *	May queue events.
  *
  *----------------------------------------------------------------------
  */
 
-TkOS2Drawable *
-TkOS2GetDrawableFromHandle(hwnd)
-    HWND hwnd;			/* OS/2 PM window handle */
+static void
+MotionCheckProc(clientData, flags)
+    ClientData clientData;	/* Not used. */
+    int flags;
 {
-    Tcl_HashEntry *hPtr;
-
-    hPtr = Tcl_FindHashEntry(&windowTable, (char *)hwnd);
-    if (hPtr) {
-	return (TkOS2Drawable *)Tcl_GetHashValue(hPtr);
-    }
-    return NULL;
+    FlushMotion();
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * DeleteWindow --
+ * TkOS2SetMotionCompression --
  *
- *      Remove a window from the window table, and free the resources
- *      associated with the drawable.
+ *	Turn motion compression on or off, either for one window or,
+ *	if tkwin is NULL, for the whole application.  Drawing programs
+ *	that want every mouse position a window gets can turn it off
+ *	for that window only.
  *
  * Results:
- *      None.
+ *	Returns the previous setting: 1 if motion events were being
+ *	compressed, 0 if not.
  *
  * Side effects:
- *      Frees the resources associated with a window handle.
+ *	Changes which motion events are collapsed.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-DeleteWindow(hwnd)
-    HWND hwnd;
+int
+TkOS2SetMotionCompression(tkwin, compress)
+    Tk_Window tkwin;		/* Window to change, or NULL. */
+    int compress;		/* 0 to report every motion event. */
 {
     TkOS2Drawable *todPtr;
-    Tcl_HashEntry *hPtr;
+    int old;
 
-    /*
-     * Remove the window from the window table.
-     */
-
-    hPtr = Tcl_FindHashEntry(&windowTable, (char *)hwnd);
-    if (hPtr) {
-        Tcl_DeleteHashEntry(hPtr);
+    if (tkwin == NULL) {
+	old = motionCompression;
+	motionCompression = compress;
+    } else {
+	Tk_MakeWindowExist(tkwin);
+	todPtr = (TkOS2Drawable *) Tk_WindowId(tkwin);
+	old = !(todPtr->window.flags & TOD_ALL_MOTION);
+	if (compress) {
+	    todPtr->window.flags &= ~TOD_ALL_MOTION;
+	} else {
+	    todPtr->window.flags |= TOD_ALL_MOTION;
+	}
     }
-
+    if (!compress) {
+	FlushMotion();
+    }
+    return old;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GetMotionStats --
+ *
+ *	Report how many motion events were collapsed.
+ *
+ * Results:
+ *	Fills in *statsPtr.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2GetMotionStats(statsPtr)
+    TkOS2MotionStats *statsPtr;
+{
+    *statsPtr = motionStats;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2MotionCmd --
+ *
+ *	This procedure is invoked to process the "os2motion" Tcl
+ *	command:
+ *
+ *	    os2motion compress ?pathName? ?boolean?
+ *	    os2motion stats
+ *	    os2motion reset
+ *
+ *	"compress" turns motion compression on or off for the whole
+ *	application, or for one window if a path name is given, and
+ *	returns the setting.  Drawing programs that need every mouse
+ *	position can turn it off for their canvas.
+ *
+ * Results:
+ *	A standard Tcl result.  "stats" returns a list of names and
+ *	values.
+ *
+ * Side effects:
+ *	See the user documentation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2MotionCmd(clientData, interp, argc, argv)
+    ClientData clientData;	/* Not used. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings. */
+{
+    Tk_Window tkwin = NULL;
+    TkOS2Drawable *todPtr;
+    char string[200];
+    size_t length;
+    int c, index, compress;
+
+    if (argc < 2) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" option ?arg ...?\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+    c = argv[1][0];
+    length = strlen(argv[1]);
+    if ((c == 'c') && (strncmp(argv[1], "compress", length) == 0)) {
+	index = 2;
+	if ((index < argc) && (argv[index][0] == '.')) {
+	    tkwin = Tk_NameToWindow(interp, argv[index],
+		    Tk_MainWindow(interp));
+	    if (tkwin == NULL) {
+		return TCL_ERROR;
+	    }
+	    index++;
+	}
+	if (index + 1 < argc) {
+	    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		    " compress ?pathName? ?boolean?\"", (char *) NULL);
+	    return TCL_ERROR;
+	}
+	if (index < argc) {
+	    if (Tcl_GetBoolean(interp, argv[index], &compress) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    TkOS2SetMotionCompression(tkwin, compress);
+	}
+	if (tkwin == NULL) {
+	    compress = motionCompression;
+	} else if (Tk_WindowId(tkwin) == None) {
+	    compress = 1;
+	} else {
+	    todPtr = (TkOS2Drawable *) Tk_WindowId(tkwin);
+	    compress = !(todPtr->window.flags & TOD_ALL_MOTION);
+	}
+	Tcl_AppendResult(interp, compress ? "1" : "0", (char *) NULL);
+    } else if ((c == 'r') && (strncmp(argv[1], "reset", length) == 0)) {
+	memset((char *) &motionStats, 0, sizeof(motionStats));
+    } else if ((c == 's') && (strncmp(argv[1], "stats", length) == 0)) {
+	sprintf(string, "compress %d motionEvents %lu collapsed %lu "
+		"delivered %lu", motionCompression, motionStats.motionEvents,
+		motionStats.collapsed, motionStats.delivered);
+	Tcl_AppendResult(interp, string, (char *) NULL);
+    } else {
+	Tcl_AppendResult(interp, "bad option \"", argv[1],
+		"\": must be compress, reset, or stats", (char *) NULL);
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddDamage --
+ *
+ *	Record the area of a WM_PAINT, to be passed on as an Expose
+ *	event with the next frame, see PresentFrame.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Grows the damage recorded for the window.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AddDamage(hwnd, winPtr, eventPtr)
+    HWND hwnd;			/* Window that got the WM_PAINT. */
+    TkWindow *winPtr;		/* Tk window for hwnd. */
+    XEvent *eventPtr;		/* Expose event for the painted area. */
+{
+    Damage *damagePtr;
+    Tcl_HashEntry *hPtr;
+    TkWindow *topPtr;
+    int x2, y2, new;
+
+    if (!damageInitialized) {
+	Tcl_InitHashTable(&damageTable, TCL_ONE_WORD_KEYS);
+	damageInitialized = 1;
+    }
+    x2 = eventPtr->xexpose.x + eventPtr->xexpose.width;
+    y2 = eventPtr->xexpose.y + eventPtr->xexpose.height;
+    hPtr = Tcl_CreateHashEntry(&damageTable, (char *) hwnd, &new);
+    if (!new) {
+	damagePtr = &damage[(int) Tcl_GetHashValue(hPtr)];
+	if (eventPtr->xexpose.x < damagePtr->x1) {
+	    damagePtr->x1 = eventPtr->xexpose.x;
+	}
+	if (eventPtr->xexpose.y < damagePtr->y1) {
+	    damagePtr->y1 = eventPtr->xexpose.y;
+	}
+	if (x2 > damagePtr->x2) {
+	    damagePtr->x2 = x2;
+	}
+	if (y2 > damagePtr->y2) {
+	    damagePtr->y2 = y2;
+	}
+	if (!damagePtr->timed && (currentStamp != NULL)) {
+	    damagePtr->timed = 1;
+	    damagePtr->start = currentStamp->start;
+	}
+	return;
+    }
+
+    if (numDamage == maxDamage) {
+	if (damage == NULL) {
+	    maxDamage = 32;
+	    damage = (Damage *) ckalloc(maxDamage * sizeof(Damage));
+	} else {
+	    maxDamage *= 2;
+	    damage = (Damage *) ckrealloc((char *) damage,
+		    maxDamage * sizeof(Damage));
+	}
+    }
+    if (numDamage == 0) {
+	firstDamage = WinGetCurrentTime(hab);
+    }
+    for (topPtr = winPtr; !(topPtr->flags & TK_TOP_LEVEL)
+	    && (topPtr->parentPtr != NULL); topPtr = topPtr->parentPtr) {
+	/* Empty loop body. */
+    }
+    Tcl_SetHashValue(hPtr, (ClientData) numDamage);
+    damagePtr = &damage[numDamage++];
+    damagePtr->hwnd = hwnd;
+    damagePtr->top = (topPtr->window != None)
+	    ? TkOS2GetHWND(topPtr->window) : hwnd;
+    damagePtr->x1 = eventPtr->xexpose.x;
+    damagePtr->y1 = eventPtr->xexpose.y;
+    damagePtr->x2 = x2;
+    damagePtr->y2 = y2;
+    damagePtr->timed = (currentStamp != NULL);
+    if (damagePtr->timed) {
+	damagePtr->start = currentStamp->start;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PresentFrame --
+ *
+ *	Queue an Expose event for every window with recorded damage,
+ *	the windows of one toplevel after each other, and note when the
+ *	redrawing they cause is done.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Queues events; clears the recorded damage.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PresentFrame()
+{
+    TkOS2Drawable *todPtr;
+    TkWindow *winPtr;
+    Damage *damagePtr;
+    Tcl_Event *evPtr;
+    XEvent event;
+    HWND top;
+    ULONG now;
+    int i, j, toplevels, windows;
+
+    if (numDamage == 0) {
+	return;
+    }
+    now = WinGetCurrentTime(hab);
+    if (redrawStats.frames > 0) {
+	redrawStats.lastInterval = now - lastPresent;
+	if (redrawStats.lastInterval > redrawStats.maxInterval) {
+	    redrawStats.maxInterval = redrawStats.lastInterval;
+	}
+    }
+    lastPresent = now;
+    FlushMotion();
+
+    toplevels = windows = 0;
+    for (i = 0; i < numDamage; i++) {
+	top = damage[i].top;
+	if (top == NULLHANDLE) {
+	    continue;		/* Done with an earlier toplevel. */
+	}
+	toplevels++;
+	for (j = i; j < numDamage; j++) {
+	    damagePtr = &damage[j];
+	    if (damagePtr->top != top) {
+		continue;
+	    }
+	    if (j > i) {
+		damagePtr->top = NULLHANDLE;
+	    }
+
+	    /*
+	     * The window may have been destroyed since it was damaged.
+	     */
+
+	    todPtr = TkOS2GetDrawableFromHandle(damagePtr->hwnd);
+	    winPtr = (todPtr != NULL) ? TkOS2GetWinPtr(todPtr) : NULL;
+	    if ((winPtr == NULL) || (winPtr->window == None)) {
+		continue;
+	    }
+	    event.type = Expose;
+	    event.xany.serial = winPtr->display->request++;
+	    event.xany.send_event = False;
+	    event.xany.display = winPtr->display;
+	    event.xany.window = (Window) winPtr->window;
+	    event.xexpose.x = damagePtr->x1;
+	    event.xexpose.y = damagePtr->y1;
+	    event.xexpose.width = damagePtr->x2 - damagePtr->x1;
+	    event.xexpose.height = damagePtr->y2 - damagePtr->y1;
+	    event.xexpose.count = 0;
+	    Tk_QueueWindowEvent(&event, TCL_QUEUE_TAIL);
+	    TkOS2ExposeLightweight(winPtr, &event);
+	    if (damagePtr->timed) {
+		QueueLatencyStamp(WM_PAINT, damagePtr->start);
+	    }
+	    windows++;
+	}
+    }
+    numDamage = 0;
+    Tcl_DeleteHashTable(&damageTable);
+    Tcl_InitHashTable(&damageTable, TCL_ONE_WORD_KEYS);
+
+    redrawStats.frames++;
+    redrawStats.exposes += windows;
+    redrawStats.lastToplevels = toplevels;
+    redrawStats.lastWindows = windows;
+
+    /*
+     * The widgets redraw from idle handlers they create when they get
+     * the Expose events.  Queue an event behind the Expose events; when
+     * it is serviced it creates an idle handler behind theirs, which
+     * marks the end of the frame.
+     */
+
+    evPtr = (Tcl_Event *) ckalloc(sizeof(Tcl_Event));
+    evPtr->proc = FrameQueuedProc;
+    Tcl_QueueEvent(evPtr, TCL_QUEUE_TAIL);
+    frameDrawing = 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameQueuedProc --
+ *
+ *	Called when the event queued behind the Expose events of a frame
+ *	is serviced.
+ *
+ * Results:
+ *	Returns 1 if the event was handled, 0 if window events aren't
+ *	being serviced.
+ *
+ * Side effects:
+ *	Creates an idle handler.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FrameQueuedProc(evPtr, flags)
+    Tcl_Event *evPtr;		/* Event being serviced. */
+    int flags;			/* Events being serviced. */
+{
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+	return 0;
+    }
+    Tcl_DoWhenIdle(FrameDoneProc, (ClientData) NULL);
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameDoneProc --
+ *
+ *	Idle handler run after the redrawing of a frame is done.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Updates the frame statistics; allows the next frame.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FrameDoneProc(clientData)
+    ClientData clientData;	/* Not used. */
+{
+    ULONG drawTime = WinGetCurrentTime(hab) - lastPresent;
+
+    frameDrawing = 0;
+    redrawStats.framesDrawn++;
+    redrawStats.lastDraw = drawTime;
+    redrawStats.totalDraw += drawTime;
+    if (drawTime > redrawStats.maxDraw) {
+	redrawStats.maxDraw = drawTime;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RedrawSetupProc --
+ *
+ *	Event source setup procedure: don't let the notifier block
+ *	past the next frame while there is damage.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May set the maximum block time.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RedrawSetupProc(clientData, flags)
+    ClientData clientData;	/* Not used. */
+    int flags;
+{
+    Tcl_Time blockTime;
+    ULONG elapsed, wait;
+
+    if (!(flags & TCL_WINDOW_EVENTS) || (numDamage == 0)) {
+	return;
+    }
+    elapsed = WinGetCurrentTime(hab) - lastPresent;
+    wait = (elapsed >= (ULONG) frameInterval) ? 0
+	    : (ULONG) frameInterval - elapsed;
+    blockTime.sec = wait / 1000;
+    blockTime.usec = (wait % 1000) * 1000;
+    Tcl_SetMaxBlockTime(&blockTime);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RedrawCheckProc --
+ *
+ *	Event source check procedure: present the recorded damage once
+ *	the frame interval is over, unless input is waiting or the last
+ *	frame is still being drawn.  Neither can hold a frame back for
+ *	more than MAX_FRAME_DEFER intervals.  If events are serviced
+ *	without waiting, as by "update", the damage is presented at
+ *	once.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May queue Expose events.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RedrawCheckProc(clientData, flags)
+    ClientData clientData;	/* Not used. */
+    int flags;
+{
+    ULONG now;
+
+    if (!(flags & TCL_WINDOW_EVENTS) || (numDamage == 0)) {
+	return;
+    }
+    if (flags & TCL_DONT_WAIT) {
+	PresentFrame();
+	return;
+    }
+    now = WinGetCurrentTime(hab);
+    if (now - lastPresent < (ULONG) frameInterval) {
+	return;
+    }
+    if (now - firstDamage < (ULONG) (MAX_FRAME_DEFER * frameInterval)) {
+	if (frameDrawing) {
+	    return;
+	}
+	if (WinQueryQueueStatus(HWND_DESKTOP) & (QS_KEY | QS_MOUSE)) {
+	    if (firstDamage != deferredDamage) {
+		deferredDamage = firstDamage;
+		redrawStats.inputDeferred++;
+	    }
+	    return;
+	}
+    }
+    PresentFrame();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2SetFrameInterval --
+ *
+ *	Change the least time between two frames of redrawing.
+ *
+ * Results:
+ *	Returns the previous interval, in milliseconds.
+ *
+ * Side effects:
+ *	An interval of 0 turns pacing off: the damage recorded so far is
+ *	presented and later WM_PAINTs become Expose events at once.
+ *	Intervals outside 0 to MAX_FRAME_INTERVAL are clamped to that
+ *	range.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2SetFrameInterval(interval)
+    int interval;		/* Milliseconds, 0 for no pacing. */
+{
+    int old = frameInterval;
+
+    if (interval < 0) {
+	interval = 0;
+    } else if (interval > MAX_FRAME_INTERVAL) {
+	interval = MAX_FRAME_INTERVAL;
+    }
+    frameInterval = interval;
+    if (frameInterval == 0) {
+	PresentFrame();
+    }
+    redrawStats.interval = frameInterval;
+    return old;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GetRedrawStats --
+ *
+ *	Report the timing of the frames presented so far.
+ *
+ * Results:
+ *	Fills in *statsPtr.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkOS2GetRedrawStats(statsPtr)
+    TkOS2RedrawStats *statsPtr;
+{
+    *statsPtr = redrawStats;
+    statsPtr->interval = frameInterval;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2RedrawCmd --
+ *
+ *	This procedure is invoked to process the "os2redraw" Tcl
+ *	command:
+ *
+ *	    os2redraw interval ?milliseconds?
+ *	    os2redraw stats
+ *	    os2redraw reset
+ *
+ * Results:
+ *	A standard Tcl result.  "stats" returns a list of names and
+ *	values, with times in milliseconds.
+ *
+ * Side effects:
+ *	See the user documentation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2RedrawCmd(clientData, interp, argc, argv)
+    ClientData clientData;	/* Not used. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings. */
+{
+    char string[300];
+    size_t length;
+    int c, interval;
+
+    if (argc < 2) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" option ?arg?\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+    c = argv[1][0];
+    length = strlen(argv[1]);
+    if ((c == 'i') && (strncmp(argv[1], "interval", length) == 0)) {
+	if (argc > 3) {
+	    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		    " interval ?milliseconds?\"", (char *) NULL);
+	    return TCL_ERROR;
+	}
+	if (argc == 3) {
+	    if (Tcl_GetInt(interp, argv[2], &interval) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if ((interval < 0) || (interval > MAX_FRAME_INTERVAL)) {
+		sprintf(string, "%d", MAX_FRAME_INTERVAL);
+		Tcl_AppendResult(interp, "bad interval \"", argv[2],
+			"\": must be between 0 and ", string,
+			" milliseconds", (char *) NULL);
+		return TCL_ERROR;
+	    }
+	    TkOS2SetFrameInterval(interval);
+	}
+	sprintf(string, "%d", frameInterval);
+	Tcl_AppendResult(interp, string, (char *) NULL);
+    } else if ((c == 'r') && (strncmp(argv[1], "reset", length) == 0)) {
+	memset((char *) &redrawStats, 0, sizeof(redrawStats));
+    } else if ((c == 's') && (strncmp(argv[1], "stats", length) == 0)) {
+	sprintf(string, "interval %d frames %lu paints %lu exposes %lu "
+		"deferred %lu toplevels %d windows %d lastInterval %lu "
+		"maxInterval %lu lastDraw %lu maxDraw %lu avgDraw %lu",
+		frameInterval, redrawStats.frames, redrawStats.paints,
+		redrawStats.exposes, redrawStats.inputDeferred,
+		redrawStats.lastToplevels, redrawStats.lastWindows,
+		redrawStats.lastInterval, redrawStats.maxInterval,
+		redrawStats.lastDraw, redrawStats.maxDraw,
+		(redrawStats.framesDrawn > 0)
+		    ? redrawStats.totalDraw / redrawStats.framesDrawn : 0UL);
+	Tcl_AppendResult(interp, string, (char *) NULL);
+    } else {
+	Tcl_AppendResult(interp, "bad option \"", argv[1],
+		"\": must be interval, reset, or stats", (char *) NULL);
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2FrameProc, TkOS2TopLevelProc, TkOS2ChildProc --
+ *
+ *	Window procedures of the decorative frames, the top level
+ *	client windows and the child windows.  They pass the message on
+ *	to HandleFrameMessage, HandleTopLevelMessage or
+ *	HandleChildMessage, and time it if latency tracking is on.
+ *
+ * Results:
+ *	Standard OS/2 PM return value.
+ *
+ * Side effects:
+ *	Those of the message handler.
+ *
+ *----------------------------------------------------------------------
+ */
+
+MRESULT EXPENTRY
+TkOS2FrameProc(hwnd, message, param1, param2)
+    HWND hwnd;
+    ULONG message;
+    MPARAM param1;
+    MPARAM param2;
+{
+    MessageStamp stamp;
+    MRESULT result;
+
+    if (!latencyTracking) {
+	return HandleFrameMessage(hwnd, message, param1, param2);
+    }
+    BeginMessage(&stamp, message);
+    result = HandleFrameMessage(hwnd, message, param1, param2);
+    EndMessage(&stamp);
+    return result;
+}
+
+MRESULT EXPENTRY
+TkOS2TopLevelProc(hwnd, message, param1, param2)
+    HWND hwnd;
+    ULONG message;
+    MPARAM param1;
+    MPARAM param2;
+{
+    MessageStamp stamp;
+    MRESULT result;
+
+    if (!latencyTracking) {
+	return HandleTopLevelMessage(hwnd, message, param1, param2);
+    }
+    BeginMessage(&stamp, message);
+    result = HandleTopLevelMessage(hwnd, message, param1, param2);
+    EndMessage(&stamp);
+    return result;
+}
+
+MRESULT EXPENTRY
+TkOS2ChildProc(hwnd, message, param1, param2)
+    HWND hwnd;
+    ULONG message;
+    MPARAM param1;
+    MPARAM param2;
+{
+    MessageStamp stamp;
+    MRESULT result;
+
+    if (!latencyTracking) {
+	return HandleChildMessage(hwnd, message, param1, param2);
+    }
+    BeginMessage(&stamp, message);
+    result = HandleChildMessage(hwnd, message, param1, param2);
+    EndMessage(&stamp);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LatencyNow --
+ *
+ *	Read the high resolution timer.
+ *
+ * Results:
+ *	The time in microseconds since some point in the past.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static double
+LatencyNow()
+{
+    QWORD time;
+
+    DosTmrQueryTime(&time);
+    return ((double) time.ulHi * 4294967296.0 + (double) time.ulLo)
+	    * 1000000.0 / (double) timerFrequency;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BeginMessage, EndMessage --
+ *
+ *	Time a message from the moment the window procedure gets it
+ *	until it returns.  Messages sent while another one is handled
+ *	are timed separately; currentStamp is the innermost one.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	EndMessage adds the time to the "proc" histogram of the message
+ *	type.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+BeginMessage(stampPtr, message)
+    MessageStamp *stampPtr;	/* Record on the caller's stack. */
+    ULONG message;		/* Message being handled. */
+{
+    stampPtr->message = message;
+    stampPtr->start = LatencyNow();
+    stampPtr->outerPtr = currentStamp;
+    currentStamp = stampPtr;
+    messagesTracked++;
+}
+
+static void
+EndMessage(stampPtr)
+    MessageStamp *stampPtr;	/* Record passed to BeginMessage. */
+{
+    currentStamp = stampPtr->outerPtr;
+    AddLatency(&GetMessageLatency(stampPtr->message)->proc,
+	    LatencyNow() - stampPtr->start);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetMessageLatency --
+ *
+ *	Find the histograms of a message type, creating them if needed.
+ *
+ * Results:
+ *	Pointer to the histograms.
+ *
+ * Side effects:
+ *	May allocate memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static MessageLatency *
+GetMessageLatency(message)
+    ULONG message;
+{
+    MessageLatency *latencyPtr;
+    Tcl_HashEntry *hPtr;
+    int new;
+
+    if (!latencyInitialized) {
+	Tcl_InitHashTable(&latencyTable, TCL_ONE_WORD_KEYS);
+	latencyInitialized = 1;
+    }
+    hPtr = Tcl_CreateHashEntry(&latencyTable, (char *) message, &new);
+    if (!new) {
+	return (MessageLatency *) Tcl_GetHashValue(hPtr);
+    }
+    latencyPtr = (MessageLatency *) ckalloc(sizeof(MessageLatency));
+    memset((char *) latencyPtr, 0, sizeof(MessageLatency));
+    latencyPtr->message = message;
+    Tcl_SetHashValue(hPtr, (ClientData) latencyPtr);
+    return latencyPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddLatency --
+ *
+ *	Add a sample to a latency histogram.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Updates *histPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AddLatency(histPtr, micros)
+    LatencyHistogram *histPtr;
+    double micros;		/* Latency in microseconds. */
+{
+    unsigned long value = (micros > 0.0) ? (unsigned long) micros : 0;
+    int i;
+
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+	if (value < latencyLimits[i]) {
+	    break;
+	}
+    }
+    histPtr->buckets[i]++;
+    histPtr->count++;
+    histPtr->total += micros;
+    if (value > histPtr->max) {
+	histPtr->max = value;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * QueueLatencyEvent --
+ *
+ *	Called by TranslateEvent after it has queued the Tk events for
+ *	the message being timed.  Queues an event behind them, which
+ *	measures how long the message took until Tk had handled it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Queues an event; samples the number of timed events waiting.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+QueueLatencyEvent()
+{
+    if (currentStamp != NULL) {
+	QueueLatencyStamp(currentStamp->message, currentStamp->start);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * QueueLatencyStamp --
+ *
+ *	Queue the event that measures how long a message took until Tk
+ *	had handled the events made from it, for a message whose events
+ *	are queued now.  Used for messages whose events were held back,
+ *	after the window procedure returned.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Queues an event, unless tracking has been turned off since the
+ *	message came; samples the number of timed events waiting.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+QueueLatencyStamp(message, start)
+    ULONG message;		/* Message the events were made from. */
+    double start;		/* When the window procedure got it. */
+{
+    LatencyEvent *evPtr;
+    int i, depth;
+
+    if (!latencyTracking) {
+	return;
+    }
+    for (i = 0, depth = latencyQueued; (depth > 0) && (i < DEPTH_BUCKETS - 1);
+	    i++, depth >>= 1) {
+	/* Empty loop body. */
+    }
+    depthBuckets[i]++;
+    if (latencyQueued > maxDepth) {
+	maxDepth = latencyQueued;
+    }
+    latencyQueued++;
+
+    evPtr = (LatencyEvent *) ckalloc(sizeof(LatencyEvent));
+    evPtr->header.proc = LatencyEventProc;
+    evPtr->message = message;
+    evPtr->start = start;
+    Tcl_QueueEvent((Tcl_Event *) evPtr, TCL_QUEUE_TAIL);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LatencyEventProc --
+ *
+ *	Called when the event queued by QueueLatencyEvent is serviced,
+ *	that is after the Tk events in front of it have been handled.
+ *
+ * Results:
+ *	Returns 1 if the event was handled, 0 if window events aren't
+ *	being serviced.
+ *
+ * Side effects:
+ *	Adds the time to the "handled" histogram of the message type.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+LatencyEventProc(evPtr, flags)
+    Tcl_Event *evPtr;		/* Event being serviced. */
+    int flags;			/* Events being serviced. */
+{
+    LatencyEvent *latencyEvPtr = (LatencyEvent *) evPtr;
+
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+	return 0;
+    }
+    latencyQueued--;
+    eventsHandled++;
+    AddLatency(&GetMessageLatency(latencyEvPtr->message)->handled,
+	    LatencyNow() - latencyEvPtr->start);
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2SetLatencyTracking --
+ *
+ *	Turn the timing of PM messages on or off.
+ *
+ * Results:
+ *	Returns the previous setting.
+ *
+ * Side effects:
+ *	Turning tracking on the first time, or after a reset, starts
+ *	the throughput clock.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2SetLatencyTracking(track)
+    int track;			/* 1 to time messages. */
+{
+    int old = latencyTracking;
+
+    if (track && (timerFrequency == 0)) {
+	if ((DosTmrQueryFreq(&timerFrequency) != 0)
+		|| (timerFrequency == 0)) {
+	    timerFrequency = 0;
+	    return old;		/* No high resolution timer. */
+	}
+	trackingSince = LatencyNow();
+    }
+    latencyTracking = track;
+    return old;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ResetLatency --
+ *
+ *	Clear the histograms and counters.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees the histograms; restarts the throughput clock.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ResetLatency()
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+
+    if (latencyInitialized) {
+	for (hPtr = Tcl_FirstHashEntry(&latencyTable, &search); hPtr != NULL;
+		hPtr = Tcl_NextHashEntry(&search)) {
+	    ckfree((char *) Tcl_GetHashValue(hPtr));
+	}
+	Tcl_DeleteHashTable(&latencyTable);
+	Tcl_InitHashTable(&latencyTable, TCL_ONE_WORD_KEYS);
+    }
+    memset((char *) depthBuckets, 0, sizeof(depthBuckets));
+    maxDepth = 0;
+    messagesTracked = eventsHandled = 0;
+    if (timerFrequency != 0) {
+	trackingSince = LatencyNow();
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AppendHistogram --
+ *
+ *	Append the counts of a histogram to the interpreter result as a
+ *	list of names and values.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Appends to interp->result.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AppendHistogram(interp, histPtr)
+    Tcl_Interp *interp;
+    LatencyHistogram *histPtr;
+{
+    char string[100];
+    int i;
+
+    sprintf(string, "count %lu avg %lu max %lu histogram {", histPtr->count,
+	    (histPtr->count > 0)
+		? (unsigned long) (histPtr->total / histPtr->count) : 0UL,
+	    histPtr->max);
+    Tcl_AppendResult(interp, string, (char *) NULL);
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+	sprintf(string, (i == 0) ? "%lu" : " %lu", histPtr->buckets[i]);
+	Tcl_AppendResult(interp, string, (char *) NULL);
+    }
+    Tcl_AppendResult(interp, "}", (char *) NULL);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2LatencyCmd --
+ *
+ *	This procedure is invoked to process the "os2latency" Tcl
+ *	command:
+ *
+ *	    os2latency enable ?boolean?
+ *	    os2latency buckets
+ *	    os2latency messages
+ *	    os2latency stats
+ *	    os2latency reset
+ *
+ * Results:
+ *	A standard Tcl result.  "buckets" returns the upper limits of the
+ *	histogram buckets in microseconds, the last bucket being open.
+ *	"messages" returns, for each message type seen, its name and a
+ *	list with the "proc" histogram (until the window procedure
+ *	returned) and the "handled" histogram (until Tk had handled the
+ *	events made from it).  "stats" returns the number of messages
+ *	and events, the throughput, and the histogram of the number of
+ *	timed events waiting in the queue (buckets 0, 1, 2-3, 4-7, ...).
+ *
+ * Side effects:
+ *	See the user documentation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkOS2LatencyCmd(clientData, interp, argc, argv)
+    ClientData clientData;	/* Not used. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings. */
+{
+    MessageLatency *latencyPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    char string[200], *name;
+    size_t length;
+    double elapsed;
+    int c, i, track, first;
+
+    if (argc < 2) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" option ?arg?\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+    c = argv[1][0];
+    length = strlen(argv[1]);
+    if ((c == 'b') && (strncmp(argv[1], "buckets", length) == 0)) {
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+	    sprintf(string, (i == 0) ? "%lu" : " %lu", latencyLimits[i]);
+	    Tcl_AppendResult(interp, string, (char *) NULL);
+	}
+    } else if ((c == 'e') && (strncmp(argv[1], "enable", length) == 0)) {
+	if (argc > 3) {
+	    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		    " enable ?boolean?\"", (char *) NULL);
+	    return TCL_ERROR;
+	}
+	if (argc == 3) {
+	    if (Tcl_GetBoolean(interp, argv[2], &track) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    TkOS2SetLatencyTracking(track);
+	}
+	Tcl_AppendResult(interp, latencyTracking ? "1" : "0", (char *) NULL);
+    } else if ((c == 'm') && (strncmp(argv[1], "messages", length) == 0)) {
+	if (!latencyInitialized) {
+	    return TCL_OK;
+	}
+	first = 1;
+	for (hPtr = Tcl_FirstHashEntry(&latencyTable, &search); hPtr != NULL;
+		hPtr = Tcl_NextHashEntry(&search)) {
+	    latencyPtr = (MessageLatency *) Tcl_GetHashValue(hPtr);
+	    name = NULL;
+	    for (i = 0; messageNames[i].name != NULL; i++) {
+		if (messageNames[i].message == latencyPtr->message) {
+		    name = messageNames[i].name;
+		    break;
+		}
+	    }
+	    if (name == NULL) {
+		sprintf(string, "0x%lx", latencyPtr->message);
+		name = string;
+	    }
+	    Tcl_AppendResult(interp, first ? "" : " ", name, " {proc {",
+		    (char *) NULL);
+	    first = 0;
+	    AppendHistogram(interp, &latencyPtr->proc);
+	    Tcl_AppendResult(interp, "} handled {", (char *) NULL);
+	    AppendHistogram(interp, &latencyPtr->handled);
+	    Tcl_AppendResult(interp, "}}", (char *) NULL);
+	}
+    } else if ((c == 'r') && (strncmp(argv[1], "reset", length) == 0)) {
+	ResetLatency();
+    } else if ((c == 's') && (strncmp(argv[1], "stats", length) == 0)) {
+	elapsed = (timerFrequency != 0)
+		? (LatencyNow() - trackingSince) / 1000.0 : 0.0;
+	sprintf(string, "messages %lu events %lu elapsed %lu rate %lu "
+		"waiting %d maxWaiting %d queue {", messagesTracked,
+		eventsHandled, (unsigned long) elapsed,
+		(elapsed > 0.0)
+		    ? (unsigned long) (messagesTracked * 1000.0 / elapsed) : 0UL,
+		latencyQueued, maxDepth);
+	Tcl_AppendResult(interp, string, (char *) NULL);
+	for (i = 0; i < DEPTH_BUCKETS; i++) {
+	    sprintf(string, (i == 0) ? "%lu" : " %lu", depthBuckets[i]);
+	    Tcl_AppendResult(interp, string, (char *) NULL);
+	}
+	Tcl_AppendResult(interp, "}", (char *) NULL);
+    } else {
+	Tcl_AppendResult(interp, "bad option \"", argv[1],
+		"\": must be buckets, enable, messages, reset, or stats",
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GetModifierState --
+ *
+ *	This function constructs a state mask for the mouse buttons 
+ *	and modifier keys.
+ *
+ * Results:
+ *	Returns a composite value of all the modifier and button state
+ *	flags that were set at the time the event occurred.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+unsigned int
+TkOS2GetModifierState(message, param1, param2)
+    ULONG message;		/* OS/2 PM message type */
+    MPARAM param1;		/* param1 of message, used if key message */
+    MPARAM param2;		/* param2 of message, used if key message */
+{
+    unsigned int state = 0;	/* accumulated state flags */
+    int isKeyEvent = 0;		/* 1 if message is a key press or release */
+    int prevState = 0;		/* 1 if key was previously down */
+    USHORT flags= SHORT1FROMMP(param1);
+    UCHAR krepeat= CHAR3FROMMP(param1);
+    UCHAR scancode= CHAR4FROMMP(param1);
+    USHORT charcode= SHORT1FROMMP(param2);
+    USHORT vkeycode= SHORT2FROMMP(param2); /* function key */
+
+#ifdef DEBUG
+printf("TkOS2GetModifierState fl %x, krepeat %d, scan %x, char %d, VK %x\n",
+flags, krepeat, scancode, charcode, vkeycode);
+#endif
+    /*
+     * If the event is a key press or release, we check for autorepeat.
+     */
+    if ( (flags & KC_CHAR) || (flags & KC_VIRTUALKEY) ) {
+	isKeyEvent = TRUE;
+	prevState = flags & KC_PREVDOWN;
+#ifdef DEBUG
+printf("    isKeyEvent\n");
+#endif
+    }
+
+    /*
+     * If the key being pressed or released is a modifier key, then
+     * we use its previous state, otherwise we look at the current state.
+     */
+
+    if (isKeyEvent && (vkeycode == VK_SHIFT)) {
+	state |= prevState ? ShiftMask : 0;
+    } else {
+	state |= (WinGetKeyState(HWND_DESKTOP, VK_SHIFT) & 0x8000)
+	         ? ShiftMask : 0;
+    }
+    if (isKeyEvent && (vkeycode == VK_CTRL)) {
+	state |= prevState ? ControlMask : 0;
+    } else {
+	state |= (WinGetKeyState(HWND_DESKTOP, VK_CTRL) & 0x8000)
+	         ? ControlMask : 0;
+    }
+    if (isKeyEvent && (vkeycode == VK_ALT)) {
+	state |= prevState ? Mod1Mask : 0;
+    } else {
+	state |= (WinGetKeyState(HWND_DESKTOP, VK_ALT) & 0x8000)
+	         ? Mod1Mask : 0;
+    }
+    if (isKeyEvent && (vkeycode == VK_MENU)) {
+	state |= prevState ? Mod2Mask : 0;
+    } else {
+	state |= (WinGetKeyState(HWND_DESKTOP, VK_MENU) & 0x8000)
+	         ? Mod2Mask : 0;
+    }
+
+    /*
+     * For toggle keys, we have to check both the previous key state
+     * and the current toggle state.  The result is the state of the
+     * toggle before the event.
+     */
+
+    if ((vkeycode == VK_CAPSLOCK) && !( flags & KC_KEYUP)) {
+	state = (prevState ^ (WinGetKeyState(HWND_DESKTOP, VK_CAPSLOCK) & 0x0001))
+	        ? 0 : LockMask;
+    } else {
+	state |= (WinGetKeyState(HWND_DESKTOP, VK_CAPSLOCK) & 0x0001)
+	         ? LockMask : 0;
+    }
+    if ((vkeycode == VK_NUMLOCK) && !( flags & KC_KEYUP)) {
+	state = (prevState ^ (WinGetKeyState(HWND_DESKTOP, VK_NUMLOCK) & 0x0001))
+	        ? 0 : Mod1Mask;
+    } else {
+	state |= (WinGetKeyState(HWND_DESKTOP, VK_NUMLOCK) & 0x0001)
+	         ? Mod1Mask : 0;
+    }
+    if ((vkeycode == VK_SCRLLOCK) && !( flags & KC_KEYUP)) {
+	state = (prevState ^ (WinGetKeyState(HWND_DESKTOP, VK_SCRLLOCK) & 0x0001))
+	        ? 0 : Mod3Mask;
+    } else {
+	state |= (WinGetKeyState(HWND_DESKTOP, VK_SCRLLOCK) & 0x0001)
+	         ? Mod3Mask : 0;
+    }
+
+    /*
+     * If a mouse button is being pressed or released, we use the previous
+     * state of the button.
+     */
+
+    if (message == WM_BUTTON1UP || (message != WM_BUTTON1DOWN
+	    && WinGetKeyState(HWND_DESKTOP, VK_BUTTON1) & 0x8000)) {
+	state |= Button1Mask;
+    }
+    if (message == WM_BUTTON2UP || (message != WM_BUTTON2DOWN
+	    && WinGetKeyState(HWND_DESKTOP, VK_BUTTON2) & 0x8000)) {
+	state |= Button2Mask;
+    }
+    if (message == WM_BUTTON3UP || (message != WM_BUTTON3DOWN
+	    && WinGetKeyState(HWND_DESKTOP, VK_BUTTON3) & 0x8000)) {
+	state |= Button3Mask;
+    }
+#ifdef DEBUG
+printf("    returning state %x\n", state);
+#endif
+    return state;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetTranslatedKey --		NOT USED
+ *
+ *	Retrieves WM_CHAR messages that are placed on the system queue
+ *	by the TranslateMessage system call and places them in the
+ *	given KeyPress event.
+ *
+ * Results:
+ *	Sets the trans_chars and nchars member of the key event.
+ *
+ * Side effects:
+ *	Removes any WM_CHAR messages waiting on the top of the system
+ *	event queue.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GetTranslatedKey(xkey)
+    XKeyEvent *xkey;
+{
+    QMSG msg;
+    
+    xkey->nchars = 0;
+
+    while (xkey->nchars < XMaxTransChars
+	    && WinPeekMsg(hab, &msg, NULLHANDLE, 0, 0, PM_NOREMOVE)) {
+/* WM_SYSCHAR not in PM
+	if ((msg.msg == WM_CHAR) || msg.msg == WM_SYSCHAR) {
+*/
+	if ((msg.msg == WM_CHAR)) {
+	    xkey->trans_chars[xkey->nchars] = SHORT1FROMMP(msg.mp2);
+	    xkey->nchars++;
+	    WinGetMsg(hab, &msg, NULLHANDLE, 0, 0);
+            if ((msg.msg == WM_CHAR) && ((LONG)msg.mp2 & 0x20000000)) {
+                xkey->state = 0;
+            }
+	} else {
+	    break;
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkOS2GetDrawableFromHandle --
+ *
+ *	Find the drawable associated with the given window handle.
+ *
+ * Results:
+ *	Returns a drawable pointer if the window is managed by Tk.
+ *	Otherwise it returns NULL.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TkOS2Drawable *
+TkOS2GetDrawableFromHandle(hwnd)
+    HWND hwnd;			/* OS/2 PM window handle */
+{
+    WindowSlot *slotPtr;
+    int mask, i;
+
+    if (hwnd == lastHwnd) {
+	return lastTodPtr;
+    }
+    if (hwnd == NULLHANDLE || windowSlots == NULL) {
+	return NULL;
+    }
+    mask = (1 << windowBits) - 1;
+    for (i = WINDOW_INDEX(hwnd); ; i = (i + 1) & mask) {
+	slotPtr = &windowSlots[i];
+	if (slotPtr->hwnd == hwnd) {
+	    lastHwnd = hwnd;
+	    lastTodPtr = slotPtr->todPtr;
+	    return slotPtr->todPtr;
+	}
+	if (slotPtr->hwnd == NULLHANDLE) {
+	    return NULL;
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddWindow --
+ *
+ *	Enter a newly created window in the window table.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May grow the table.  Panics if the handle is in the table
+ *	already.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AddWindow(hwnd, todPtr)
+    HWND hwnd;			/* OS/2 PM window handle */
+    TkOS2Drawable *todPtr;	/* Drawable to return for it */
+{
+    int mask, i;
+
+    if (2 * (numWindows + 1) > (1 << windowBits)) {
+	ResizeWindowTable(windowBits + 1);
+    }
+    mask = (1 << windowBits) - 1;
+    for (i = WINDOW_INDEX(hwnd); windowSlots[i].hwnd != NULLHANDLE;
+	    i = (i + 1) & mask) {
+	if (windowSlots[i].hwnd == hwnd) {
+	    panic("Duplicate window handle: %p", hwnd);
+	}
+    }
+    windowSlots[i].hwnd = hwnd;
+    windowSlots[i].todPtr = todPtr;
+    numWindows++;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RemoveWindow --
+ *
+ *	Remove a window from the window table.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Entries further along the probe sequence may move into the freed
+ *	slot, and the table may shrink.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RemoveWindow(hwnd)
+    HWND hwnd;			/* OS/2 PM window handle */
+{
+    int mask, i, j, home;
+
+    if (hwnd == lastHwnd) {
+	lastHwnd = NULLHANDLE;
+	lastTodPtr = NULL;
+    }
+    if (hwnd == NULLHANDLE || windowSlots == NULL) {
+	return;
+    }
+    mask = (1 << windowBits) - 1;
+    for (i = WINDOW_INDEX(hwnd); windowSlots[i].hwnd != hwnd;
+	    i = (i + 1) & mask) {
+	if (windowSlots[i].hwnd == NULLHANDLE) {
+	    return;
+	}
+    }
+
+    /*
+     * Close the gap: move back each following entry whose home slot
+     * does not lie (cyclically) between the gap and the entry itself.
+     */
+
+    for (j = (i + 1) & mask; windowSlots[j].hwnd != NULLHANDLE;
+	    j = (j + 1) & mask) {
+	home = WINDOW_INDEX(windowSlots[j].hwnd);
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    windowSlots[i] = windowSlots[j];
+	    i = j;
+	}
+    }
+    windowSlots[i].hwnd = NULLHANDLE;
+    windowSlots[i].todPtr = NULL;
+    numWindows--;
+
+    if ((windowBits > MIN_WINDOW_BITS)
+	    && (8 * numWindows < (1 << windowBits))) {
+	ResizeWindowTable(windowBits - 1);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ResizeWindowTable --
+ *
+ *	Rehash the window table into a table of 1 << bits slots.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Reallocates windowSlots.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ResizeWindowTable(bits)
+    int bits;
+{
+    WindowSlot *oldSlots = windowSlots;
+    int oldSize = (oldSlots == NULL) ? 0 : (1 << windowBits);
+    int size = 1 << bits;
+    int mask = size - 1;
+    int i, j;
+
+    windowSlots = (WindowSlot *) ckalloc(size * sizeof(WindowSlot));
+    memset((char *) windowSlots, 0, size * sizeof(WindowSlot));
+    windowBits = bits;
+    for (i = 0; i < oldSize; i++) {
+	if (oldSlots[i].hwnd == NULLHANDLE) {
+	    continue;
+	}
+	for (j = WINDOW_INDEX(oldSlots[i].hwnd);
+		windowSlots[j].hwnd != NULLHANDLE; j = (j + 1) & mask) {
+	    /* Empty loop body. */
+	}
+	windowSlots[j] = oldSlots[i];
+    }
+    if (oldSlots != NULL) {
+	ckfree((char *) oldSlots);
+    }
+#ifdef DEBUG
+    printf("ResizeWindowTable: %d slots for %d windows\n", size, numWindows);
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DeleteWindow --
+ *
+ *      Remove a window from the window table, and free the resources
+ *      associated with the drawable.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Frees the resources associated with a window handle.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DeleteWindow(hwnd)
+    HWND hwnd;
+{
+    TkOS2Drawable *todPtr;
+
+    /*
+     * Remove the window from the window table.
+     */
+
+    RemoveWindow(hwnd);
+    TkOS2CancelGeometry(hwnd);
+
     /*
      * Free the drawable associated with this window, unless the drawable
      * is still in use by a TkWindow.  This only happens in the case of
@@ -1767,6 +3583,16 @@ DeleteWindow(hwnd)
 #ifdef DEBUG
 printf("DeleteWindow: hwnd %x, todPtr %x\n", hwnd, todPtr);
 #endif
+
+    /*
+     * Forget a motion event held back for the window.
+     */
+
+    if (todPtr && (pendingMotionWinPtr != NULL)
+	    && (todPtr->window.winPtr == pendingMotionWinPtr)) {
+	pendingMotionWinPtr = NULL;
+    }
+
     if (todPtr) {
 #ifdef DEBUG
 printf("              todPtr->window.winPtr %x\n", todPtr->window.winPtr);